@@ -3,15 +3,369 @@
 //
 
 #include "Activation.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
 
-using std::exp;
+using std::cerr;
+using std::endl;
+using std::vector;
 
+#define BAD_ACTIVATION_ERR_MSG "Error: unknown activation type"
+#define NO_BACKWARD_ERR_MSG "Error: the activation has no backward pass: "
+
+// exp used by every softmax
+static ExpMode expMode = ExpAccurate;
+
+// _____________________________ built-in activations _____________________________
+
+/**
+ *
+ * @param data
+ * @param len
+ */
+static void reluApply(float *data, int len)
+{
+	simd().relu(data, data, len);
+}
+
+/**
+ *
+ * @param in
+ * @param out
+ * @param len
+ */
+static void reluReference(const float *in, float *out, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		out[i] = 0 < in[i] ? in[i] : 0;
+	}
+}
+
+/**
+ *
+ * @param out
+ * @param grad
+ * @param len
+ */
+static void reluBackward(const float *out, float *grad, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		grad[i] = 0 < out[i] ? grad[i] : 0;
+	}
+}
+
+/**
+ *
+ * @param data
+ * @param len
+ */
+static void softmaxApply(float *data, int len)
+{
+	const SimdKernels &kernels = simd();
+	float s = kernels.expSum(data, kernels.maxValue(data, len), data, len, expMode);
+	kernels.scale(data, 1 / s, data, len);
+}
+
+/**
+ *
+ * @param in
+ * @param out
+ * @param len
+ */
+static void softmaxReference(const float *in, float *out, int len)
+{
+	double shift = *std::max_element(in, in + len);
+	double total = 0;
+	for (int i = 0; i < len; i++)
+	{
+		total += std::exp(in[i] - shift);
+	}
+	for (int i = 0; i < len; i++)
+	{
+		out[i] = (float) (std::exp(in[i] - shift) / total);
+	}
+}
+
+/**
+ *
+ * @param data
+ * @param rows
+ * @param cols
+ */
+static void softmaxColumns(float *data, int rows, int cols)
+{
+	const SimdKernels &kernels = simd();
+	// walk the batch row by row and keep one running max and sum per column
+	vector<float> maxes(data, data + cols);
+	for (int i = 1; i < rows; i++)
+	{
+		for (int j = 0; j < cols; j++)
+		{
+			maxes[j] = data[i * cols + j] > maxes[j] ? data[i * cols + j] : maxes[j];
+		}
+	}
+	vector<float> sums(cols, 0);
+	for (int i = 0; i < rows; i++)
+	{
+		float *row = data + i * cols;
+		for (int j = 0; j < cols; j++)
+		{
+			row[j] -= maxes[j];
+		}
+		kernels.expSum(row, 0, row, cols, expMode);
+		kernels.add(sums.data(), row, sums.data(), cols);
+	}
+	for (int j = 0; j < cols; j++)
+	{
+		sums[j] = 1 / sums[j];
+	}
+	for (int i = 0; i < rows; i++)
+	{
+		float *row = data + i * cols;
+		for (int j = 0; j < cols; j++)
+		{
+			row[j] *= sums[j];
+		}
+	}
+}
+
+/**
+ * the gradient of the logits under cross-entropy is already given, so
+ * this holds in the last layer only (Trainer rejects a softmax elsewhere)
+ * @param out
+ * @param grad
+ * @param len
+ */
+static void softmaxBackward(const float *out, float *grad, int len)
+{
+	(void) out;
+	(void) grad;
+	(void) len;
+}
+
+/**
+ *
+ * @param data
+ * @param len
+ */
+static void geluApply(float *data, int len)
+{
+	simd().gelu(data, data, len);
+}
+
+/**
+ *
+ * @param in
+ * @param out
+ * @param len
+ */
+static void geluReference(const float *in, float *out, int len)
+{
+	const double sqrt2Pi = std::sqrt(2 / std::acos(-1.0));
+	for (int i = 0; i < len; i++)
+	{
+		double x = in[i];
+		out[i] = (float) (0.5 * x * (1 + std::tanh(sqrt2Pi * (x + 0.044715 * x * x * x))));
+	}
+}
+
+/**
+ *
+ * @param data
+ * @param len
+ */
+static void sigmoidApply(float *data, int len)
+{
+	simd().sigmoid(data, data, len);
+}
+
+/**
+ *
+ * @param in
+ * @param out
+ * @param len
+ */
+static void sigmoidReference(const float *in, float *out, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		out[i] = (float) (1 / (1 + std::exp(-(double) in[i])));
+	}
+}
+
+/**
+ *
+ * @param out
+ * @param grad
+ * @param len
+ */
+static void sigmoidBackward(const float *out, float *grad, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		grad[i] *= out[i] * (1 - out[i]);
+	}
+}
+
+/**
+ *
+ * @param data
+ * @param len
+ */
+static void tanhApply(float *data, int len)
+{
+	simd().tanh(data, data, len);
+}
+
+/**
+ *
+ * @param in
+ * @param out
+ * @param len
+ */
+static void tanhReference(const float *in, float *out, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		out[i] = (float) std::tanh((double) in[i]);
+	}
+}
+
+/**
+ *
+ * @param out
+ * @param grad
+ * @param len
+ */
+static void tanhBackward(const float *out, float *grad, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		grad[i] *= 1 - out[i] * out[i];
+	}
+}
+
+/**
+ *
+ * @param data
+ * @param len
+ */
+static void leakyReluApply(float *data, int len)
+{
+	simd().leakyRelu(data, LEAKY_RELU_SLOPE, data, len);
+}
+
+/**
+ *
+ * @param in
+ * @param out
+ * @param len
+ */
+static void leakyReluReference(const float *in, float *out, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		out[i] = in[i] < 0 ? LEAKY_RELU_SLOPE * in[i] : in[i];
+	}
+}
+
+/**
+ * the output is negative exactly when the input is, the slope is positive
+ * @param out
+ * @param grad
+ * @param len
+ */
+static void leakyReluBackward(const float *out, float *grad, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		grad[i] = out[i] < 0 ? LEAKY_RELU_SLOPE * grad[i] : grad[i];
+	}
+}
+
+/**
+ * the registry, the built-in activations first in ActivationType order
+ * @return the entries
+ */
+static vector<ActivationInfo> &registry()
+{
+	static vector<ActivationInfo> entries = {
+			{"relu",      reluApply,      reluReference,      nullptr,        EpilogueRelu, reluBackward},
+			{"softmax",   softmaxApply,   softmaxReference,   softmaxColumns, EpilogueNone, softmaxBackward},
+			{"gelu",      geluApply,      geluReference,      nullptr,        EpilogueNone, nullptr},
+			{"sigmoid",   sigmoidApply,   sigmoidReference,   nullptr,        EpilogueNone, sigmoidBackward},
+			{"tanh",      tanhApply,      tanhReference,      nullptr,        EpilogueNone, tanhBackward},
+			{"leakyrelu", leakyReluApply, leakyReluReference, nullptr,        EpilogueNone, leakyReluBackward}
+	};
+	return entries;
+}
+
+/**
+ *
+ * @param info
+ * @return
+ */
+ActivationType registerActivation(const ActivationInfo &info)
+{
+	registry().push_back(info);
+	return (ActivationType) (registry().size() - 1);
+}
+
+/**
+ *
+ * @param type
+ * @return
+ */
+const ActivationInfo &activationInfo(ActivationType type)
+{
+	if (type < 0 || type >= activationCount())
+	{
+		cerr << BAD_ACTIVATION_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	return registry()[type];
+}
+
+/**
+ *
+ * @param name
+ * @param type
+ * @return
+ */
+bool findActivation(const char *name, ActivationType *type)
+{
+	for (int i = 0; i < activationCount(); i++)
+	{
+		if (std::strcmp(registry()[i].name, name) == 0)
+		{
+			*type = (ActivationType) i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ *
+ * @return
+ */
+int activationCount()
+{
+	return (int) registry().size();
+}
+
+// _____________________________ Activation _____________________________
 
 /**
  *
  * @param actType
  */
-Activation::Activation(ActivationType actType) : type(actType)
+Activation::Activation(ActivationType actType) : type(actType), info(activationInfo(actType))
 {}
 
 /**
@@ -23,6 +377,33 @@ ActivationType Activation::getActivationType() const
 	return type;
 }
 
+/**
+ *
+ * @return
+ */
+const ActivationInfo &Activation::getInfo() const
+{
+	return info;
+}
+
+/**
+ *
+ * @param mode
+ */
+void Activation::setExpMode(ExpMode mode)
+{
+	expMode = mode;
+}
+
+/**
+ *
+ * @return
+ */
+ExpMode Activation::getExpMode()
+{
+	return expMode;
+}
+
 /**
  *
  * @param vec
@@ -30,29 +411,83 @@ ActivationType Activation::getActivationType() const
  */
 Matrix Activation::operator()(const Matrix &vec) const
 {
-	int len = vec.getRows() * vec.getCols();
-	Matrix r = Matrix(vec.getRows(), vec.getCols());
-	// Relu
-	if (type == Relu)
+	Matrix r = Matrix(vec);
+	apply(r.data(), r.getRows() * r.getCols());
+	return r;
+}
+
+/**
+ *
+ * @param data
+ * @param len
+ */
+void Activation::apply(float *data, int len) const
+{
+	info.apply(data, len);
+}
+
+/**
+ *
+ * @param batch
+ * @return
+ */
+Matrix Activation::applyPerColumn(const Matrix &batch) const
+{
+	Matrix r = Matrix(batch);
+	applyPerColumn(r.data(), r.getRows(), r.getCols());
+	return r;
+}
+
+/**
+ *
+ * @param data
+ * @param rows
+ * @param cols
+ */
+void Activation::applyPerColumn(float *data, int rows, int cols) const
+{
+	if (info.applyColumns == nullptr || cols == 1)
 	{
-		for (int i = 0; i < len; i++)
-		{
-			if (0 < vec[i])
-			{
-				r[i] = vec[i];
-			}
-		}
+		apply(data, rows * cols);
+		return;
+	}
+	info.applyColumns(data, rows, cols);
+}
+
+/**
+ *
+ * @param out
+ * @param grad
+ * @param len
+ */
+void Activation::backward(const float *out, float *grad, int len) const
+{
+	if (info.backward == nullptr)
+	{
+		cerr << NO_BACKWARD_ERR_MSG << info.name << endl;
+		exit(EXIT_FAILURE);
 	}
-		// Softmax
-	else
+	info.backward(out, grad, len);
+}
+
+/**
+ *
+ * @param logits
+ * @param len
+ * @param index
+ * @return
+ */
+float softmaxArgmax(const float *logits, int len, int *index)
+{
+	int best = 0;
+	for (int i = 1; i < len; i++)
 	{
-		float s = 0;
-		for (int i = 0; i < len; i++)
+		if (logits[i] > logits[best])
 		{
-			r[i] = exp(vec[i]);
-			s += exp(vec[i]);
+			best = i;
 		}
-		r = r * (1 / s);
 	}
-	return r;
+	*index = best;
+	// exp(max - max) is exactly 1 in both exp modes
+	return 1 / simd().expSum(logits, logits[best], nullptr, len, expMode);
 }
@@ -3,18 +3,105 @@
 #define ACTIVATION_H
 
 #include "Matrix.h"
+#include "Simd.h"
 #include <cmath>
 
 /**
  * @enum ActivationType
  * @brief Indicator of activation function.
+ * the built-in entries of the activation registry, in order;
+ * registerActivation hands out the values after the last one
  */
-enum ActivationType
+enum ActivationType : int
 {
 	Relu,
-	Softmax
+	Softmax,
+	Gelu,
+	Sigmoid,
+	Tanh,
+	LeakyRelu
 };
 
+// slope of LeakyRelu below 0
+#define LEAKY_RELU_SLOPE 0.01f
+
+/**
+ * @struct ActivationInfo
+ * @brief one entry of the activation registry: how to run an
+ * activation and how to check it
+ */
+typedef struct ActivationInfo
+{
+	/**
+	 * short lower-case name, e.g. "relu"
+	 */
+	const char *name;
+
+	/**
+	 * the activation in place, vectorized on the active simd level
+	 */
+	void (*apply)(float *data, int len);
+
+	/**
+	 * out = the activation of in, computed per element in double.
+	 * slow, the baseline apply is tested against
+	 */
+	void (*reference)(const float *in, float *out, int len);
+
+	/**
+	 * the activation in place on every column of a row-major
+	 * rows x cols matrix, each column taken as a vector of its own.
+	 * null for element-wise activations, which do not care
+	 */
+	void (*applyColumns)(float *data, int rows, int cols);
+
+	/**
+	 * the FusedEpilogue that computes the activation inside
+	 * SimdKernels::denseRows, EpilogueNone if there is none
+	 * (apply then runs on the outputs)
+	 */
+	FusedEpilogue epilogue;
+
+	/**
+	 * grad *= the derivative of the activation at the outputs out,
+	 * turning the gradient of the outputs into that of the inputs.
+	 * null when the derivative is not a function of the outputs
+	 * (gelu), such an activation can not be trained. softmax passes
+	 * grad through: it is only trained under cross-entropy, whose
+	 * gradient of the logits softmaxCrossEntropy gives directly
+	 */
+	void (*backward)(const float *out, float *grad, int len);
+} ActivationInfo;
+
+/**
+ * add an activation to the registry. not thread safe: register
+ * before building layers that use it. the info is copied
+ * @param info the activation, apply and reference must not be null
+ * @return the type that selects it
+ */
+ActivationType registerActivation(const ActivationInfo &info);
+
+/**
+ * the registry entry of a type, exits if there is none
+ * @param type the type
+ * @return its entry
+ */
+const ActivationInfo &activationInfo(ActivationType type);
+
+/**
+ * look up a registered activation by its name
+ * @param name the name, e.g. "relu"
+ * @param type out: its type, untouched if there is none
+ * @return true if the name is registered
+ */
+bool findActivation(const char *name, ActivationType *type);
+
+/**
+ * number of registered activations, the built-in ones included.
+ * the types are 0 to activationCount() - 1
+ * @return the count
+ */
+int activationCount();
 
 /**
  * the activation class represent the
@@ -25,9 +112,11 @@ class Activation
 {
 private:
 	ActivationType type;
+	// the registry entry, looked up once here rather than on every call
+	ActivationInfo info;
 public:
 	/**
-	 * regular constructor
+	 * regular constructor, exits on an unregistered type
 	 * @param type the type of activation function to active
 	 */
 	Activation(ActivationType type);
@@ -38,6 +127,24 @@ public:
 	 */
 	ActivationType getActivationType() const;
 
+	/**
+	 * the registry entry of the activation
+	 * @return name, kernels and epilogue
+	 */
+	const ActivationInfo &getInfo() const;
+
+	/**
+	 * the exp every softmax uses (process wide, accurate by default)
+	 * @param mode ExpAccurate or ExpFast, see SimdKernels::expSum
+	 */
+	static void setExpMode(ExpMode mode);
+
+	/**
+	 * the exp every softmax uses
+	 * @return the mode
+	 */
+	static ExpMode getExpMode();
+
 	/**
 	 * use the activation function on the vector vec
 	 * @param vec the vector to active the function on
@@ -45,6 +152,69 @@ public:
 	 * of the activation on vec
 	 */
 	Matrix operator()(const Matrix &vec) const;
+
+	/**
+	 * use the activation function on a lazy expression.
+	 * the expression is evaluated straight into the
+	 * result buffer, which is then activated in place
+	 * @param expr the expression to active the function on
+	 * @return new vector r which is the value
+	 * of the activation on expr
+	 */
+	template<class E>
+	Matrix operator()(const MatrixExpr<E> &expr) const
+	{
+		Matrix r = Matrix(expr);
+		apply(r.data(), r.getRows() * r.getCols());
+		return r;
+	}
+
+	/**
+	 * use the activation function on a raw vector in place,
+	 * without allocating, through the kernel of the registry.
+	 * softmax subtracts the max first,
+	 * so large logits do not overflow, and takes one exp per value
+	 * @param data the vector values
+	 * @param len number of values
+	 */
+	void apply(float *data, int len) const;
+
+	/**
+	 * use the activation function on every column of batch
+	 * as if each column was a vector of its own
+	 * (softmax normalizes each column separately)
+	 * @param batch matrix whose columns are vectors
+	 * @return new matrix with the activated columns
+	 */
+	Matrix applyPerColumn(const Matrix &batch) const;
+
+	/**
+	 * applyPerColumn in place, without allocating
+	 * @param data row-major rows x cols values
+	 * @param rows rows of the batch
+	 * @param cols cols of the batch, one vector each
+	 */
+	void applyPerColumn(float *data, int rows, int cols) const;
+
+	/**
+	 * backward pass: grad *= the derivative at the outputs,
+	 * see ActivationInfo::backward. exits if the activation has none
+	 * @param out the outputs of the activation
+	 * @param grad the gradient of the outputs, in place
+	 * @param len number of values
+	 */
+	void backward(const float *out, float *grad, int len) const;
 };
 
+/**
+ * the most probable entry of softmax(logits) and its probability,
+ * without computing the other probabilities: the argmax of the
+ * logits, with probability 1 / sum(exp(logits - max))
+ * @param logits the vector values
+ * @param len number of values, at least 1
+ * @param index out: index of the largest logit (the first one on ties)
+ * @return its softmax probability
+ */
+float softmaxArgmax(const float *logits, int len, int *index);
+
 #endif //ACTIVATION_H
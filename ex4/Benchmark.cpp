@@ -0,0 +1,319 @@
+// Benchmark.cpp
+
+#include "Benchmark.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#define FILTER_ARG "--filter="
+#define JSON_ARG "--json="
+#define MIN_TIME_ARG "--min-time="
+#define BENCH_ARG_ERR_MSG "Error: unknown benchmark option "
+#define BENCH_JSON_ERR_MSG "Error: can not write "
+// the iteration count grows by at most this factor between probes
+#define BENCH_MAX_GROWTH 10
+// and aims this far past the min time, so the last probe usually counts
+#define BENCH_OVERSHOOT 1.4
+#define BENCH_MAX_ITERATIONS 1000000000L
+
+using std::cerr;
+using std::endl;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+/**
+ * @struct Registered
+ * @brief a registered benchmark
+ */
+typedef struct Registered
+{
+	std::string name;
+	BenchBody body;
+} Registered;
+
+/**
+ * @struct BenchResult
+ * @brief the last probe of a benchmark
+ */
+typedef struct BenchResult
+{
+	std::string name;
+	long iterations;
+	double seconds;
+	double items, flops, bytes;
+	std::vector<std::pair<std::string, double>> counters;
+} BenchResult;
+
+/**
+ * the registry, in registration order
+ * @return the registered benchmarks
+ */
+std::vector<Registered> &registry()
+{
+	static std::vector<Registered> benchmarks;
+	return benchmarks;
+}
+
+/**
+ * a name as a JSON string: quotes and backslashes escaped
+ * @param text the name
+ * @return the quoted string
+ */
+std::string jsonString(const std::string &text)
+{
+	std::string out = "\"";
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+		}
+		out += c;
+	}
+	return out + "\"";
+}
+
+/**
+ * write the results in the layout of Google Benchmark's JSON output:
+ * a context object and a benchmarks array, times in ns per iteration
+ * @param path the file
+ * @param results the results
+ * @return false if the file could not be written
+ */
+bool writeJson(const char *path, const std::vector<BenchResult> &results)
+{
+	std::ofstream os(path, std::ios::trunc);
+	char date[64];
+	time_t now = time(nullptr);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+	os << "{\n  \"context\": {\n";
+	os << "    \"date\": " << jsonString(date) << ",\n";
+	os << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+	os << "    \"pool_threads\": " << ThreadPool::global().getThreads() << ",\n";
+	os << "    \"simd\": " << jsonString(simd().name) << "\n  },\n";
+	os << "  \"benchmarks\": [";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult &r = results[i];
+		os << (i ? ",\n" : "\n") << "    {\n";
+		os << "      \"name\": " << jsonString(r.name) << ",\n";
+		os << "      \"iterations\": " << r.iterations << ",\n";
+		os << "      \"real_time\": " << r.seconds / r.iterations * 1e9 << ",\n";
+		os << "      \"time_unit\": \"ns\"";
+		if (r.items > 0)
+		{
+			os << ",\n      \"items_per_second\": " << r.items * r.iterations / r.seconds;
+		}
+		if (r.flops > 0)
+		{
+			os << ",\n      \"gflops\": " << r.flops * r.iterations / r.seconds * 1e-9;
+		}
+		if (r.bytes > 0)
+		{
+			os << ",\n      \"bytes_per_second\": " << r.bytes * r.iterations / r.seconds;
+		}
+		for (const std::pair<std::string, double> &counter : r.counters)
+		{
+			os << ",\n      " << jsonString(counter.first) << ": " << counter.second;
+		}
+		os << "\n    }";
+	}
+	os << "\n  ]\n}\n";
+	os.close();
+	return !os.fail();
+}
+
+/**
+ * one line of the table
+ * @param r the result
+ */
+void printResult(const BenchResult &r)
+{
+	printf("%-44s %12.1f ns %10ld", r.name.c_str(), r.seconds / r.iterations * 1e9, r.iterations);
+	if (r.items > 0)
+	{
+		printf("  %10.4g items/s", r.items * r.iterations / r.seconds);
+	}
+	if (r.flops > 0)
+	{
+		printf("  %7.2f GFLOP/s", r.flops * r.iterations / r.seconds * 1e-9);
+	}
+	if (r.bytes > 0)
+	{
+		printf("  %7.2f GB/s", r.bytes * r.iterations / r.seconds * 1e-9);
+	}
+	for (const std::pair<std::string, double> &counter : r.counters)
+	{
+		printf("  %s=%g", counter.first.c_str(), counter.second);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+}
+
+/**
+ *
+ * @param iterations
+ */
+BenchState::BenchState(long iterations) : _iterations(iterations), _done(0), _seconds(0), _items(0), _flops(0),
+										  _bytes(0)
+{}
+
+/**
+ *
+ * @return
+ */
+bool BenchState::keepRunning()
+{
+	if (_done == 0)
+	{
+		_start = Clock::now();
+	}
+	if (_done < _iterations)
+	{
+		_done++;
+		return true;
+	}
+	_seconds = std::chrono::duration<double>(Clock::now() - _start).count();
+	return false;
+}
+
+long BenchState::getIterations() const
+{
+	return _iterations;
+}
+
+double BenchState::getSeconds() const
+{
+	return _seconds;
+}
+
+void BenchState::setItems(double perIteration)
+{
+	_items = perIteration;
+}
+
+void BenchState::setFlops(double perIteration)
+{
+	_flops = perIteration;
+}
+
+void BenchState::setBytes(double perIteration)
+{
+	_bytes = perIteration;
+}
+
+/**
+ *
+ * @param name
+ * @param value
+ */
+void BenchState::setCounter(const std::string &name, double value)
+{
+	_counters.emplace_back(name, value);
+}
+
+double BenchState::getItems() const
+{
+	return _items;
+}
+
+double BenchState::getFlops() const
+{
+	return _flops;
+}
+
+double BenchState::getBytes() const
+{
+	return _bytes;
+}
+
+const std::vector<std::pair<std::string, double>> &BenchState::getCounters() const
+{
+	return _counters;
+}
+
+/**
+ *
+ * @param name
+ * @param body
+ */
+void registerBenchmark(const std::string &name, const BenchBody &body)
+{
+	registry().push_back({name, body});
+}
+
+/**
+ *
+ * @param argc
+ * @param argv
+ * @return
+ */
+int runBenchmarks(int argc, char **argv)
+{
+	std::string filter;
+	const char *json = nullptr;
+	double minTime = BENCH_MIN_SECONDS;
+	for (int i = 0; i < argc; i++)
+	{
+		if (std::strncmp(argv[i], FILTER_ARG, std::strlen(FILTER_ARG)) == 0)
+		{
+			filter = argv[i] + std::strlen(FILTER_ARG);
+		}
+		else if (std::strncmp(argv[i], JSON_ARG, std::strlen(JSON_ARG)) == 0)
+		{
+			json = argv[i] + std::strlen(JSON_ARG);
+		}
+		else if (std::strncmp(argv[i], MIN_TIME_ARG, std::strlen(MIN_TIME_ARG)) == 0)
+		{
+			minTime = std::atof(argv[i] + std::strlen(MIN_TIME_ARG));
+		}
+		else
+		{
+			cerr << BENCH_ARG_ERR_MSG << argv[i] << endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<BenchResult> results;
+	for (const Registered &benchmark : registry())
+	{
+		if (benchmark.name.find(filter) == std::string::npos)
+		{
+			continue;
+		}
+		long iterations = 1;
+		while (true)
+		{
+			BenchState state(iterations);
+			benchmark.body(state);
+			double seconds = state.getSeconds();
+			if (seconds >= minTime || iterations >= BENCH_MAX_ITERATIONS)
+			{
+				results.push_back({benchmark.name, iterations, seconds, state.getItems(), state.getFlops(),
+								   state.getBytes(), state.getCounters()});
+				printResult(results.back());
+				break;
+			}
+			double wanted = seconds > 0 ? iterations * minTime * BENCH_OVERSHOOT / seconds
+										: (double) iterations * BENCH_MAX_GROWTH;
+			iterations = std::min(BENCH_MAX_ITERATIONS,
+								  std::max(iterations + 1,
+										   (long) std::min(wanted, (double) iterations * BENCH_MAX_GROWTH)));
+		}
+	}
+	if (json != nullptr && !writeJson(json, results))
+	{
+		cerr << BENCH_JSON_ERR_MSG << json << endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
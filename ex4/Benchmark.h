@@ -0,0 +1,120 @@
+// Benchmark.h
+// a small registry of parameterized benchmarks in the style of Google
+// Benchmark: a body times its own loop, the runner grows the iteration
+// count until the loop takes long enough, and the results are printed
+// as a table and optionally written as JSON for tracking across releases
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * default shortest measured loop, see --min-time
+ */
+#define BENCH_MIN_SECONDS 0.2
+
+/**
+ * the state of one run of a benchmark body:
+ *
+ *     registerBenchmark("axpy/len:4096", [](BenchState &state)
+ *     {
+ *         ... setup, not timed ...
+ *         while (state.keepRunning())
+ *             simd().axpy(2, x, y, 4096);
+ *         state.setFlops(2 * 4096);
+ *     });
+ */
+class BenchState
+{
+private:
+	long _iterations, _done;
+	std::chrono::steady_clock::time_point _start;
+	double _seconds;
+	double _items, _flops, _bytes;
+	std::vector<std::pair<std::string, double>> _counters;
+public:
+	/**
+	 * a run of the given length
+	 * @param iterations times keepRunning returns true
+	 */
+	explicit BenchState(long iterations);
+
+	/**
+	 * the loop condition of the timed loop. the clock starts on the
+	 * first call and stops on the one that returns false
+	 * @return true while iterations are left
+	 */
+	bool keepRunning();
+
+	long getIterations() const;
+
+	/**
+	 * the time of the whole loop
+	 * @return seconds
+	 */
+	double getSeconds() const;
+
+	/**
+	 * report items/s, e.g. images
+	 * @param perIteration items one iteration processes
+	 */
+	void setItems(double perIteration);
+
+	/**
+	 * report GFLOP/s
+	 * @param perIteration floating point operations of one iteration
+	 */
+	void setFlops(double perIteration);
+
+	/**
+	 * report GB/s
+	 * @param perIteration bytes one iteration reads and writes
+	 */
+	void setBytes(double perIteration);
+
+	/**
+	 * report any other value as is, e.g. a thread count or an error
+	 * @param name the counter
+	 * @param value its value
+	 */
+	void setCounter(const std::string &name, double value);
+
+	double getItems() const;
+
+	double getFlops() const;
+
+	double getBytes() const;
+
+	const std::vector<std::pair<std::string, double>> &getCounters() const;
+};
+
+/**
+ * a benchmark body, see BenchState
+ */
+typedef std::function<void(BenchState &)> BenchBody;
+
+/**
+ * add a benchmark. names are paths of parameters,
+ * e.g. "matmul/128x784/batch:64"
+ * @param name the name
+ * @param body the body
+ */
+void registerBenchmark(const std::string &name, const BenchBody &body);
+
+/**
+ * run the registered benchmarks in order and print a table.
+ * options: --filter=<text> runs only the names containing it,
+ * --json=<file> also writes the results there,
+ * --min-time=<seconds> the shortest measured loop (BENCH_MIN_SECONDS)
+ * @param argc number of options
+ * @param argv the options
+ * @return EXIT_SUCCESS, or EXIT_FAILURE on a bad option or file
+ */
+int runBenchmarks(int argc, char **argv);
+
+#endif //BENCHMARK_H
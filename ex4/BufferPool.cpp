@@ -0,0 +1,167 @@
+// BufferPool.cpp
+
+#include "BufferPool.h"
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+#define POOL_ERR_MSG "Error: out of memory"
+
+static std::atomic<long> requests(0);
+static std::atomic<long> reuses(0);
+static std::atomic<long> systemAllocations(0);
+static std::atomic<long> systemFrees(0);
+
+// set once the free lists of the thread are destroyed at thread exit:
+// buffers released after that (static matrices) go to the system.
+// trivially destructible, so it can still be read then, unlike the lists
+static thread_local bool listsDead = false;
+
+/**
+ * the released buffers of one thread, by size class.
+ * fixed arrays, so parking a buffer never allocates
+ */
+struct FreeLists
+{
+	float *buffers[POOL_CLASSES][POOL_CLASS_CAP];
+	int counts[POOL_CLASSES];
+	// bytes of all the parked buffers, at most POOL_THREAD_BYTES
+	long bytes;
+
+	FreeLists() : buffers(), counts(), bytes(0)
+	{}
+
+	~FreeLists()
+	{
+		for (int c = 0; c < POOL_CLASSES; c++)
+		{
+			for (int i = 0; i < counts[c]; i++)
+			{
+				std::free(buffers[c][i]);
+				systemFrees++;
+			}
+			counts[c] = 0;
+		}
+		listsDead = true;
+	}
+};
+
+static thread_local FreeLists lists;
+static thread_local long threadRequests = 0;
+
+/**
+ * the size class of a buffer
+ * @param len number of floats
+ * @return the class, POOL_CLASSES if too big for the pool
+ */
+static int sizeClass(int len)
+{
+	if (len <= POOL_MIN_FLOATS)
+	{
+		return 0;
+	}
+	// len is in (base, 2 * base] for a power of two base, whose doubling
+	// is split into POOL_CLASS_STEPS classes of base / POOL_CLASS_STEPS
+	int octave = (31 - __builtin_clz((unsigned int) len - 1)) - (31 - __builtin_clz(POOL_MIN_FLOATS));
+	int base = POOL_MIN_FLOATS << octave;
+	int step = (len - base - 1) / (base / POOL_CLASS_STEPS);
+	int c = 1 + octave * POOL_CLASS_STEPS + step;
+	return c < POOL_CLASSES ? c : POOL_CLASSES;
+}
+
+/**
+ * the bytes of a buffer of a size class, a multiple of POOL_ALIGN
+ * @param c the class, below POOL_CLASSES
+ * @return the bytes
+ */
+static size_t classBytes(int c)
+{
+	if (c == 0)
+	{
+		return sizeof(float) * POOL_MIN_FLOATS;
+	}
+	size_t base = (size_t) POOL_MIN_FLOATS << ((c - 1) / POOL_CLASS_STEPS);
+	size_t floats = base + base / POOL_CLASS_STEPS * ((c - 1) % POOL_CLASS_STEPS + 1);
+	return (sizeof(float) * floats + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+}
+
+/**
+ *
+ * @param len
+ * @return
+ */
+float *poolAllocate(int len)
+{
+	requests++;
+	threadRequests++;
+	int c = sizeClass(len);
+	if (c < POOL_CLASSES && !listsDead && lists.counts[c] > 0)
+	{
+		reuses++;
+		lists.bytes -= (long) classBytes(c);
+		return lists.buffers[c][--lists.counts[c]];
+	}
+	// aligned_alloc wants a multiple of the alignment
+	size_t bytes = c < POOL_CLASSES ? classBytes(c) :
+				   (sizeof(float) * (size_t) len + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+	void *buffer = std::aligned_alloc(POOL_ALIGN, bytes);
+	if (buffer == nullptr)
+	{
+		std::cerr << POOL_ERR_MSG << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	systemAllocations++;
+	return (float *) buffer;
+}
+
+/**
+ *
+ * @param buffer
+ * @param len
+ */
+void poolRelease(float *buffer, int len)
+{
+	if (buffer == nullptr)
+	{
+		return;
+	}
+	int c = sizeClass(len);
+	if (c < POOL_CLASSES && !listsDead && lists.counts[c] < POOL_CLASS_CAP &&
+		lists.bytes + (long) classBytes(c) <= POOL_THREAD_BYTES)
+	{
+		lists.bytes += (long) classBytes(c);
+		lists.buffers[c][lists.counts[c]++] = buffer;
+		return;
+	}
+	std::free(buffer);
+	systemFrees++;
+}
+
+/**
+ *
+ * @return
+ */
+long poolThreadRequests()
+{
+	return threadRequests;
+}
+
+/**
+ *
+ * @return
+ */
+PoolStats poolStats()
+{
+	return {requests.load(), reuses.load(), systemAllocations.load(), systemFrees.load()};
+}
+
+/**
+ *
+ */
+void resetPoolStats()
+{
+	requests = 0;
+	reuses = 0;
+	systemAllocations = 0;
+	systemFrees = 0;
+}
@@ -0,0 +1,93 @@
+// BufferPool.h
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+/**
+ * alignment of every pooled buffer: a cache line,
+ * and the widest simd load (avx-512)
+ */
+#define POOL_ALIGN 64
+
+/**
+ * the smallest size class, one cache line of floats
+ */
+#define POOL_MIN_FLOATS 16
+
+/**
+ * size classes per doubling above POOL_MIN_FLOATS: the class sizes
+ * step by a quarter of their power of two, so a buffer wastes at most
+ * a quarter of its size (a 784x128 matrix takes 114688 floats, not 131072)
+ */
+#define POOL_CLASS_STEPS 4
+
+/**
+ * POOL_MIN_FLOATS, then POOL_CLASS_STEPS classes per doubling
+ * up to POOL_MIN_FLOATS << 19 floats (32MB). bigger buffers bypass the pool
+ */
+#define POOL_CLASSES (1 + 19 * POOL_CLASS_STEPS)
+
+/**
+ * released buffers a thread keeps per size class,
+ * more are given back to the system
+ */
+#define POOL_CLASS_CAP 8
+
+/**
+ * bytes of released buffers a thread keeps over all its classes,
+ * buffers that do not fit are given back to the system
+ */
+#define POOL_THREAD_BYTES (32L << 20)
+
+/**
+ * @struct PoolStats
+ * @brief counters of the buffer pool, over all threads
+ */
+typedef struct PoolStats
+{
+	// poolAllocate calls
+	long requests;
+	// requests served from a free list
+	long reuses;
+	// buffers taken from / given back to the system
+	long systemAllocations, systemFrees;
+} PoolStats;
+
+/**
+ * a POOL_ALIGN aligned buffer of at least len floats, uninitialized.
+ * sizes are rounded up to a size class, and each thread keeps a few
+ * released buffers of every class, up to POOL_THREAD_BYTES in all, so
+ * temporaries of the same shapes are recycled instead of going to
+ * malloc every time.
+ * lock free: every thread has its own free lists
+ * @param len number of floats, at least 1
+ * @return the buffer
+ */
+float *poolAllocate(int len);
+
+/**
+ * give a buffer back, possibly to another thread than the allocating one
+ * @param buffer from poolAllocate, or nullptr
+ * @param len the len it was allocated with
+ */
+void poolRelease(float *buffer, int len);
+
+/**
+ * poolAllocate calls of the calling thread so far, a counter
+ * cheap enough to take before and after a call (see ProfileScope)
+ * @return the calls
+ */
+long poolThreadRequests();
+
+/**
+ * the pool counters
+ * @return counters since the start or the last resetPoolStats
+ */
+PoolStats poolStats();
+
+/**
+ * zero the pool counters
+ */
+void resetPoolStats();
+
+#endif //BUFFERPOOL_H
@@ -0,0 +1,179 @@
+// Dataset.cpp
+
+#include "Dataset.h"
+#include "Simd.h"
+#include <fstream>
+#include <iostream>
+
+#define IDX_READ_ERR_MSG "Error: not an IDX file of unsigned bytes: "
+#define IDX_COUNT_ERR_MSG "Error: the IDX images and labels do not match"
+#define IDX_WRITE_ERR_MSG "Error: can not write the IDX file "
+
+using std::cerr;
+using std::endl;
+
+/**
+ * read one big endian field of an IDX header
+ * @param is the stream
+ * @return the value
+ */
+static uint32_t readBigEndian(std::istream &is)
+{
+	unsigned char bytes[4] = {};
+	is.read((char *) bytes, sizeof(bytes));
+	return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | bytes[3];
+}
+
+/**
+ * write one big endian field of an IDX header
+ * @param os the stream
+ * @param value the value
+ */
+static void writeBigEndian(std::ostream &os, uint32_t value)
+{
+	unsigned char bytes[4] = {(unsigned char) (value >> 24), (unsigned char) (value >> 16),
+							  (unsigned char) (value >> 8), (unsigned char) value};
+	os.write((const char *) bytes, sizeof(bytes));
+}
+
+/**
+ * exit with the read error of a file
+ * @param path the file
+ */
+static void readFailed(const char *path)
+{
+	cerr << IDX_READ_ERR_MSG << path << endl;
+	exit(EXIT_FAILURE);
+}
+
+/**
+ *
+ * @param images
+ * @param labels
+ */
+IdxDataset::IdxDataset(const char *images, const char *labels) : _count(0), _rows(0), _cols(0)
+{
+	std::ifstream is(images, std::ios::binary);
+	if (!is.is_open() || readBigEndian(is) != IDX_IMAGES_MAGIC)
+	{
+		readFailed(images);
+	}
+	_count = (int) readBigEndian(is);
+	_rows = (int) readBigEndian(is);
+	_cols = (int) readBigEndian(is);
+	if (!is || _count < 0 || _rows <= 0 || _cols <= 0)
+	{
+		readFailed(images);
+	}
+	std::vector<unsigned char> pixels((size_t) _count * _rows * _cols);
+	is.read((char *) pixels.data(), (std::streamsize) pixels.size());
+	if (!is)
+	{
+		readFailed(images);
+	}
+	_images.resize(pixels.size());
+	simd().bytesToFloat(pixels.data(), IDX_PIXEL_SCALE, _images.data(), (int) pixels.size());
+
+	std::ifstream ls(labels, std::ios::binary);
+	if (!ls.is_open() || readBigEndian(ls) != IDX_LABELS_MAGIC)
+	{
+		readFailed(labels);
+	}
+	if ((int) readBigEndian(ls) != _count)
+	{
+		cerr << IDX_COUNT_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	std::vector<unsigned char> classes(_count);
+	ls.read((char *) classes.data(), (std::streamsize) classes.size());
+	if (!ls)
+	{
+		readFailed(labels);
+	}
+	_labels.assign(classes.begin(), classes.end());
+}
+
+/**
+ *
+ * @return
+ */
+int IdxDataset::getCount() const
+{
+	return _count;
+}
+
+/**
+ *
+ * @return
+ */
+int IdxDataset::getImageSize() const
+{
+	return _rows * _cols;
+}
+
+int IdxDataset::getRows() const
+{
+	return _rows;
+}
+
+int IdxDataset::getCols() const
+{
+	return _cols;
+}
+
+/**
+ *
+ * @param i
+ * @return
+ */
+const float *IdxDataset::image(int i) const
+{
+	return _images.data() + (size_t) i * _rows * _cols;
+}
+
+/**
+ *
+ * @param i
+ * @return
+ */
+int IdxDataset::label(int i) const
+{
+	return _labels[i];
+}
+
+/**
+ *
+ * @param images
+ * @param labels
+ * @param pixels
+ * @param classes
+ * @param count
+ * @param rows
+ * @param cols
+ */
+void writeIdx(const char *images, const char *labels, const uint8_t *pixels, const uint8_t *classes, int count,
+			  int rows, int cols)
+{
+	std::ofstream os(images, std::ios::binary | std::ios::trunc);
+	writeBigEndian(os, IDX_IMAGES_MAGIC);
+	writeBigEndian(os, (uint32_t) count);
+	writeBigEndian(os, (uint32_t) rows);
+	writeBigEndian(os, (uint32_t) cols);
+	os.write((const char *) pixels, (std::streamsize) count * rows * cols);
+	os.close();
+	if (!os)
+	{
+		cerr << IDX_WRITE_ERR_MSG << images << endl;
+		exit(EXIT_FAILURE);
+	}
+	std::ofstream ls(labels, std::ios::binary | std::ios::trunc);
+	writeBigEndian(ls, IDX_LABELS_MAGIC);
+	writeBigEndian(ls, (uint32_t) count);
+	ls.write((const char *) classes, count);
+	ls.close();
+	if (!ls)
+	{
+		cerr << IDX_WRITE_ERR_MSG << labels << endl;
+		exit(EXIT_FAILURE);
+	}
+}
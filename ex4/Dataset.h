@@ -0,0 +1,81 @@
+// Dataset.h
+
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <cstdint>
+#include <vector>
+
+// first 4 bytes of the IDX files of MNIST: 0, 0, the type (8 = unsigned
+// bytes) and the number of dims, big endian like every field after them
+#define IDX_IMAGES_MAGIC 0x00000803u
+#define IDX_LABELS_MAGIC 0x00000801u
+// pixels are scaled from [0, 255] to [0, 1]
+#define IDX_PIXEL_SCALE (1.0f / 255)
+
+/**
+ * a labeled image set in the IDX format of MNIST, read whole into
+ * memory: the images as floats in [0, 1], one contiguous row-major
+ * image after the other, and their labels
+ */
+class IdxDataset
+{
+private:
+	int _count, _rows, _cols;
+	std::vector<float> _images;
+	std::vector<int> _labels;
+public:
+	/**
+	 * read an images file and its labels file. exits if they are not
+	 * IDX files of unsigned bytes, or do not hold the same count
+	 * @param images the images file (e.g. train-images-idx3-ubyte)
+	 * @param labels the labels file (e.g. train-labels-idx1-ubyte)
+	 */
+	IdxDataset(const char *images, const char *labels);
+
+	/**
+	 * number of images
+	 * @return the count
+	 */
+	int getCount() const;
+
+	/**
+	 * values in one image
+	 * @return rows * cols
+	 */
+	int getImageSize() const;
+
+	int getRows() const;
+
+	int getCols() const;
+
+	/**
+	 * one image
+	 * @param i image index
+	 * @return getImageSize() values in [0, 1]
+	 */
+	const float *image(int i) const;
+
+	/**
+	 * the label of one image
+	 * @param i image index
+	 * @return the label
+	 */
+	int label(int i) const;
+};
+
+/**
+ * write an images file and its labels file in the IDX format.
+ * exits on failure
+ * @param images the images file to create
+ * @param labels the labels file to create
+ * @param pixels count * rows * cols pixels, image after image
+ * @param classes count labels
+ * @param count number of images
+ * @param rows rows of an image
+ * @param cols cols of an image
+ */
+void writeIdx(const char *images, const char *labels, const uint8_t *pixels, const uint8_t *classes, int count,
+			  int rows, int cols);
+
+#endif //DATASET_H
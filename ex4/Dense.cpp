@@ -3,6 +3,28 @@
 //
 
 #include "Dense.h"
+#include "Gemm.h"
+#include "Profile.h"
+#include "Simd.h"
+#include <utility>
+#include <vector>
+
+/**
+ *
+ * @param weights
+ * @return
+ */
+WeightFormat chooseWeightFormat(const Matrix &weights)
+{
+	float density = weightDensity(weights);
+	float csrCost = density * CSR_RELATIVE_COST;
+	float bsrCost = density / blockFill(weights) * BSR_RELATIVE_COST;
+	if (csrCost >= 1 && bsrCost >= 1)
+	{
+		return WeightsFloat;
+	}
+	return bsrCost <= csrCost ? WeightsBsr : WeightsCsr;
+}
 
 /**
  *
@@ -11,7 +33,19 @@
  * @param type
  */
 Dense::Dense(Matrix &weights, Matrix &biases, ActivationType type) : Wights(weights), bias(biases),
-																	 activation(type)
+																	 activation(type), mode(DenseFused),
+																	 format(WeightsFloat)
+{}
+
+/**
+ *
+ * @param weights
+ * @param biases
+ * @param type
+ */
+Dense::Dense(Matrix &&weights, Matrix &&biases, ActivationType type) :
+		Wights(std::move(weights)), bias(std::move(biases)), activation(type), mode(DenseFused),
+		format(WeightsFloat)
 {}
 
 /**
@@ -41,6 +75,88 @@ const Activation Dense::getActivation() const
 	return activation;
 }
 
+/**
+ *
+ * @return
+ */
+DenseMode Dense::getMode() const
+{
+	return mode;
+}
+
+/**
+ *
+ * @param newMode
+ */
+void Dense::setMode(DenseMode newMode)
+{
+	mode = newMode;
+}
+
+/**
+ *
+ * @return
+ */
+WeightFormat Dense::getWeightFormat() const
+{
+	return format;
+}
+
+/**
+ *
+ * @param newFormat
+ */
+void Dense::setWeightFormat(WeightFormat newFormat)
+{
+	if (newFormat == WeightsAuto)
+	{
+		newFormat = chooseWeightFormat(Wights);
+	}
+	if (newFormat == WeightsInt8 && quantized.getRows() == 0)
+	{
+		quantized = QuantizedMatrix(Wights);
+	}
+	if (newFormat == WeightsCsr && csr.getRows() == 0)
+	{
+		csr = CsrMatrix(Wights);
+	}
+	if (newFormat == WeightsBsr && bsr.getRows() == 0)
+	{
+		bsr = BsrMatrix(Wights);
+	}
+	if (newFormat == WeightsFp16 || newFormat == WeightsBf16)
+	{
+		HalfType type = newFormat == WeightsBf16 ? HalfBf16 : HalfFp16;
+		if (half.getRows() == 0 || half.getType() != type)
+		{
+			half = HalfMatrix(Wights, type);
+		}
+	}
+	format = newFormat;
+}
+
+/**
+ *
+ * @return
+ */
+size_t Dense::weightBytes() const
+{
+	switch (format)
+	{
+		case WeightsInt8:
+			return (size_t) quantized.getRows() * quantized.getStride() + quantized.getRows() * sizeof(float);
+		case WeightsCsr:
+			return csr.bytes();
+		case WeightsBsr:
+			return bsr.bytes();
+		case WeightsFp16:
+		case WeightsBf16:
+			return half.bytes();
+		default:
+			return (size_t) Wights.getRows() * Wights.getCols() * sizeof(float);
+	}
+}
+
 /**
  *
  * @param vec
@@ -48,6 +164,303 @@ const Activation Dense::getActivation() const
  */
 Matrix Dense::operator()(const Matrix &vec) const
 {
-	return activation((Wights * vec) + bias);
+	if ((mode == DenseFused || format != WeightsFloat) && vec.getCols() == 1 && vec.getRows() == Wights.getCols())
+	{
+		Matrix out(Wights.getRows(), 1, MatrixUninitialized);
+		forward(vec.data(), out.data());
+		return out;
+	}
+	if (format != WeightsFloat && vec.getRows() == Wights.getCols())
+	{
+		// several columns: the batch path keeps to the format, the float weights would not
+		return forwardBatch(vec);
+	}
+	Matrix product = Wights * vec;
+	return activation(product + bias);
+}
+
+
+/**
+ *
+ * @param in
+ * @param out
+ */
+void Dense::forward(const float *in, float *out) const
+{
+	int rows = Wights.getRows();
+	if (format != WeightsFloat)
+	{
+		forwardLinear(in, out);
+		PROFILE_SCOPE(step, "dense/activation");
+		activation.apply(out, rows);
+		return;
+	}
+	if (mode == DenseFused)
+	{
+		// one pass over the weights, the activation fused in when it has an epilogue,
+		// run on the outputs otherwise (softmax needs all of them first)
+		FusedEpilogue epilogue = activation.getInfo().epilogue;
+		{
+			PROFILE_SCOPE(step, "dense/fused");
+			PROFILE_COUNT(step, 2.0 * rows * Wights.getCols(), weightBytes());
+			simd().denseRows(Wights.data(), Wights.getCols(), in, bias.data(), out, rows, Wights.getCols(),
+							 epilogue);
+		}
+		if (epilogue == EpilogueNone)
+		{
+			PROFILE_SCOPE(step, "dense/activation");
+			activation.apply(out, rows);
+		}
+		return;
+	}
+	{
+		PROFILE_SCOPE(step, "dense/gemv");
+		PROFILE_COUNT(step, 2.0 * rows * Wights.getCols(), weightBytes());
+		gemm(rows, 1, Wights.getCols(), Wights.data(), Wights.getCols(), in, 1, out, 1);
+	}
+	{
+		PROFILE_SCOPE(step, "dense/bias");
+		simd().add(out, bias.data(), out, rows);
+	}
+	PROFILE_SCOPE(step, "dense/activation");
+	activation.apply(out, rows);
+}
+
+/**
+ *
+ * @param in
+ * @param out
+ */
+void Dense::forwardLinear(const float *in, float *out) const
+{
+	if (format == WeightsInt8)
+	{
+		PROFILE_SCOPE(step, "dense/gemv");
+		PROFILE_COUNT(step, 2.0 * Wights.getRows() * Wights.getCols(), weightBytes());
+		_linearInt8(in, out);
+		return;
+	}
+	if (format != WeightsFloat)
+	{
+		{
+			PROFILE_SCOPE(step, "dense/gemv");
+			PROFILE_COUNT(step, 2.0 * Wights.getRows() * Wights.getCols(), weightBytes());
+			if (format == WeightsCsr)
+			{
+				csr.multiply(in, out);
+			}
+			else if (format == WeightsBsr)
+			{
+				bsr.multiply(in, out);
+			}
+			else
+			{
+				half.multiply(in, out);
+			}
+		}
+		PROFILE_SCOPE(step, "dense/bias");
+		simd().add(out, bias.data(), out, Wights.getRows());
+		return;
+	}
+	PROFILE_SCOPE(step, "dense/fused");
+	PROFILE_COUNT(step, 2.0 * Wights.getRows() * Wights.getCols(), weightBytes());
+	simd().denseRows(Wights.data(), Wights.getCols(), in, bias.data(), out, Wights.getRows(), Wights.getCols(),
+					 EpilogueNone);
 }
 
+/**
+ *
+ * @param in
+ * @param out
+ */
+void Dense::_linearInt8(const float *in, float *out) const
+{
+	// per thread scratch, grown once to the widest layer seen
+	static thread_local std::vector<int8_t> x;
+	static thread_local std::vector<int32_t> acc;
+	int rows = quantized.getRows();
+	if ((int) x.size() < quantized.getStride())
+	{
+		x.resize(quantized.getStride());
+	}
+	if ((int) acc.size() < rows)
+	{
+		acc.resize(rows);
+	}
+	float inScale = quantizeVector(in, quantized.getCols(), x.data());
+	quantized.multiply(x.data(), acc.data());
+	const float *scales = quantized.scales();
+	const float *b = bias.data();
+	for (int i = 0; i < rows; i++)
+	{
+		out[i] = (float) acc[i] * (scales[i] * inScale) + b[i];
+	}
+}
+
+/**
+ *
+ * @param in
+ * @param out
+ */
+void Dense::_forwardInt8(const float *in, float *out) const
+{
+	_linearInt8(in, out);
+	activation.apply(out, quantized.getRows());
+}
+
+/**
+ *
+ * @param batch
+ * @return
+ */
+Matrix Dense::forwardBatch(const Matrix &batch) const
+{
+	Matrix out(Wights.getRows(), batch.getCols(), MatrixUninitialized);
+	forwardBatch(batch, out);
+	return out;
+}
+
+/**
+ *
+ * @param batch
+ * @param out
+ */
+void Dense::forwardBatch(const Matrix &batch, Matrix &out) const
+{
+	int rows = Wights.getRows();
+	int n = batch.getCols();
+	if (out.getRows() != rows || out.getCols() != n)
+	{
+		out = Matrix(rows, n, MatrixUninitialized);
+	}
+	if (format == WeightsInt8)
+	{
+		// the int8 kernel is matrix-vector: run the columns one by one
+		// through per thread scratch, grown once to the widest layer seen
+		static thread_local std::vector<float> in;
+		static thread_local std::vector<float> column;
+		if ((int) in.size() < batch.getRows())
+		{
+			in.resize(batch.getRows());
+		}
+		if ((int) column.size() < rows)
+		{
+			column.resize(rows);
+		}
+		for (int j = 0; j < n; j++)
+		{
+			ConstMatrixView inColumn = batch.view().col(j);
+			for (int i = 0; i < batch.getRows(); i++)
+			{
+				in[i] = inColumn(i, 0);
+			}
+			_forwardInt8(in.data(), column.data());
+			MatrixView outColumn = out.view().col(j);
+			for (int i = 0; i < rows; i++)
+			{
+				outColumn(i, 0) = column[i];
+			}
+		}
+		return;
+	}
+	{
+		PROFILE_SCOPE(step, "dense/gemm");
+		PROFILE_COUNT(step, 2.0 * rows * Wights.getCols() * n, weightBytes());
+		if (format == WeightsCsr)
+		{
+			csr.multiply(batch, out);
+		}
+		else if (format == WeightsBsr)
+		{
+			bsr.multiply(batch, out);
+		}
+		else if (format == WeightsFp16 || format == WeightsBf16)
+		{
+			half.multiply(batch, out);
+		}
+		else
+		{
+			gemm(Wights.view(), batch.view(), out.view());
+		}
+	}
+	{
+		PROFILE_SCOPE(step, "dense/bias");
+		float *row = out.data();
+		const float *b = bias.data();
+		for (int i = 0; i < rows; i++, row += n)
+		{
+			for (int j = 0; j < n; j++)
+			{
+				row[j] += b[i];
+			}
+		}
+	}
+	PROFILE_SCOPE(step, "dense/activation");
+	activation.applyPerColumn(out.data(), rows, n);
+}
+
+/**
+ *
+ * @param in
+ * @param out
+ * @param grad
+ * @param gradWeights
+ * @param gradBias
+ * @param gradIn
+ */
+void Dense::backwardBatch(const Matrix &in, const Matrix &out, Matrix &grad, Matrix &gradWeights, Matrix &gradBias,
+						  Matrix *gradIn) const
+{
+	int rows = Wights.getRows();
+	int n = grad.getCols();
+	activation.backward(out.data(), grad.data(), rows * n);
+	// dW = dZ * in^T, db = the row sums of dZ, d(in) = W^T * dZ
+	gemm(grad.view(), in.view().transposed(), gradWeights.view());
+	const float *row = grad.data();
+	float *gb = gradBias.data();
+	for (int i = 0; i < rows; i++, row += n)
+	{
+		float s = 0;
+		for (int j = 0; j < n; j++)
+		{
+			s += row[j];
+		}
+		gb[i] = s;
+	}
+	if (gradIn != nullptr)
+	{
+		gemm(Wights.view().transposed(), grad.view(), gradIn->view());
+	}
+}
+
+/**
+ *
+ * @return
+ */
+Matrix &Dense::trainableWeights()
+{
+	_dropDerivedWeights();
+	return Wights;
+}
+
+/**
+ *
+ * @return
+ */
+Matrix &Dense::trainableBias()
+{
+	_dropDerivedWeights();
+	return bias;
+}
+
+/**
+ *
+ */
+void Dense::_dropDerivedWeights()
+{
+	format = WeightsFloat;
+	quantized = QuantizedMatrix();
+	csr = CsrMatrix();
+	bsr = BsrMatrix();
+	half = HalfMatrix();
+}
@@ -7,6 +7,70 @@
 
 #include "Matrix.h"
 #include "Activation.h"
+#include "Quantize.h"
+#include "SparseMatrix.h"
+#include "HalfMatrix.h"
+
+/**
+ * @enum DenseMode
+ * @brief how a Dense layer runs a single input vector
+ */
+enum DenseMode
+{
+	// W * x, + bias and the activation as three passes
+	DenseUnfused,
+	// one pass: each output gets its bias and activation
+	// right after its dot product (the default)
+	DenseFused
+};
+
+/**
+ * @enum WeightFormat
+ * @brief what a Dense layer multiplies with
+ */
+enum WeightFormat
+{
+	// the float weights as loaded (the default)
+	WeightsFloat,
+	// per row int8 weights and a per vector int8 input, int32 sums,
+	// dequantized to float before the bias and activation
+	WeightsInt8,
+	// the non-zero weights in compressed sparse rows (CsrMatrix)
+	WeightsCsr,
+	// the non-zero 4x4 blocks of the weights (BsrMatrix)
+	WeightsBsr,
+	// the weights rounded to fp16 or bf16 (HalfMatrix), widened to
+	// float in registers: half the weight bytes to read per input
+	WeightsFp16,
+	WeightsBf16,
+	// not a format: setWeightFormat picks one by chooseWeightFormat
+	WeightsAuto
+};
+
+/**
+ * time of one stored value of a CsrMatrix (a gather and a multiply-add)
+ * relative to one weight of the fused dense kernel, measured on 128x784
+ * in bench. CSR pays off below a density of 1 / this
+ */
+#define CSR_RELATIVE_COST 16.0f
+
+/**
+ * time of one stored 4x4 block of a BsrMatrix relative to 16 weights
+ * of the fused dense kernel, measured the same way
+ */
+#define BSR_RELATIVE_COST 3.0f
+
+/**
+ * the fastest float format for a weight matrix on single vectors,
+ * from its measured density d and block fill f (see weightDensity,
+ * blockFill): the cheapest of WeightsFloat (cost 1), WeightsCsr
+ * (d * CSR_RELATIVE_COST) and WeightsBsr (d / f * BSR_RELATIVE_COST).
+ * the costs are measured on single vectors only; on the 64 column
+ * batches of bench the formats it picks are faster than float as well
+ * @param weights the weights
+ * @return the format
+ */
+WeightFormat chooseWeightFormat(const Matrix &weights);
 
 /**
  * the Dense class represent the whole Dense layer
@@ -17,6 +81,33 @@ private:
 	Matrix Wights;
 	Matrix bias;
 	Activation activation;
+	DenseMode mode;
+	WeightFormat format;
+	QuantizedMatrix quantized;
+	CsrMatrix csr;
+	BsrMatrix bsr;
+	// the one of WeightsFp16 / WeightsBf16 last set
+	HalfMatrix half;
+
+	/**
+	 * forward on the int8 weights
+	 * @param in the input vector, getWeights().getCols() values
+	 * @param out the output vector, getWeights().getRows() values
+	 */
+	void _forwardInt8(const float *in, float *out) const;
+
+	/**
+	 * W * x + b on the int8 weights, dequantized
+	 * @param in the input vector, getWeights().getCols() values
+	 * @param out the output vector, getWeights().getRows() values
+	 */
+	void _linearInt8(const float *in, float *out) const;
+
+	/**
+	 * back to WeightsFloat, dropping the int8, sparse and 16 bit weights
+	 * (about to go stale: the float ones are handed out for writing)
+	 */
+	void _dropDerivedWeights();
 public:
 	/**
 	 * regular constructor
@@ -28,6 +119,16 @@ public:
 	 */
 	Dense(Matrix &weights, Matrix &biases, ActivationType type);
 
+	/**
+	 * taking constructor. the layer takes the buffers of the
+	 * matrices instead of copying them, so borrowed matrices
+	 * (see Matrix::borrow) stay on their buffers
+	 * @param weights the wight matrix in the Dense layer
+	 * @param biases the bias vector in the Dense layer
+	 * @param type the activation type
+	 */
+	Dense(Matrix &&weights, Matrix &&biases, ActivationType type);
+
 	/**
 	 * get the values of the weights matrix
 	 * @return the value of the weights matrix
@@ -47,12 +148,111 @@ public:
 	const Activation getActivation() const;
 
 	/**
-	 * activate the layer on an input
+	 * get the execution mode of the layer
+	 * @return the mode
+	 */
+	DenseMode getMode() const;
+
+	/**
+	 * set the execution mode of the layer
+	 * @param newMode the mode single vectors will run in
+	 */
+	void setMode(DenseMode newMode);
+
+	/**
+	 * get the format of the weights the layer multiplies with
+	 * @return the format
+	 */
+	WeightFormat getWeightFormat() const;
+
+	/**
+	 * set the format of the weights the layer multiplies with.
+	 * the int8, sparse and 16 bit weights are built from the float ones
+	 * on the first switch; the float weights are kept so the layer can switch back
+	 * @param newFormat the format, WeightsAuto for chooseWeightFormat
+	 */
+	void setWeightFormat(WeightFormat newFormat);
+
+	/**
+	 * bytes of the weights the layer reads per input in its current format
+	 * @return the bytes
+	 */
+	size_t weightBytes() const;
+
+	/**
+	 * activate the layer on an input. in a weight format other than
+	 * float, an input of several columns runs as forwardBatch, so the
+	 * format is used for it as it is for a single vector
 	 * @param vec the matrix of the vector
 	 * which is the input to the layer
 	 * @return the output vector of the layer
 	 */
 	Matrix operator()(const Matrix &vec) const;
+
+	/**
+	 * activate the layer on a raw input vector into a
+	 * caller owned output buffer, without allocating
+	 * @param in the input vector, getWeights().getCols() values
+	 * @param out the output vector, getWeights().getRows() values
+	 */
+	void forward(const float *in, float *out) const;
+
+	/**
+	 * W * x + b without the activation (e.g. the logits of a
+	 * softmax layer), in the current weight format, without allocating
+	 * @param in the input vector, getWeights().getCols() values
+	 * @param out the output vector, getWeights().getRows() values
+	 */
+	void forwardLinear(const float *in, float *out) const;
+
+	/**
+	 * activate the layer on a batch of inputs at once.
+	 * the weights multiply the whole batch as one
+	 * matrix product and the bias is added to every column
+	 * @param batch matrix whose columns are the input vectors
+	 * @return matrix whose columns are the output vectors
+	 */
+	Matrix forwardBatch(const Matrix &batch) const;
+
+	/**
+	 * forwardBatch into a caller owned matrix, reshaped only if it
+	 * does not already have the shape of the outputs, so a buffer kept
+	 * across calls of the same batch size is reused, not reallocated
+	 * @param batch matrix whose columns are the input vectors
+	 * @param out matrix whose columns are the output vectors
+	 */
+	void forwardBatch(const Matrix &batch, Matrix &out) const;
+
+	/**
+	 * backward pass of a batch forwardBatch ran on: the gradients of
+	 * the loss by the weights, the bias and the inputs, from the one
+	 * by the outputs. the gradient buffers are caller owned and shaped,
+	 * so they are reused from step to step
+	 * @param in the input batch, inputs x n
+	 * @param out the outputs forwardBatch gave for it, outputs x n
+	 * @param grad the gradient by the outputs, outputs x n; overwritten
+	 * with the one by the pre-activations (see Activation::backward)
+	 * @param gradWeights set to the gradient by the weights, shaped as them
+	 * @param gradBias set to the gradient by the bias, shaped as it
+	 * @param gradIn set to the gradient by the inputs, inputs x n;
+	 * null to skip it (the first layer)
+	 */
+	void backwardBatch(const Matrix &in, const Matrix &out, Matrix &grad, Matrix &gradWeights, Matrix &gradBias,
+					   Matrix *gradIn) const;
+
+	/**
+	 * the weights, for an optimizer to update in place.
+	 * switches the layer to WeightsFloat and drops its int8, sparse and
+	 * 16 bit weights, which would go stale; set the format again after training
+	 * @return the float weights
+	 */
+	Matrix &trainableWeights();
+
+	/**
+	 * the bias, for an optimizer to update in place (see trainableWeights)
+	 * @return the bias
+	 */
+	Matrix &trainableBias();
 };
 
 
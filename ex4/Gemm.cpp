@@ -0,0 +1,506 @@
+// Gemm.cpp
+
+#include "Gemm.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+// cache blocks. MC x KC of A stays in L2, KC x NR sliver of B stays in L1.
+// MC is a multiple of every register tile height in the simd tables
+#define MC 96
+#define KC 256
+#define NC 2048
+
+// bytes of A rows the multi-vector gemv keeps in L1 while every
+// vector of the batch passes over them
+#define GEMV_BLOCK_BYTES (16 * 1024)
+
+#define GEMM_SHAPE_ERR_MSG "Error: the shapes of the product views do not match"
+
+using std::cerr;
+using std::endl;
+using std::min;
+using std::vector;
+
+// products with less multiply-adds stay on the calling thread
+static long parallelThreshold = GEMM_PARALLEL_MACS;
+
+/**
+ * pack a mc x kc block of A into mr row panels,
+ * each panel stored column after column. edge panels
+ * are zero padded so the micro-kernel never branches
+ * @param mc rows in the block
+ * @param kc cols in the block
+ * @param a block start
+ * @param rsa distance between two rows of A
+ * @param csa distance between two cols of A
+ * @param packed destination
+ * @param tileRows panel height (register tile rows)
+ */
+static void packA(int mc, int kc, const float *a, int rsa, int csa, float *packed, int tileRows)
+{
+	for (int ir = 0; ir < mc; ir += tileRows)
+	{
+		int mr = min(tileRows, mc - ir);
+		for (int p = 0; p < kc; p++)
+		{
+			for (int i = 0; i < mr; i++)
+			{
+				packed[i] = a[(ir + i) * rsa + p * csa];
+			}
+			for (int i = mr; i < tileRows; i++)
+			{
+				packed[i] = 0;
+			}
+			packed += tileRows;
+		}
+	}
+}
+
+/**
+ * pack a kc x nc block of B into nr col panels,
+ * each panel stored row after row, zero padded
+ * @param kc rows in the block
+ * @param nc cols in the block
+ * @param b block start
+ * @param rsb distance between two rows of B
+ * @param csb distance between two cols of B
+ * @param packed destination
+ * @param tileCols panel width (register tile cols)
+ */
+static void packB(int kc, int nc, const float *b, int rsb, int csb, float *packed, int tileCols)
+{
+	for (int jr = 0; jr < nc; jr += tileCols)
+	{
+		int nr = min(tileCols, nc - jr);
+		if (rsb == 1 && csb != 1)
+		{
+			// B is a transpose: its cols are contiguous, walk down them
+			for (int j = 0; j < nr; j++)
+			{
+				const float *col = b + (jr + j) * csb;
+				for (int p = 0; p < kc; p++)
+				{
+					packed[p * tileCols + j] = col[p];
+				}
+			}
+			for (int p = 0; p < kc; p++)
+			{
+				for (int j = nr; j < tileCols; j++)
+				{
+					packed[p * tileCols + j] = 0;
+				}
+			}
+			packed += kc * tileCols;
+			continue;
+		}
+		for (int p = 0; p < kc; p++)
+		{
+			const float *row = b + p * rsb + jr * csb;
+			if (csb == 1)
+			{
+				for (int j = 0; j < nr; j++)
+				{
+					packed[j] = row[j];
+				}
+			}
+			else
+			{
+				for (int j = 0; j < nr; j++)
+				{
+					packed[j] = row[j * csb];
+				}
+			}
+			for (int j = nr; j < tileCols; j++)
+			{
+				packed[j] = 0;
+			}
+			packed += tileCols;
+		}
+	}
+}
+
+/**
+ * y = A * x for a row-major A, one dot product per row
+ * (the simd denseRows kernel without bias and epilogue)
+ * @param m rows of A
+ * @param k cols of A
+ * @param a the A buffer
+ * @param lda distance between two rows of A
+ * @param x the vector, read with stride incx
+ * @param incx distance between two elements of x
+ * @param y the result, written with stride incy
+ * @param incy distance between two elements of y
+ */
+static void gemv(int m, int k, const float *a, int lda, const float *x, int incx, float *y, int incy)
+{
+	const float *xs = x;
+	vector<float> contiguous;
+	if (incx != 1)
+	{
+		contiguous.resize(k);
+		for (int p = 0; p < k; p++)
+		{
+			contiguous[p] = x[p * incx];
+		}
+		xs = contiguous.data();
+	}
+	ThreadPool &pool = ThreadPool::global();
+	if (incy == 1 && (long) m * k >= parallelThreshold && pool.getThreads() > 1)
+	{
+		// row chunks, a multiple of the four rows denseRows does at once
+		int chunk = (m + pool.getThreads() - 1) / pool.getThreads();
+		chunk = (chunk + 3) / 4 * 4;
+		pool.parallelFor((m + chunk - 1) / chunk, [&](int task)
+		{
+			int first = task * chunk;
+			simd().denseRows(a + first * lda, lda, xs, nullptr, y + first, min(chunk, m - first), k,
+							 EpilogueNone);
+		});
+		return;
+	}
+	if (incy == 1)
+	{
+		simd().denseRows(a, lda, xs, nullptr, y, m, k, EpilogueNone);
+		return;
+	}
+	for (int i = 0; i < m; i++)
+	{
+		simd().denseRows(a + i * lda, lda, xs, nullptr, y + i * incy, 1, k, EpilogueNone);
+	}
+}
+
+/**
+ * y = A^T * x where A^T is m x k and A is stored k x m row-major:
+ * adds x[p] times stored row p of A to y, so A is still read
+ * row by row instead of down its columns
+ * @param m rows of A^T (cols of the stored A)
+ * @param k cols of A^T (rows of the stored A)
+ * @param a the stored A buffer
+ * @param lda distance between two stored rows of A
+ * @param x the vector, read with stride incx
+ * @param incx distance between two elements of x
+ * @param y the result, written with stride incy
+ * @param incy distance between two elements of y
+ */
+static void gemvTransposed(int m, int k, const float *a, int lda, const float *x, int incx, float *y, int incy)
+{
+	static thread_local vector<float> sums;
+	sums.assign(m, 0);
+	const SimdKernels &kernels = simd();
+	for (int p = 0; p < k; p++)
+	{
+		kernels.axpy(x[p * incx], a + p * lda, sums.data(), m);
+	}
+	for (int i = 0; i < m; i++)
+	{
+		y[i * incy] = sums[i];
+	}
+}
+
+/**
+ * C = A * B for a row-major A and a few cols of B: the cols are
+ * copied out contiguous, then A is walked by blocks of rows small
+ * enough to stay in L1 and every col runs the denseRows kernel over
+ * the block. A is read from memory once, like gemv, and no panel is
+ * packed, which is what the blocked kernel spends its time on when
+ * n is much smaller than its register tile
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param k cols of A and rows of B
+ * @param a the A buffer
+ * @param lda distance between two rows of A
+ * @param b the B buffer
+ * @param rsb distance between two rows of B
+ * @param csb distance between two cols of B
+ * @param c the C buffer
+ * @param ldc distance between two rows of C
+ */
+static void gemvMulti(int m, int n, int k, const float *a, int lda, const float *b, int rsb, int csb, float *c,
+					  int ldc)
+{
+	static thread_local vector<float> cols;
+	static thread_local vector<float> sums;
+	cols.resize((size_t) n * k);
+	sums.resize((size_t) n * m);
+	for (int p = 0; p < k; p++)
+	{
+		for (int j = 0; j < n; j++)
+		{
+			cols[(size_t) j * k + p] = b[p * rsb + j * csb];
+		}
+	}
+	// a multiple of the four rows denseRows does at once
+	int rowBlock = std::max(4, GEMV_BLOCK_BYTES / (int) sizeof(float) / std::max(k, 1) / 4 * 4);
+	const float *xs = cols.data();
+	float *ys = sums.data();
+	auto block = [&](int task)
+	{
+		int first = task * rowBlock;
+		int rows = min(rowBlock, m - first);
+		for (int j = 0; j < n; j++)
+		{
+			simd().denseRows(a + first * lda, lda, xs + (size_t) j * k, nullptr, ys + (size_t) j * m + first, rows,
+							 k, EpilogueNone);
+		}
+	};
+	int blocks = (m + rowBlock - 1) / rowBlock;
+	ThreadPool &pool = ThreadPool::global();
+	if ((long) m * n * k >= parallelThreshold && pool.getThreads() > 1)
+	{
+		pool.parallelFor(blocks, block);
+	}
+	else
+	{
+		for (int task = 0; task < blocks; task++)
+		{
+			block(task);
+		}
+	}
+	for (int i = 0; i < m; i++)
+	{
+		float *row = c + i * ldc;
+		for (int j = 0; j < n; j++)
+		{
+			row[j] = ys[(size_t) j * m + i];
+		}
+	}
+}
+
+/**
+ * the plain i-k-j loop on any strides, C = A * B
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param k cols of A and rows of B
+ * @param a the A buffer
+ * @param rsa distance between two rows of A
+ * @param csa distance between two cols of A
+ * @param b the B buffer
+ * @param rsb distance between two rows of B
+ * @param csb distance between two cols of B
+ * @param c the C buffer
+ * @param rsc distance between two rows of C
+ * @param csc distance between two cols of C
+ */
+static void naiveStrided(int m, int n, int k, const float *a, int rsa, int csa, const float *b, int rsb, int csb,
+						 float *c, int rsc, int csc)
+{
+	for (int i = 0; i < m; i++)
+	{
+		float *row = c + i * rsc;
+		for (int j = 0; j < n; j++)
+		{
+			row[j * csc] = 0;
+		}
+		for (int p = 0; p < k; p++)
+		{
+			float aip = a[i * rsa + p * csa];
+			const float *bRow = b + p * rsb;
+			for (int j = 0; j < n; j++)
+			{
+				row[j * csc] += aip * bRow[j * csb];
+			}
+		}
+	}
+}
+
+/**
+ *
+ * @param m
+ * @param n
+ * @param k
+ * @param a
+ * @param lda
+ * @param b
+ * @param ldb
+ * @param c
+ * @param ldc
+ */
+void gemmNaive(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc)
+{
+	for (int i = 0; i < m; i++)
+	{
+		float *row = c + i * ldc;
+		for (int j = 0; j < n; j++)
+		{
+			row[j] = 0;
+		}
+		for (int p = 0; p < k; p++)
+		{
+			float aip = a[i * lda + p];
+			const float *bRow = b + p * ldb;
+			for (int j = 0; j < n; j++)
+			{
+				row[j] += aip * bRow[j];
+			}
+		}
+	}
+}
+
+/**
+ * C = A * B on A and B of any strides, C of unit col stride:
+ * picks the gemv (by rows of A, or by rows of the stored A when A
+ * is a transpose), the multi-vector gemv for a few cols of B,
+ * the plain loop or the blocked kernel (whose
+ * packing absorbs the strides and reads transposes along their
+ * contiguous side)
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param k cols of A and rows of B
+ * @param a the A buffer
+ * @param rsa distance between two rows of A
+ * @param csa distance between two cols of A
+ * @param b the B buffer
+ * @param rsb distance between two rows of B
+ * @param csb distance between two cols of B
+ * @param c the C buffer
+ * @param ldc distance between two rows of C
+ */
+static void gemmStrided(int m, int n, int k, const float *a, int rsa, int csa, const float *b, int rsb, int csb,
+						float *c, int ldc)
+{
+	if (n == 1 && csa == 1)
+	{
+		gemv(m, k, a, rsa, b, rsb, c, ldc);
+		return;
+	}
+	if (n == 1 && rsa == 1)
+	{
+		gemvTransposed(m, k, a, csa, b, rsb, c, ldc);
+		return;
+	}
+	if (n <= GEMM_GEMV_COLS && csa == 1)
+	{
+		gemvMulti(m, n, k, a, rsa, b, rsb, csb, c, ldc);
+		return;
+	}
+	if ((long) m * n * k < GEMM_TINY_FLOPS)
+	{
+		if (csa == 1 && csb == 1)
+		{
+			gemmNaive(m, n, k, a, rsa, b, rsb, c, ldc);
+		}
+		else
+		{
+			naiveStrided(m, n, k, a, rsa, csa, b, rsb, csb, c, ldc, 1);
+		}
+		return;
+	}
+
+	const SimdKernels &kernels = simd();
+	const int tileRows = kernels.gemmMr;
+	const int tileCols = kernels.gemmNr;
+	ThreadPool &pool = ThreadPool::global();
+	int threads = (long) m * n * k < parallelThreshold ? 1 : pool.getThreads();
+
+	// output row blocks handed to the threads: at most MC rows,
+	// smaller when that is needed to give every thread a block
+	int rowBlock = min(MC, (m + threads - 1) / threads);
+	rowBlock = (rowBlock + tileRows - 1) / tileRows * tileRows;
+	int blocks = (m + rowBlock - 1) / rowBlock;
+
+	// packing buffers are kept per thread so repeated calls do not allocate
+	static thread_local vector<float> packedB;
+	packedB.resize((size_t) KC * (NC + tileCols));
+
+	for (int jc = 0; jc < n; jc += NC)
+	{
+		int nc = min(NC, n - jc);
+		for (int pc = 0; pc < k; pc += KC)
+		{
+			int kc = min(KC, k - pc);
+			const float *panelB = packedB.data();
+			packB(kc, nc, b + pc * rsb + jc * csb, rsb, csb, packedB.data(), tileCols);
+			auto block = [&](int task)
+			{
+				static thread_local vector<float> packedA;
+				packedA.resize((size_t) MC * KC);
+				int ic = task * rowBlock;
+				int mc = min(rowBlock, m - ic);
+				packA(mc, kc, a + ic * rsa + pc * csa, rsa, csa, packedA.data(), tileRows);
+				for (int jr = 0; jr < nc; jr += tileCols)
+				{
+					for (int ir = 0; ir < mc; ir += tileRows)
+					{
+						kernels.gemmTile(kc, packedA.data() + ir * kc, panelB + jr * kc,
+										 c + (ic + ir) * ldc + jc + jr, ldc,
+										 min(tileRows, mc - ir), min(tileCols, nc - jr), pc != 0);
+					}
+				}
+			};
+			if (threads > 1)
+			{
+				pool.parallelFor(blocks, block);
+			}
+			else
+			{
+				for (int task = 0; task < blocks; task++)
+				{
+					block(task);
+				}
+			}
+		}
+	}
+}
+
+/**
+ *
+ * @param m
+ * @param n
+ * @param k
+ * @param a
+ * @param lda
+ * @param b
+ * @param ldb
+ * @param c
+ * @param ldc
+ */
+void gemm(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc)
+{
+	gemmStrided(m, n, k, a, lda, 1, b, ldb, 1, c, ldc);
+}
+
+/**
+ *
+ * @param a
+ * @param b
+ * @param c
+ */
+void gemm(ConstMatrixView a, ConstMatrixView b, MatrixView c)
+{
+	int m = a.getRows();
+	int n = b.getCols();
+	int k = a.getCols();
+	if (b.getRows() != k || c.getRows() != m || c.getCols() != n)
+	{
+		cerr << GEMM_SHAPE_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	if (c.getColStride() == 1)
+	{
+		gemmStrided(m, n, k, a.data(), a.getRowStride(), a.getColStride(), b.data(), b.getRowStride(),
+					b.getColStride(), c.data(), c.getRowStride());
+	}
+	else if (c.getRowStride() == 1)
+	{
+		// a transposed C: compute C^T = B^T * A^T into it
+		gemmStrided(n, m, k, b.data(), b.getColStride(), b.getRowStride(), a.data(), a.getColStride(),
+					a.getRowStride(), c.data(), c.getColStride());
+	}
+	else
+	{
+		naiveStrided(m, n, k, a.data(), a.getRowStride(), a.getColStride(), b.data(), b.getRowStride(),
+					 b.getColStride(), c.data(), c.getRowStride(), c.getColStride());
+	}
+}
+
+/**
+ *
+ * @param macs
+ */
+void setGemmParallelThreshold(long macs)
+{
+	parallelThreshold = macs;
+}
@@ -0,0 +1,77 @@
+// Gemm.h
+
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "MatrixView.h"
+
+/**
+ * products with less multiply-adds than this
+ * are done by the plain loop, packing them costs more
+ * than it saves
+ */
+#define GEMM_TINY_FLOPS 4096
+
+/**
+ * products with at most this many cols of B (small batches) and a
+ * row-major A run as one gemv per col over L1 sized row blocks of A,
+ * packing A and B costs more than the blocked kernel saves there
+ */
+#define GEMM_GEMV_COLS 16
+
+/**
+ * default for setGemmParallelThreshold. below about a million
+ * multiply-adds waking the workers costs more than it saves
+ */
+#define GEMM_PARALLEL_MACS (1L << 20)
+
+/**
+ * general matrix multiplication C = A * B
+ * on row-major buffers. C is overwritten.
+ * big products run on a cache blocked kernel:
+ * B is packed into KC x NC panels (L2/L3),
+ * A into MC x KC panels (L2), and a register
+ * tile micro-kernel from the simd table walks the packed panels (L1).
+ * n == 1 (matrix-vector) goes to a row-dot kernel since
+ * every weight is read only once anyway, n up to GEMM_GEMV_COLS
+ * to the same kernel over L1 sized row blocks of A.
+ * products of at least the parallel threshold are split by row blocks
+ * of C over ThreadPool::global()
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param k cols of A and rows of B
+ * @param a the A buffer
+ * @param lda distance between two rows of A
+ * @param b the B buffer
+ * @param ldb distance between two rows of B
+ * @param c the C buffer
+ * @param ldc distance between two rows of C
+ */
+void gemm(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc);
+
+/**
+ * general matrix multiplication C = A * B on views of any strides,
+ * e.g. blocks or transposes of matrices, without copying them first
+ * (the packing of the blocked kernel reads the strides).
+ * C is overwritten; exits if the shapes do not match
+ * @param a the A view
+ * @param b the B view
+ * @param c the C view
+ */
+void gemm(ConstMatrixView a, ConstMatrixView b, MatrixView c);
+
+/**
+ * the plain i-k-j loop used for tiny products
+ * (and as a reference). C is overwritten.
+ * params as in gemm
+ */
+void gemmNaive(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc);
+
+/**
+ * set the size from which gemm splits its work over the threads
+ * of ThreadPool::global() (whose size is set with setThreads)
+ * @param macs multiply-adds (m * n * k) of the smallest parallel product
+ */
+void setGemmParallelThreshold(long macs);
+
+#endif //GEMM_H
@@ -0,0 +1,177 @@
+// HalfMatrix.cpp
+
+#include "HalfMatrix.h"
+#include "Gemm.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#define HALF_SHAPE_ERR_MSG "Error: the shapes of the half precision product do not match"
+
+// float bit patterns the fp16 rounding is decided by
+#define FLOAT_INF_BITS 0x7f800000u
+// 65520, the first float that rounds past the largest fp16 (65504)
+#define FP16_OVERFLOW_BITS 0x477ff000u
+// 2^-14, the smallest normal fp16
+#define FP16_NORMAL_BITS 0x38800000u
+// the exponent bias difference, 127 - 15, in place
+#define FP16_REBIAS_BITS 0x38000000u
+
+using std::cerr;
+using std::endl;
+
+/**
+ *
+ * @param value
+ * @return
+ */
+uint16_t floatToFp16(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = (uint16_t) ((bits >> 16) & 0x8000);
+	uint32_t abs = bits & 0x7fffffff;
+	if (abs > FLOAT_INF_BITS)
+	{
+		return sign | 0x7e00;
+	}
+	if (abs >= FP16_OVERFLOW_BITS)
+	{
+		return sign | 0x7c00;
+	}
+	if (abs < FP16_NORMAL_BITS)
+	{
+		// subnormal: in units of 2^-24, the default rounding is to nearest even
+		return sign | (uint16_t) std::nearbyint(std::fabs(value) * 0x1p24f);
+	}
+	// round the 13 dropped mantissa bits to nearest even; a carry moves into the exponent
+	abs += 0xfff + ((abs >> 13) & 1);
+	return sign | (uint16_t) ((abs - FP16_REBIAS_BITS) >> 13);
+}
+
+/**
+ *
+ * @param value
+ * @return
+ */
+uint16_t floatToBf16(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	if ((bits & 0x7fffffff) > FLOAT_INF_BITS)
+	{
+		return (uint16_t) ((bits >> 16) | 0x40);
+	}
+	return (uint16_t) ((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+}
+
+/**
+ *
+ */
+HalfMatrix::HalfMatrix() : _rows(0), _cols(0), _type(HalfFp16)
+{}
+
+/**
+ *
+ * @param matrix
+ * @param type
+ */
+HalfMatrix::HalfMatrix(const Matrix &matrix, HalfType type) : _rows(matrix.getRows()), _cols(matrix.getCols()),
+															  _type(type), _values((size_t) _rows * _cols)
+{
+	const float *values = matrix.data();
+	for (size_t i = 0; i < _values.size(); i++)
+	{
+		_values[i] = type == HalfBf16 ? floatToBf16(values[i]) : floatToFp16(values[i]);
+	}
+}
+
+int HalfMatrix::getRows() const
+{
+	return _rows;
+}
+
+int HalfMatrix::getCols() const
+{
+	return _cols;
+}
+
+HalfType HalfMatrix::getType() const
+{
+	return _type;
+}
+
+/**
+ *
+ * @return
+ */
+size_t HalfMatrix::bytes() const
+{
+	return _values.size() * sizeof(uint16_t);
+}
+
+/**
+ *
+ * @return
+ */
+Matrix HalfMatrix::toFloat() const
+{
+	Matrix out(_rows, _cols, MatrixUninitialized);
+	simd().halfToFloat(_values.data(), _type, out.data(), (int) _values.size());
+	return out;
+}
+
+/**
+ *
+ * @param x
+ * @param y
+ */
+void HalfMatrix::multiply(const float *x, float *y) const
+{
+	simd().halfRows(_values.data(), _cols, _type, x, y, _rows, _cols);
+}
+
+/**
+ *
+ * @param x
+ * @return
+ */
+Matrix HalfMatrix::multiply(const Matrix &x) const
+{
+	Matrix out(_rows, x.getCols(), MatrixUninitialized);
+	multiply(x, out);
+	return out;
+}
+
+/**
+ *
+ * @param x
+ * @param out
+ */
+void HalfMatrix::multiply(const Matrix &x, Matrix &out) const
+{
+	if (x.getRows() != _cols)
+	{
+		cerr << HALF_SHAPE_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	// per thread scratch, grown once to the widest panel seen
+	static thread_local std::vector<float> panel;
+	if (panel.size() < (size_t) HALF_PANEL_ROWS * _cols)
+	{
+		panel.resize((size_t) HALF_PANEL_ROWS * _cols);
+	}
+	int n = x.getCols();
+	if (out.getRows() != _rows || out.getCols() != n)
+	{
+		out = Matrix(_rows, n, MatrixUninitialized);
+	}
+	const SimdKernels &kernels = simd();
+	for (int i = 0; i < _rows; i += HALF_PANEL_ROWS)
+	{
+		int rows = std::min(HALF_PANEL_ROWS, _rows - i);
+		kernels.halfToFloat(_values.data() + (size_t) i * _cols, _type, panel.data(), rows * _cols);
+		gemm(rows, n, _cols, panel.data(), _cols, x.data(), n, out.data() + (size_t) i * n, n);
+	}
+}
@@ -0,0 +1,102 @@
+// HalfMatrix.h
+
+#ifndef HALFMATRIX_H
+#define HALFMATRIX_H
+
+#include "Matrix.h"
+#include "Simd.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * rows of a HalfMatrix widened to float at a time by the batch
+ * product: 64 rows of 784 floats stay in L2 while the gemm reads them
+ */
+#define HALF_PANEL_ROWS 64
+
+/**
+ * round a float to the nearest fp16, ties to even. out of range
+ * values become inf, tiny ones fp16 subnormals or 0
+ * @param value the float
+ * @return the fp16 bits
+ */
+uint16_t floatToFp16(float value);
+
+/**
+ * round a float to the nearest bf16, ties to even
+ * @param value the float
+ * @return the bf16 bits
+ */
+uint16_t floatToBf16(float value);
+
+/**
+ * a matrix stored as 16 bit floats (HalfType): half the bytes of
+ * a float Matrix, widened back to float in registers by the simd
+ * kernels, so a memory bound matrix-vector product reads half as much.
+ * fp16 keeps 11 significant bits over a range of about 6e-8 to 65504,
+ * bf16 8 bits over the whole float range
+ */
+class HalfMatrix
+{
+private:
+	int _rows, _cols;
+	HalfType _type;
+	// row-major
+	std::vector<uint16_t> _values;
+public:
+	/**
+	 * empty (0x0) constructor
+	 */
+	HalfMatrix();
+
+	/**
+	 * round a float matrix to 16 bits
+	 * @param matrix the matrix
+	 * @param type HalfFp16 or HalfBf16
+	 */
+	HalfMatrix(const Matrix &matrix, HalfType type);
+
+	int getRows() const;
+
+	int getCols() const;
+
+	HalfType getType() const;
+
+	/**
+	 * memory the matrix takes
+	 * @return bytes of the values
+	 */
+	size_t bytes() const;
+
+	/**
+	 * the values widened back to float
+	 * @return getRows() x getCols() matrix
+	 */
+	Matrix toFloat() const;
+
+	/**
+	 * y = W * x, converting in registers
+	 * @param x getCols() values
+	 * @param y getRows() values, overwritten
+	 */
+	void multiply(const float *x, float *y) const;
+
+	/**
+	 * W * X: HALF_PANEL_ROWS rows at a time are widened into a
+	 * per thread scratch panel and multiplied by gemm
+	 * @param x getCols() x n matrix
+	 * @return getRows() x n product
+	 */
+	Matrix multiply(const Matrix &x) const;
+
+	/**
+	 * W * X into a buffer kept by the caller, reallocated only
+	 * if it is not getRows() x n already
+	 * @param x getCols() x n matrix
+	 * @param out the product, overwritten
+	 */
+	void multiply(const Matrix &x, Matrix &out) const;
+};
+
+#endif //HALFMATRIX_H
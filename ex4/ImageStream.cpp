@@ -0,0 +1,269 @@
+// ImageStream.cpp
+
+#include "ImageStream.h"
+#include "Dataset.h"
+#include "Simd.h"
+#include <algorithm>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STREAM_OPEN_ERR_MSG "Error: can not open the image file "
+#define STREAM_READ_ERR_MSG "Error: can not read the image file"
+// the IDX images header: magic, count, rows, cols
+#define IDX_HEADER_FIELDS 4
+
+using std::cerr;
+using std::endl;
+
+/**
+ * a big endian IDX header field
+ * @param bytes its 4 bytes
+ * @return the value
+ */
+static uint32_t bigEndian(const uint8_t *bytes)
+{
+	return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | bytes[3];
+}
+
+/**
+ * open a file for reading front to back, or exit
+ * @param path the file
+ * @return the descriptor
+ */
+static int openSequential(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		cerr << STREAM_OPEN_ERR_MSG << path << endl;
+		exit(EXIT_FAILURE);
+	}
+	// a hint: the kernel may read ahead further
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	return fd;
+}
+
+/**
+ *
+ * @param path
+ */
+ImageStream::ImageStream(const char *path) : _fd(openSequential(path)), _format(StreamIdx), _imageSize(0),
+											 _count(0), _next(0), _start(IDX_HEADER_FIELDS * 4)
+{
+	uint8_t header[IDX_HEADER_FIELDS * 4];
+	_readFully(header, sizeof(header));
+	if (bigEndian(header) != IDX_IMAGES_MAGIC || bigEndian(header + 8) == 0 || bigEndian(header + 12) == 0)
+	{
+		cerr << STREAM_OPEN_ERR_MSG << path << endl;
+		exit(EXIT_FAILURE);
+	}
+	_count = bigEndian(header + 4);
+	_imageSize = (int) (bigEndian(header + 8) * bigEndian(header + 12));
+}
+
+/**
+ *
+ * @param path
+ * @param imageSize
+ */
+ImageStream::ImageStream(const char *path, int imageSize) : _fd(openSequential(path)), _format(StreamRawFloat),
+															_imageSize(imageSize), _count(0), _next(0), _start(0)
+{
+	struct stat st = {};
+	if (imageSize <= 0 || fstat(_fd, &st) != 0)
+	{
+		cerr << STREAM_OPEN_ERR_MSG << path << endl;
+		exit(EXIT_FAILURE);
+	}
+	_count = (long) st.st_size / ((long) imageSize * (long) sizeof(float));
+}
+
+/**
+ *
+ */
+ImageStream::~ImageStream()
+{
+	close(_fd);
+}
+
+/**
+ *
+ * @param out
+ * @param len
+ */
+void ImageStream::_readFully(void *out, size_t len)
+{
+	char *p = (char *) out;
+	while (len > 0)
+	{
+		ssize_t got = read(_fd, p, len);
+		if (got <= 0)
+		{
+			cerr << STREAM_READ_ERR_MSG << endl;
+			exit(EXIT_FAILURE);
+		}
+		p += got;
+		len -= (size_t) got;
+	}
+}
+
+/**
+ *
+ * @return
+ */
+int ImageStream::getImageSize() const
+{
+	return _imageSize;
+}
+
+/**
+ *
+ * @return
+ */
+long ImageStream::getCount() const
+{
+	return _count;
+}
+
+/**
+ *
+ * @param batch
+ * @param maxImages
+ * @return
+ */
+int ImageStream::next(Matrix &batch, int maxImages)
+{
+	int n = (int) std::min((long) maxImages, _count - _next);
+	if (n <= 0)
+	{
+		return 0;
+	}
+	if (batch.getRows() != _imageSize || batch.getCols() != n)
+	{
+		batch = Matrix(_imageSize, n, MatrixUninitialized);
+	}
+	size_t len = (size_t) n * _imageSize;
+	// a single image is its own column: no transpose, straight into the batch
+	float *rows = batch.data();
+	if (n > 1)
+	{
+		if (_rows.size() < len)
+		{
+			_rows.resize(len);
+		}
+		rows = _rows.data();
+	}
+	if (_format == StreamIdx)
+	{
+		if (_bytes.size() < len)
+		{
+			_bytes.resize(len);
+		}
+		_readFully(_bytes.data(), len);
+		simd().bytesToFloat(_bytes.data(), IDX_PIXEL_SCALE, rows, (int) len);
+	}
+	else
+	{
+		_readFully(rows, len * sizeof(float));
+	}
+	if (n > 1)
+	{
+		transposeInto(rows, _imageSize, batch.data(), n, n, _imageSize);
+	}
+	_next += n;
+	return n;
+}
+
+/**
+ *
+ */
+void ImageStream::rewind()
+{
+	lseek(_fd, _start, SEEK_SET);
+	_next = 0;
+}
+
+// _____________________________ BatchPipeline _____________________________
+
+/**
+ *
+ * @param stream
+ * @param batchSize
+ */
+BatchPipeline::BatchPipeline(ImageStream &stream, int batchSize) :
+		_stream(stream), _batchSize(batchSize), _counts{0, 0}, _filled{false, false}, _held(-1), _wanted(0),
+		_stop(false)
+{
+	_reader = std::thread(&BatchPipeline::_run, this);
+}
+
+/**
+ *
+ */
+BatchPipeline::~BatchPipeline()
+{
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		_stop = true;
+	}
+	_changed.notify_all();
+	_reader.join();
+}
+
+/**
+ *
+ */
+void BatchPipeline::_run()
+{
+	for (int slot = 0;; slot ^= 1)
+	{
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			_changed.wait(guard, [&]
+			{ return _stop || (!_filled[slot] && _held != slot); });
+			if (_stop)
+			{
+				return;
+			}
+		}
+		// the slot is the reader's alone until it is marked filled
+		int count = _stream.next(_slots[slot], _batchSize);
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			_counts[slot] = count;
+			_filled[slot] = true;
+		}
+		_changed.notify_all();
+		if (count == 0)
+		{
+			return;
+		}
+	}
+}
+
+/**
+ *
+ * @return
+ */
+const Matrix *BatchPipeline::next()
+{
+	std::unique_lock<std::mutex> guard(_lock);
+	if (_held >= 0)
+	{
+		_held = -1;
+		_changed.notify_all();
+	}
+	int slot = _wanted;
+	_changed.wait(guard, [&]
+	{ return _filled[slot]; });
+	if (_counts[slot] == 0)
+	{
+		return nullptr;
+	}
+	_filled[slot] = false;
+	_held = slot;
+	_wanted ^= 1;
+	return &_slots[slot];
+}
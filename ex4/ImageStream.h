@@ -0,0 +1,159 @@
+// ImageStream.h
+
+#ifndef IMAGESTREAM_H
+#define IMAGESTREAM_H
+
+#include "Matrix.h"
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @enum StreamFormat
+ * @brief what an ImageStream reads
+ */
+enum StreamFormat
+{
+	// an IDX file of unsigned byte images (e.g. t10k-images-idx3-ubyte),
+	// pixels normalized by IDX_PIXEL_SCALE
+	StreamIdx,
+	// native floats, one image after the other (as operator<< writes them)
+	StreamRawFloat
+};
+
+/**
+ * reads the images of a file front to back a batch at a time, with
+ * one read call per batch into a staging buffer. idx pixels are
+ * widened to floats by the simd bytesToFloat kernel, then the image
+ * rows are transposed into the one image per column layout of
+ * MlpNetwork::classifyBatch. the staging buffers are kept, so a
+ * stream of batches of one size allocates nothing after the first
+ */
+class ImageStream
+{
+private:
+	int _fd;
+	StreamFormat _format;
+	int _imageSize;
+	long _count, _next;
+	// the file offset of the first image
+	long _start;
+	// the raw bytes and the image-major floats of a batch
+	std::vector<uint8_t> _bytes;
+	std::vector<float> _rows;
+
+	/**
+	 * read exactly len bytes, or exit
+	 * @param out the buffer
+	 * @param len number of bytes
+	 */
+	void _readFully(void *out, size_t len);
+
+public:
+	/**
+	 * open an IDX images file. exits if it is not one
+	 * @param path the file
+	 */
+	explicit ImageStream(const char *path);
+
+	/**
+	 * open a file of raw floats. exits if it can not be opened
+	 * @param path the file
+	 * @param imageSize floats in one image; a last partial image is ignored
+	 */
+	ImageStream(const char *path, int imageSize);
+
+	ImageStream(const ImageStream &other) = delete;
+
+	ImageStream &operator=(const ImageStream &other) = delete;
+
+	/**
+	 * closes the file
+	 */
+	~ImageStream();
+
+	/**
+	 * values in one image
+	 * @return the size
+	 */
+	int getImageSize() const;
+
+	/**
+	 * number of images in the file
+	 * @return the count
+	 */
+	long getCount() const;
+
+	/**
+	 * read the next images
+	 * @param batch set to getImageSize() x n, one image per column;
+	 * reshaped only if it is not that shape already
+	 * @param maxImages the most images to read, at least 1
+	 * @return n, the images read: 0 at the end of the file
+	 */
+	int next(Matrix &batch, int maxImages);
+
+	/**
+	 * go back to the first image
+	 */
+	void rewind();
+};
+
+/**
+ * overlaps reading with inference: a reader thread fills one of two
+ * batches from an ImageStream while the caller works on the other.
+ *
+ *     BatchPipeline pipeline(stream, 256);
+ *     while (const Matrix *batch = pipeline.next())
+ *         network.classifyBatch(*batch);
+ */
+class BatchPipeline
+{
+private:
+	ImageStream &_stream;
+	int _batchSize;
+	Matrix _slots[2];
+	// images in a filled slot, 0 once the stream ended
+	int _counts[2];
+	bool _filled[2];
+	// the slot the caller holds, -1 for none
+	int _held;
+	int _wanted;
+	bool _stop;
+	std::mutex _lock;
+	std::condition_variable _changed;
+	std::thread _reader;
+
+	/**
+	 * the reader thread: fill the slots in turn until the stream ends
+	 */
+	void _run();
+
+public:
+	/**
+	 * start reading
+	 * @param stream the stream, must outlive the pipeline and not be
+	 * read by anyone else meanwhile
+	 * @param batchSize images per batch
+	 */
+	BatchPipeline(ImageStream &stream, int batchSize);
+
+	BatchPipeline(const BatchPipeline &other) = delete;
+
+	BatchPipeline &operator=(const BatchPipeline &other) = delete;
+
+	/**
+	 * stops and joins the reader
+	 */
+	~BatchPipeline();
+
+	/**
+	 * hand back the batch returned last and wait for the next one
+	 * @return the batch, valid until the next call; nullptr at the end
+	 */
+	const Matrix *next();
+};
+
+#endif //IMAGESTREAM_H
@@ -0,0 +1,624 @@
+// InferenceServer.cpp
+
+#include "InferenceServer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define ADDRESS_ERR_MSG "Error: bad address (unix:<path> or tcp:<port>) "
+#define LISTEN_ERR_MSG "Error: can not listen on "
+#define CONNECT_ERR_MSG "Error: can not connect to "
+#define SERVER_ERR_MSG "Error: the server can not start"
+
+using std::cerr;
+using std::endl;
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @struct InferenceServer::Connection
+ * @brief a non-blocking client socket, the image being received on it and
+ * the replies it did not take yet. shared by the requests read from it, so
+ * the socket is closed only once the io thread dropped it and no request
+ * of it is left in a batch
+ */
+struct InferenceServer::Connection
+{
+	int fd;
+	// the io thread's
+	std::vector<float> pending;
+	size_t received;
+	bool readDone;
+	// the rest under lock, shared with the batcher
+	std::mutex lock;
+	std::vector<char> outgoing;
+	// images queued or in a batch, not yet in outgoing
+	int queued;
+	bool dropped;
+
+	Connection(int socket, int imageSize) : fd(socket), pending(imageSize), received(0), readDone(false),
+											queued(0), dropped(false)
+	{}
+
+	~Connection()
+	{
+		close(fd);
+	}
+
+	/**
+	 * images received and not answered on the socket yet, under lock
+	 * @return the count
+	 */
+	int inFlight() const
+	{
+		return queued + (int) (outgoing.size() / sizeof(ServerReply));
+	}
+
+	/**
+	 * send what outgoing has until the socket takes no more, under lock
+	 * @return false if the connection failed
+	 */
+	bool flush()
+	{
+		size_t sent = 0;
+		while (sent < outgoing.size())
+		{
+			ssize_t got = send(fd, outgoing.data() + sent, outgoing.size() - sent, MSG_NOSIGNAL);
+			if (got < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (got <= 0)
+			{
+				outgoing.erase(outgoing.begin(), outgoing.begin() + (long) sent);
+				return got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+			}
+			sent += (size_t) got;
+		}
+		outgoing.clear();
+		return true;
+	}
+
+	/**
+	 * give up on the client: no more replies, and the socket shut down now
+	 * rather than once the last request of it left its batch
+	 */
+	void drop()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		dropped = true;
+		outgoing.clear();
+		shutdown(fd, SHUT_RDWR);
+	}
+};
+
+/**
+ * parse an address into a socket address, or exit
+ * @param address see UNIX_ADDRESS_PREFIX
+ * @param storage the socket address
+ * @param len its length
+ * @return the address family
+ */
+static int parseAddress(const char *address, sockaddr_storage &storage, socklen_t &len)
+{
+	std::memset(&storage, 0, sizeof(storage));
+	if (std::strncmp(address, UNIX_ADDRESS_PREFIX, std::strlen(UNIX_ADDRESS_PREFIX)) == 0)
+	{
+		const char *path = address + std::strlen(UNIX_ADDRESS_PREFIX);
+		sockaddr_un *un = (sockaddr_un *) &storage;
+		if (*path != '\0' && std::strlen(path) < sizeof(un->sun_path))
+		{
+			un->sun_family = AF_UNIX;
+			std::strcpy(un->sun_path, path);
+			len = sizeof(sockaddr_un);
+			return AF_UNIX;
+		}
+	}
+	else if (std::strncmp(address, TCP_ADDRESS_PREFIX, std::strlen(TCP_ADDRESS_PREFIX)) == 0)
+	{
+		int port = std::atoi(address + std::strlen(TCP_ADDRESS_PREFIX));
+		sockaddr_in *in = (sockaddr_in *) &storage;
+		if (port > 0 && port < (1 << 16))
+		{
+			in->sin_family = AF_INET;
+			in->sin_port = htons((uint16_t) port);
+			in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			len = sizeof(sockaddr_in);
+			return AF_INET;
+		}
+	}
+	cerr << ADDRESS_ERR_MSG << address << endl;
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * no Nagle delay on a tcp socket: replies are small and latency bound.
+ * harmless on a unix socket, which just refuses it
+ * @param fd the socket
+ */
+static void noDelay(int fd)
+{
+	int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+/**
+ * make a socket or a pipe end non-blocking
+ * @param fd the descriptor
+ */
+static void nonBlocking(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/**
+ *
+ * @param samples
+ * @param q
+ * @return
+ */
+double latencyPercentile(std::vector<float> &samples, double q)
+{
+	if (samples.empty())
+	{
+		return 0;
+	}
+	size_t rank = std::min(samples.size() - 1, (size_t) (q * (double) samples.size()));
+	std::nth_element(samples.begin(), samples.begin() + (long) rank, samples.end());
+	return samples[rank];
+}
+
+/**
+ *
+ * @param address
+ * @return
+ */
+int listenOn(const char *address)
+{
+	sockaddr_storage storage;
+	socklen_t len;
+	int family = parseAddress(address, storage, len);
+	int fd = socket(family, SOCK_STREAM, 0);
+	if (family == AF_UNIX)
+	{
+		unlink(((sockaddr_un *) &storage)->sun_path);
+	}
+	else
+	{
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	}
+	if (fd < 0 || bind(fd, (sockaddr *) &storage, len) != 0 || listen(fd, SOMAXCONN) != 0)
+	{
+		cerr << LISTEN_ERR_MSG << address << endl;
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+/**
+ *
+ * @param address
+ * @return
+ */
+int connectTo(const char *address)
+{
+	sockaddr_storage storage;
+	socklen_t len;
+	int family = parseAddress(address, storage, len);
+	int fd = socket(family, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (sockaddr *) &storage, len) != 0)
+	{
+		cerr << CONNECT_ERR_MSG << address << endl;
+		exit(EXIT_FAILURE);
+	}
+	noDelay(fd);
+	return fd;
+}
+
+/**
+ *
+ * @param fd
+ * @param data
+ * @param len
+ * @return
+ */
+bool sendAll(int fd, const void *data, size_t len)
+{
+	const char *p = (const char *) data;
+	while (len > 0)
+	{
+		ssize_t sent = send(fd, p, len, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (sent <= 0)
+		{
+			return false;
+		}
+		p += sent;
+		len -= (size_t) sent;
+	}
+	return true;
+}
+
+/**
+ *
+ * @param fd
+ * @param data
+ * @param len
+ * @return
+ */
+bool receiveAll(int fd, void *data, size_t len)
+{
+	char *p = (char *) data;
+	while (len > 0)
+	{
+		ssize_t got = recv(fd, p, len, 0);
+		if (got < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (got <= 0)
+		{
+			return false;
+		}
+		p += got;
+		len -= (size_t) got;
+	}
+	return true;
+}
+
+/**
+ *
+ * @param network
+ * @param address
+ * @param config
+ */
+InferenceServer::InferenceServer(const MlpNetwork &network, const char *address, const ServerConfig &config) :
+		_network(network), _config(config), _address(address), _listener(listenOn(address)), _wake{-1, -1},
+		_stop(false), _batcherDone(false), _latencies(LATENCY_WINDOW), _latencyNext(0), _requests(0), _batches(0),
+		_started(Clock::now())
+{
+	_config.maxBatch = std::max(1, _config.maxBatch);
+	_config.maxWaitMicros = std::max(0, _config.maxWaitMicros);
+	if (pipe(_wake) != 0)
+	{
+		cerr << SERVER_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	// a wake up is never waited for, a full pipe wakes the io thread already
+	nonBlocking(_wake[0]);
+	nonBlocking(_wake[1]);
+	_io = std::thread(&InferenceServer::_runIo, this);
+	_batcher = std::thread(&InferenceServer::_runBatcher, this);
+}
+
+/**
+ *
+ */
+InferenceServer::~InferenceServer()
+{
+	stop();
+}
+
+/**
+ *
+ */
+void InferenceServer::stop()
+{
+	if (!_io.joinable())
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		_stop = true;
+	}
+	_queued.notify_all();
+	_wakeIo();
+	_batcher.join();
+	_io.join();
+	close(_listener);
+	close(_wake[0]);
+	close(_wake[1]);
+	if (_address.compare(0, std::strlen(UNIX_ADDRESS_PREFIX), UNIX_ADDRESS_PREFIX) == 0)
+	{
+		unlink(_address.c_str() + std::strlen(UNIX_ADDRESS_PREFIX));
+	}
+}
+
+/**
+ *
+ */
+void InferenceServer::_wakeIo()
+{
+	char byte = 0;
+	ssize_t written = write(_wake[1], &byte, 1);
+	(void) written;
+}
+
+/**
+ *
+ */
+void InferenceServer::_runIo()
+{
+	std::vector<std::shared_ptr<Connection>> connections;
+	std::vector<pollfd> fds;
+	bool stopping = false;
+	Clock::time_point drained;
+	while (true)
+	{
+		bool full, finished;
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			full = _queue.size() >= SERVER_QUEUE_IMAGES;
+			finished = _batcherDone;
+			if (_stop && !stopping)
+			{
+				stopping = true;
+				drained = Clock::now() + std::chrono::milliseconds(SERVER_DRAIN_MILLIS);
+			}
+		}
+		// a connection is done with once nothing more is read off it and it was answered
+		for (int i = (int) connections.size() - 1; i >= 0; i--)
+		{
+			bool answered;
+			{
+				std::lock_guard<std::mutex> guard(connections[i]->lock);
+				answered = connections[i]->inFlight() == 0;
+			}
+			if (answered && (connections[i]->readDone || stopping))
+			{
+				connections.erase(connections.begin() + i);
+			}
+		}
+		if (stopping && finished && (connections.empty() || Clock::now() >= drained))
+		{
+			return;
+		}
+
+		fds.clear();
+		fds.push_back({_wake[0], POLLIN, 0});
+		fds.push_back({_listener, (short) (stopping ? 0 : POLLIN), 0});
+		for (const std::shared_ptr<Connection> &connection : connections)
+		{
+			short events = !stopping && !full && !connection->readDone ? POLLIN : 0;
+			{
+				std::lock_guard<std::mutex> guard(connection->lock);
+				events |= connection->outgoing.empty() ? 0 : POLLOUT;
+			}
+			fds.push_back({connection->fd, events, 0});
+		}
+		// the batcher wakes this thread once it is finished, then the drain is timed
+		int timeout = -1;
+		if (stopping && finished)
+		{
+			timeout = (int) std::max(0L, (long) std::chrono::duration_cast<std::chrono::milliseconds>(
+					drained - Clock::now()).count());
+		}
+		if (poll(fds.data(), fds.size(), timeout) < 0)
+		{
+			continue;
+		}
+		if (fds[0].revents != 0)
+		{
+			char bytes[64];
+			while (read(_wake[0], bytes, sizeof(bytes)) > 0)
+			{
+			}
+		}
+		for (int i = (int) connections.size() - 1; i >= 0; i--)
+		{
+			short revents = fds[i + 2].revents;
+			bool alive = (revents & (POLLERR | POLLHUP | POLLNVAL)) == 0;
+			if (alive && (revents & POLLIN))
+			{
+				alive = _receive(connections[i]);
+			}
+			if (alive && (revents & POLLOUT))
+			{
+				std::lock_guard<std::mutex> guard(connections[i]->lock);
+				alive = connections[i]->flush();
+			}
+			if (!alive)
+			{
+				connections[i]->drop();
+				connections.erase(connections.begin() + i);
+			}
+		}
+		if (fds[1].revents & POLLIN)
+		{
+			int fd = accept(_listener, nullptr, nullptr);
+			if (fd >= 0)
+			{
+				noDelay(fd);
+				nonBlocking(fd);
+				connections.push_back(std::make_shared<Connection>(fd, _network.getInputSize()));
+			}
+		}
+	}
+}
+
+/**
+ *
+ * @param connection
+ * @return
+ */
+bool InferenceServer::_receive(const std::shared_ptr<Connection> &connection)
+{
+	size_t size = connection->pending.size() * sizeof(float);
+	while (true)
+	{
+		char *image = (char *) connection->pending.data();
+		ssize_t got = recv(connection->fd, image + connection->received, size - connection->received, 0);
+		if (got == 0)
+		{
+			connection->readDone = true;
+			return true;
+		}
+		if (got < 0)
+		{
+			return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+		}
+		connection->received += (size_t) got;
+		if (connection->received < size)
+		{
+			continue;
+		}
+		Request request = {connection, Clock::now(), std::move(connection->pending)};
+		connection->pending.assign(size / sizeof(float), 0);
+		connection->received = 0;
+		bool wake, full;
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			if (_stop)
+			{
+				return true;
+			}
+			{
+				std::lock_guard<std::mutex> own(connection->lock);
+				if (connection->inFlight() >= SERVER_CONNECTION_IMAGES)
+				{
+					return false;
+				}
+				connection->queued++;
+			}
+			_queue.push_back(std::move(request));
+			// the batcher only needs to hear of a first image or a full batch
+			wake = _queue.size() == 1 || (int) _queue.size() == _config.maxBatch;
+			full = _queue.size() >= SERVER_QUEUE_IMAGES;
+		}
+		if (wake)
+		{
+			_queued.notify_one();
+		}
+		if (full)
+		{
+			return true;
+		}
+	}
+}
+
+/**
+ *
+ */
+void InferenceServer::_runBatcher()
+{
+	int size = _network.getInputSize();
+	std::vector<Request> batch;
+	std::vector<float> rows;
+	Matrix images;
+	std::vector<ServerReply> replies;
+	bool wakeIo;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			_queued.wait(guard, [&]
+			{ return _stop || !_queue.empty(); });
+			if (_queue.empty())
+			{
+				_batcherDone = true;
+				break;
+			}
+			Clock::time_point deadline = _queue.front().arrived + std::chrono::microseconds(_config.maxWaitMicros);
+			_queued.wait_until(guard, deadline, [&]
+			{ return _stop || (int) _queue.size() >= _config.maxBatch; });
+			// the io thread stopped reading on a full queue, and is told there is room again
+			wakeIo = _queue.size() >= SERVER_QUEUE_IMAGES;
+			int n = std::min((int) _queue.size(), _config.maxBatch);
+			for (int i = 0; i < n; i++)
+			{
+				batch.push_back(std::move(_queue.front()));
+				_queue.pop_front();
+			}
+		}
+
+		int n = (int) batch.size();
+		rows.resize((size_t) n * size);
+		for (int j = 0; j < n; j++)
+		{
+			std::copy(batch[j].image.begin(), batch[j].image.end(), rows.begin() + (long) j * size);
+		}
+		if (images.getRows() != size || images.getCols() != n)
+		{
+			images = Matrix(size, n, MatrixUninitialized);
+		}
+		transposeInto(rows.data(), size, images.data(), n, n, size);
+		std::vector<Digit> digits = _network.classifyBatch(images);
+
+		// one non-blocking send per run of replies to the same connection, what
+		// the socket does not take waits in outgoing for the io thread
+		for (int j = 0; j < n;)
+		{
+			replies.clear();
+			int k = j;
+			for (; k < n && batch[k].from == batch[j].from; k++)
+			{
+				replies.push_back({digits[k].value, digits[k].probability});
+			}
+			Connection &to = *batch[j].from;
+			{
+				std::lock_guard<std::mutex> guard(to.lock);
+				to.queued -= k - j;
+				if (!to.dropped)
+				{
+					bool idle = to.outgoing.empty();
+					const char *bytes = (const char *) replies.data();
+					to.outgoing.insert(to.outgoing.end(), bytes, bytes + replies.size() * sizeof(ServerReply));
+					if (idle)
+					{
+						to.flush();
+					}
+					wakeIo = wakeIo || !to.outgoing.empty();
+				}
+			}
+			j = k;
+		}
+		if (wakeIo)
+		{
+			_wakeIo();
+		}
+		Clock::time_point done = Clock::now();
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			for (const Request &request : batch)
+			{
+				_latencies[_latencyNext++ % LATENCY_WINDOW] =
+						std::chrono::duration<float, std::micro>(done - request.arrived).count();
+			}
+			_requests += n;
+			_batches++;
+		}
+		batch.clear();
+	}
+	_wakeIo();
+}
+
+/**
+ *
+ * @return
+ */
+ServerStats InferenceServer::stats()
+{
+	std::lock_guard<std::mutex> guard(_lock);
+	std::vector<float> samples(_latencies.begin(),
+							   _latencies.begin() + (long) std::min(_latencyNext, (size_t) LATENCY_WINDOW));
+	ServerStats stats = {};
+	stats.requests = _requests;
+	stats.batches = _batches;
+	stats.seconds = std::chrono::duration<double>(Clock::now() - _started).count();
+	stats.p50Micros = latencyPercentile(samples, 0.5);
+	stats.p99Micros = latencyPercentile(samples, 0.99);
+	return stats;
+}
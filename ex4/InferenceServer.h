@@ -0,0 +1,227 @@
+// InferenceServer.h
+
+#ifndef INFERENCESERVER_H
+#define INFERENCESERVER_H
+
+#include "MlpNetwork.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * addresses are "unix:<path>" for a unix domain socket or
+ * "tcp:<port>" for a tcp port on the loopback interface
+ */
+#define UNIX_ADDRESS_PREFIX "unix:"
+#define TCP_ADDRESS_PREFIX "tcp:"
+
+/**
+ * latencies the server keeps for its percentiles, the most recent ones
+ */
+#define LATENCY_WINDOW (1 << 16)
+
+/**
+ * the most images a connection may have in flight, received but not yet
+ * answered on the socket. a client past it, one that sends without
+ * reading its replies, is dropped
+ */
+#define SERVER_CONNECTION_IMAGES 4096
+
+/**
+ * the most images queued for the batcher, past it the io thread stops
+ * reading the connections until the batcher took a batch
+ */
+#define SERVER_QUEUE_IMAGES (1 << 16)
+
+/**
+ * how long stop waits for the last replies to be taken by their clients
+ */
+#define SERVER_DRAIN_MILLIS 1000
+
+/**
+ * @struct ServerReply
+ * @brief what the server answers per image, in the order the images came
+ * on their connection. a request is the image's getInputSize() native floats
+ */
+typedef struct ServerReply
+{
+	uint32_t value;
+	float probability;
+} ServerReply;
+
+/**
+ * @struct ServerConfig
+ * @brief how requests are grouped into batches
+ */
+typedef struct ServerConfig
+{
+	// the most images in one batched forward pass, 1 for no batching
+	int maxBatch;
+	// how long the oldest queued image may wait for more to join its batch
+	int maxWaitMicros;
+} ServerConfig;
+
+/**
+ * @struct ServerStats
+ * @brief what the server did since it started
+ */
+typedef struct ServerStats
+{
+	long requests;
+	long batches;
+	double seconds;
+	// from an image fully received to its reply handed to its connection, over the
+	// last LATENCY_WINDOW requests
+	double p50Micros, p99Micros;
+} ServerStats;
+
+/**
+ * the q quantile of latency samples, by nearest rank
+ * @param samples the samples, reordered
+ * @param q in [0, 1], e.g. 0.99
+ * @return the quantile, 0 for no samples
+ */
+double latencyPercentile(std::vector<float> &samples, double q);
+
+/**
+ * open a listening socket, or exit
+ * @param address see UNIX_ADDRESS_PREFIX; a stale unix socket file is replaced
+ * @return the socket
+ */
+int listenOn(const char *address);
+
+/**
+ * connect to a server, or exit
+ * @param address see UNIX_ADDRESS_PREFIX
+ * @return the socket
+ */
+int connectTo(const char *address);
+
+/**
+ * send a whole buffer on a blocking socket
+ * @param fd the socket
+ * @param data the bytes
+ * @param len number of bytes
+ * @return false if the connection failed
+ */
+bool sendAll(int fd, const void *data, size_t len);
+
+/**
+ * receive a whole buffer from a blocking socket
+ * @param fd the socket
+ * @param data the bytes
+ * @param len number of bytes
+ * @return false if the connection closed or failed first
+ */
+bool receiveAll(int fd, void *data, size_t len);
+
+/**
+ * serves an MlpNetwork on a socket with dynamic micro-batching.
+ * an io thread accepts connections and reads whole images off them
+ * (poll, non-blocking reads, any number of images in flight per
+ * connection) into one queue. a batcher thread waits for the first
+ * queued image, then for up to maxWaitMicros more or until maxBatch
+ * images are queued, runs them as one classifyBatch and hands the
+ * replies to their connections. under light load an image waits at most
+ * maxWaitMicros, under heavy load the batches fill up without waiting.
+ * the client sockets are non-blocking: what a reply send does not get
+ * out is buffered on its connection and flushed by the io thread on
+ * POLLOUT, so a client that does not read holds up no one else (see
+ * SERVER_CONNECTION_IMAGES, SERVER_QUEUE_IMAGES)
+ */
+class InferenceServer
+{
+private:
+	struct Connection;
+
+	/**
+	 * @struct Request
+	 * @brief one received image
+	 */
+	typedef struct Request
+	{
+		std::shared_ptr<Connection> from;
+		std::chrono::steady_clock::time_point arrived;
+		std::vector<float> image;
+	} Request;
+
+	const MlpNetwork &_network;
+	ServerConfig _config;
+	std::string _address;
+	int _listener;
+	// written to wake the io thread out of poll
+	int _wake[2];
+	bool _stop;
+	// the batcher answered the last queued image after a stop, under _lock
+	bool _batcherDone;
+	std::mutex _lock;
+	std::condition_variable _queued;
+	std::deque<Request> _queue;
+	// stats, under _lock
+	std::vector<float> _latencies;
+	size_t _latencyNext;
+	long _requests, _batches;
+	std::chrono::steady_clock::time_point _started;
+	std::thread _io;
+	std::thread _batcher;
+
+	/**
+	 * the io thread: accept and read until stopped
+	 */
+	void _runIo();
+
+	/**
+	 * the batcher thread: batch, classify and reply until stopped
+	 */
+	void _runBatcher();
+
+	/**
+	 * read what a connection has, queueing every image it completes, until
+	 * it has no more or the queue is full
+	 * @param connection the connection
+	 * @return false if it failed or went past SERVER_CONNECTION_IMAGES
+	 */
+	bool _receive(const std::shared_ptr<Connection> &connection);
+
+	/**
+	 * get the io thread out of poll
+	 */
+	void _wakeIo();
+
+public:
+	/**
+	 * start serving
+	 * @param network the network, must outlive the server
+	 * @param address where to listen, see UNIX_ADDRESS_PREFIX
+	 * @param config the batching bounds
+	 */
+	InferenceServer(const MlpNetwork &network, const char *address, const ServerConfig &config);
+
+	InferenceServer(const InferenceServer &other) = delete;
+
+	InferenceServer &operator=(const InferenceServer &other) = delete;
+
+	/**
+	 * stops serving (see stop)
+	 */
+	~InferenceServer();
+
+	/**
+	 * stop accepting and reading, answer what is queued, give the clients
+	 * up to SERVER_DRAIN_MILLIS to take the replies and join the threads
+	 */
+	void stop();
+
+	/**
+	 * the counters and latency percentiles so far
+	 * @return the stats
+	 */
+	ServerStats stats();
+};
+
+#endif //INFERENCESERVER_H
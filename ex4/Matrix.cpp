@@ -3,26 +3,101 @@
 //
 
 #include "Matrix.h"
+#include "Gemm.h"
+#include "Simd.h"
+#include "Strassen.h"
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
 
 
 #define CONSTRUCTOR_ERR_MSG "Error: invalid rows or columns number"
 #define MULT_ERR_MSG "Error: first matrix columns dims and second matrix row dims are not the same"
 #define ADD_ERR_MSG "Error: the shape of the matrices should be the same"
 #define IDX_ERR_MSG "Error: bad indexes. indexes should be in the rage of the dims of the matrix"
+#define CSV_ERR_MSG "Error: bad text matrix at line "
 
 #define DEFAULT_SHAPE 1
+// transpose blocks of up to this many rows and cols are copied directly
+#define TRANSPOSE_LEAF 16
+// room for any float by to_chars: "-1.17549435e-38" and a separator
+#define FLOAT_CHARS 32
+// the flags under which cout prints a float as to_chars' general format does
+#define PRINT_FORMAT_FLAGS (std::ios_base::floatfield | std::ios_base::showpos | \
+							std::ios_base::showpoint | std::ios_base::uppercase)
 
 using std::cerr;
 using std::cout;
 using std::endl;
 
 
+/**
+ * out = in^T for a rows x cols block, halving the longer side
+ * until the block is a leaf
+ * @param in block start
+ * @param ldIn distance between two rows of in
+ * @param out start of the transposed block
+ * @param ldOut distance between two rows of out
+ * @param rows rows of the in block
+ * @param cols cols of the in block
+ */
+static void transposeBlock(const float *in, int ldIn, float *out, int ldOut, int rows, int cols)
+{
+	if (rows <= TRANSPOSE_LEAF && cols <= TRANSPOSE_LEAF)
+	{
+		for (int i = 0; i < rows; i++)
+		{
+			for (int j = 0; j < cols; j++)
+			{
+				out[j * ldOut + i] = in[i * ldIn + j];
+			}
+		}
+		return;
+	}
+	if (rows >= cols)
+	{
+		int half = rows / 2;
+		transposeBlock(in, ldIn, out, ldOut, half, cols);
+		transposeBlock(in + half * ldIn, ldIn, out + half, ldOut, rows - half, cols);
+	}
+	else
+	{
+		int half = cols / 2;
+		transposeBlock(in, ldIn, out, ldOut, rows, half);
+		transposeBlock(in + half, ldIn, out + half * ldOut, ldOut, rows, cols - half);
+	}
+}
+
+/**
+ *
+ */
+void addShapeError()
+{
+	cerr << ADD_ERR_MSG << endl;
+	exit(EXIT_FAILURE);
+}
+
+/**
+ *
+ */
+void indexError()
+{
+	cerr << IDX_ERR_MSG << endl;
+	exit(EXIT_FAILURE);
+}
+
+
 /**
  *
  */
-Matrix::Matrix() : shape({DEFAULT_SHAPE, DEFAULT_SHAPE})
+Matrix::Matrix() : shape({DEFAULT_SHAPE, DEFAULT_SHAPE}), owner(true)
 {
-	values = new float[DEFAULT_SHAPE]();
+	values = poolAllocate(DEFAULT_SHAPE);
+	values[0] = 0;
 }
 
 /**
@@ -30,14 +105,27 @@ Matrix::Matrix() : shape({DEFAULT_SHAPE, DEFAULT_SHAPE})
  * @param rows
  * @param cols
  */
-Matrix::Matrix(int rows, int cols)
+Matrix::Matrix(int rows, int cols) : Matrix(rows, cols, MatrixZeros)
+{}
+
+/**
+ *
+ * @param rows
+ * @param cols
+ * @param init
+ */
+Matrix::Matrix(int rows, int cols, MatrixInit init) : owner(true)
 {
 	if (rows <= 0 || cols <= 0)
 	{
 		cerr << CONSTRUCTOR_ERR_MSG << endl;
 		exit(EXIT_FAILURE);
 	}
-	values = new float[rows * cols]();
+	values = poolAllocate(rows * cols);
+	if (init == MatrixZeros)
+	{
+		std::fill(values, values + rows * cols, 0.0f);
+	}
 	shape.rows = rows;
 	shape.cols = cols;
 }
@@ -46,23 +134,91 @@ Matrix::Matrix(int rows, int cols)
  *
  * @param matrix
  */
-Matrix::Matrix(const Matrix &matrix)
+Matrix::Matrix(const Matrix &matrix) : owner(true)
 {
 	shape.rows = matrix.shape.rows;
 	shape.cols = matrix.shape.cols;
-	values = new float[shape.rows * shape.cols]();
-	for (int i = 0; i < shape.rows * shape.cols; i++)
+	values = poolAllocate(shape.rows * shape.cols);
+	std::copy(matrix.values, matrix.values + shape.rows * shape.cols, values);
+}
+
+/**
+ *
+ * @param matrix
+ */
+Matrix::Matrix(Matrix &&matrix) noexcept: shape(matrix.shape), values(matrix.values), owner(matrix.owner)
+{
+	matrix.shape = {DEFAULT_SHAPE, DEFAULT_SHAPE};
+	matrix.values = poolAllocate(DEFAULT_SHAPE);
+	matrix.values[0] = 0;
+	matrix.owner = true;
+}
+
+/**
+ *
+ * @param buffer
+ * @param dims
+ */
+Matrix::Matrix(float *buffer, MatrixDims dims) : shape(dims), values(buffer), owner(false)
+{}
+
+/**
+ *
+ * @param view
+ */
+Matrix::Matrix(ConstMatrixView view) : Matrix(view.getRows(), view.getCols(), MatrixUninitialized)
+{
+	for (int i = 0; i < shape.rows; i++)
 	{
-		values[i] = matrix.values[i];
+		ConstMatrixView row = view.row(i);
+		float *out = values + i * shape.cols;
+		for (int j = 0; j < shape.cols; j++)
+		{
+			out[j] = row(0, j);
+		}
 	}
 }
 
+/**
+ *
+ * @param buffer
+ * @param rows
+ * @param cols
+ * @return
+ */
+Matrix Matrix::borrow(float *buffer, int rows, int cols)
+{
+	if (rows <= 0 || cols <= 0)
+	{
+		cerr << CONSTRUCTOR_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	return Matrix(buffer, {rows, cols});
+}
+
 /**
  *
  */
 Matrix::~Matrix()
 {
-	delete[] values;
+	if (owner)
+	{
+		poolRelease(values, shape.rows * shape.cols);
+	}
+}
+
+/**
+ *
+ * @param len
+ */
+void Matrix::_reallocate(int len)
+{
+	if (owner)
+	{
+		poolRelease(values, shape.rows * shape.cols);
+	}
+	values = poolAllocate(len);
+	owner = true;
 }
 
 /**
@@ -74,17 +230,30 @@ Matrix &Matrix::operator=(const Matrix &rhs)
 {
 	if (this != &rhs)
 	{
-		shape = {rhs.getRows(), rhs.getCols()};
-		delete[] values;
-		values = new float[shape.rows * shape.cols]();
-		for (int i = 0; i < shape.rows * shape.cols; i++)
+		// keep the buffer when the sizes match, only reshape
+		if (shape.rows * shape.cols != rhs.getRows() * rhs.getCols())
 		{
-			values[i] = rhs.values[i];
+			_reallocate(rhs.getRows() * rhs.getCols());
 		}
+		shape = {rhs.getRows(), rhs.getCols()};
+		std::copy(rhs.values, rhs.values + shape.rows * shape.cols, values);
 	}
 	return *this;
 }
 
+/**
+ *
+ * @param rhs
+ * @return
+ */
+Matrix &Matrix::operator=(Matrix &&rhs) noexcept
+{
+	std::swap(shape, rhs.shape);
+	std::swap(values, rhs.values);
+	std::swap(owner, rhs.owner);
+	return *this;
+}
+
 /**
  *
  * @return
@@ -103,6 +272,53 @@ int Matrix::getCols() const
 	return shape.cols;
 }
 
+/**
+ *
+ * @return
+ */
+float *Matrix::data()
+{
+	return values;
+}
+
+/**
+ *
+ * @return
+ */
+const float *Matrix::data() const
+{
+	return values;
+}
+
+/**
+ *
+ * @return
+ */
+MatrixView Matrix::view()
+{
+	return MatrixView(values, shape.rows, shape.cols, shape.cols);
+}
+
+/**
+ *
+ * @return
+ */
+ConstMatrixView Matrix::view() const
+{
+	return ConstMatrixView(values, shape.rows, shape.cols, shape.cols);
+}
+
+/**
+ *
+ * @return
+ */
+Matrix Matrix::transpose() const
+{
+	Matrix out(shape.cols, shape.rows, MatrixUninitialized);
+	transposeBlock(values, shape.cols, out.values, shape.rows, shape.rows, shape.cols);
+	return out;
+}
+
 /**
  *
  * @return
@@ -118,14 +334,37 @@ Matrix &Matrix::vectorize()
  */
 void Matrix::plainPrint() const
 {
+	// to_chars matches cout only on its default format, anything else is formatted as cout would
+	bool general = (cout.flags() & PRINT_FORMAT_FLAGS) == 0 && cout.width() == 0 &&
+				   cout.getloc() == std::locale::classic();
+	int precision = cout.precision() == 0 ? 1 : (int) cout.precision();
+	std::ostringstream formatted;
+	formatted.copyfmt(cout);
+	std::string row;
+	char number[FLOAT_CHARS];
 	for (int i = 0; i < shape.rows; i++)
 	{
+		row.clear();
 		for (int j = 0; j < shape.cols; j++)
 		{
-			cout << values[i * shape.cols + j] << " ";
+			if (general)
+			{
+				char *end = std::to_chars(number, number + FLOAT_CHARS, values[i * shape.cols + j],
+										  std::chars_format::general, precision).ptr;
+				row.append(number, end);
+			}
+			else
+			{
+				formatted.str(std::string());
+				formatted << values[i * shape.cols + j];
+				row += formatted.str();
+			}
+			row += ' ';
 		}
-		cout << endl;
+		row += '\n';
+		cout.write(row.data(), (std::streamsize) row.size());
 	}
+	cout.flush();
 }
 
 /**
@@ -137,22 +376,15 @@ Matrix Matrix::operator*(const Matrix &rhs) const
 {
 	if (this->getCols() == rhs.getRows())
 	{
-		int rows = this->getRows();
-		int cols = rhs.getCols();
-		int range = rhs.getRows();
-
-		Matrix newMatrix(rows, cols);
-
-		for (int i = 0; i < rows; i++)
+		Matrix newMatrix(this->getRows(), rhs.getCols(), MatrixUninitialized);
+		int threshold = getStrassenThreshold();
+		if (threshold > 0 && getRows() >= threshold && getRows() == getCols() && getCols() == rhs.getCols())
 		{
-			for (int j = 0; j < cols; j++)
-			{
-				for (int k = 0; k < range; k++)
-				{
-					newMatrix(i, j) += (values[i * range + k] * rhs.values[k * cols + j]);
-				}
-			}
+			strassen(getRows(), rhs.getCols(), getCols(), values, getCols(), rhs.values, rhs.getCols(),
+					 newMatrix.values, newMatrix.getCols());
+			return newMatrix;
 		}
+		gemm(view(), rhs.view(), newMatrix.view());
 		return newMatrix;
 	}
 	cerr << MULT_ERR_MSG << endl;
@@ -161,53 +393,20 @@ Matrix Matrix::operator*(const Matrix &rhs) const
 
 /**
  *
- * @param scalar
- * @return
+ * @param expr
  */
-Matrix Matrix::operator*(const float scalar) const
+void Matrix::_assign(const SumExpr<Matrix, Matrix> &expr)
 {
-	Matrix newMatrix = Matrix(shape.rows, shape.cols);
-	for (int i = 0; i < shape.rows * shape.cols; i++)
-	{
-		newMatrix[i] = values[i] * scalar;
-	}
-	return newMatrix;
+	simd().add(expr.lhs().data, expr.rhs().data, values, shape.rows * shape.cols);
 }
 
 /**
  *
- * @param scalar
- * @param rhs
- * @return
+ * @param expr
  */
-Matrix operator*(const float scalar, const Matrix &rhs)
+void Matrix::_assign(const ScaleExpr<Matrix> &expr)
 {
-	Matrix newMatrix = Matrix(rhs.shape.rows, rhs.shape.cols);
-	for (int i = 0; i < rhs.shape.rows * rhs.shape.cols; i++)
-	{
-		newMatrix[i] = rhs.values[i] * scalar;
-	}
-	return newMatrix;
-}
-
-/**
- *
- * @param rhs
- * @return
- */
-Matrix Matrix::operator+(const Matrix &rhs) const
-{
-	if (shape.rows == rhs.shape.rows && shape.cols == rhs.shape.cols)
-	{
-		Matrix newMatrix = Matrix(shape.rows, shape.cols);
-		for (int i = 0; i < shape.rows * shape.cols; i++)
-		{
-			newMatrix[i] = values[i] + rhs.values[i];
-		}
-		return newMatrix;
-	}
-	cerr << ADD_ERR_MSG << endl;
-	exit(EXIT_FAILURE);
+	simd().scale(expr.operand().data, expr.scalar(), values, shape.rows * shape.cols);
 }
 
 /**
@@ -219,14 +418,10 @@ Matrix &Matrix::operator+=(const Matrix &rhs)
 {
 	if (shape.rows == rhs.shape.rows && shape.cols == rhs.shape.cols)
 	{
-		for (int i = 0; i < shape.rows * shape.cols; i++)
-		{
-			values[i] += rhs[i];
-		}
+		simd().add(values, rhs.values, values, shape.rows * shape.cols);
 		return *this;
 	}
-	cerr << ADD_ERR_MSG << endl;
-	exit(EXIT_FAILURE);
+	addShapeError();
 }
 
 /**
@@ -325,11 +520,249 @@ std::ostream &operator<<(std::ostream &os, const Matrix &matrix)
  */
 std::istream &operator>>(std::istream &is, const Matrix &matrix)
 {
-	for (int i = 0; i < matrix.shape.rows * matrix.shape.cols; i++)
+	// one read of the whole buffer, not a call per value
+	is.read((char *) matrix.values, (std::streamsize) matrix.shape.rows * matrix.shape.cols * sizeof(float));
+	return is;
+}
+
+/**
+ * reverse the bytes of every float
+ * @param in the floats
+ * @param out where to write them, may be in
+ * @param len number of floats
+ */
+static void swapFloatBytes(const float *in, float *out, long len)
+{
+	for (long i = 0; i < len; i++)
 	{
-		is.read((char *) &matrix.values[i], sizeof(float));
+		uint32_t bits;
+		std::memcpy(&bits, in + i, sizeof(bits));
+		bits = __builtin_bswap32(bits);
+		std::memcpy(out + i, &bits, sizeof(bits));
 	}
-	return is;
 }
 
+/**
+ *
+ * @return
+ */
+bool hostIsLittleEndian()
+{
+	const uint32_t one = 1;
+	unsigned char first;
+	std::memcpy(&first, &one, 1);
+	return first == 1;
+}
+
+/**
+ *
+ * @param os
+ * @param matrix
+ * @param swapBytes
+ */
+void writeBinary(std::ostream &os, const Matrix &matrix, bool swapBytes)
+{
+	const float *values = matrix.data();
+	long len = (long) matrix.getRows() * matrix.getCols();
+	if (!swapBytes)
+	{
+		os.write((const char *) values, (std::streamsize) (len * sizeof(float)));
+		return;
+	}
+	float chunk[MATRIX_IO_CHUNK / sizeof(float)];
+	const long chunkLen = MATRIX_IO_CHUNK / sizeof(float);
+	for (long start = 0; start < len && os; start += chunkLen)
+	{
+		long count = std::min(chunkLen, len - start);
+		swapFloatBytes(values + start, chunk, count);
+		os.write((const char *) chunk, (std::streamsize) (count * sizeof(float)));
+	}
+}
+
+/**
+ *
+ * @param is
+ * @param matrix
+ * @param swapBytes
+ */
+void readBinary(std::istream &is, Matrix &matrix, bool swapBytes)
+{
+	long len = (long) matrix.getRows() * matrix.getCols();
+	is.read((char *) matrix.data(), (std::streamsize) (len * sizeof(float)));
+	if (swapBytes)
+	{
+		swapFloatBytes(matrix.data(), matrix.data(), len);
+	}
+}
+
+/**
+ *
+ * @param os
+ * @param matrix
+ * @param separator
+ */
+void writeCsv(std::ostream &os, const Matrix &matrix, char separator)
+{
+	std::vector<char> buffer(MATRIX_IO_CHUNK + FLOAT_CHARS);
+	char *out = buffer.data();
+	const char *full = buffer.data() + MATRIX_IO_CHUNK;
+	const float *values = matrix.data();
+	int cols = matrix.getCols();
+	for (int i = 0; i < matrix.getRows(); i++, values += cols)
+	{
+		for (int j = 0; j < cols; j++)
+		{
+			out = std::to_chars(out, out + FLOAT_CHARS - 1, values[j]).ptr;
+			*out++ = j + 1 < cols ? separator : '\n';
+			if (out >= full)
+			{
+				os.write(buffer.data(), out - buffer.data());
+				out = buffer.data();
+			}
+		}
+	}
+	os.write(buffer.data(), out - buffer.data());
+}
+
+/**
+ * exit with the parse error of a text matrix
+ * @param line the line, from 1
+ */
+static void csvFailed(long line)
+{
+	cerr << CSV_ERR_MSG << line << endl;
+	exit(EXIT_FAILURE);
+}
+
+/**
+ *
+ * @param is
+ * @param separator
+ * @return
+ */
+Matrix readCsv(std::istream &is, char separator)
+{
+	// the rest of the stream in bulk, not a formatted read per value
+	std::vector<char> text;
+	std::streamsize got;
+	do
+	{
+		size_t size = text.size();
+		text.resize(size + MATRIX_IO_CHUNK);
+		is.read(text.data() + size, MATRIX_IO_CHUNK);
+		got = is.gcount();
+		text.resize(size + got);
+	} while (got == MATRIX_IO_CHUNK);
+
+	// a blank separator is taken by the skipping of the blanks
+	bool blankSeparator = separator == ' ' || separator == '\t';
+	std::vector<float> values;
+	const char *p = text.data();
+	const char *end = p + text.size();
+	long rows = 0, cols = 0, line = 0;
+	while (p < end)
+	{
+		line++;
+		const char *eol = (const char *) std::memchr(p, '\n', end - p);
+		eol = eol == nullptr ? end : eol;
+		long count = 0;
+		bool separated = false;
+		while (true)
+		{
+			while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r'))
+			{
+				p++;
+			}
+			if (p == eol)
+			{
+				// a separator has to be followed by a value
+				if (separated)
+				{
+					csvFailed(line);
+				}
+				break;
+			}
+			float value;
+			std::from_chars_result parsed = std::from_chars(p, eol, value);
+			if (parsed.ec != std::errc())
+			{
+				csvFailed(line);
+			}
+			values.push_back(value);
+			count++;
+			separated = false;
+			p = parsed.ptr;
+			while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r'))
+			{
+				p++;
+			}
+			if (p < eol && *p == separator)
+			{
+				p++;
+				separated = true;
+			}
+			else if (p < eol && !blankSeparator)
+			{
+				csvFailed(line);
+			}
+		}
+		p = eol == end ? end : eol + 1;
+		if (count == 0)
+		{
+			continue;
+		}
+		if (rows > 0 && count != cols)
+		{
+			csvFailed(line);
+		}
+		cols = count;
+		rows++;
+		if (rows * cols > INT_MAX)
+		{
+			csvFailed(line);
+		}
+	}
+	if (rows == 0)
+	{
+		csvFailed(line);
+	}
+	Matrix matrix((int) rows, (int) cols, MatrixUninitialized);
+	std::copy(values.begin(), values.end(), matrix.data());
+	return matrix;
+}
+
+/**
+ *
+ * @param a
+ * @param b
+ * @param transA
+ * @param transB
+ * @return
+ */
+Matrix multiplyTransposed(const Matrix &a, const Matrix &b, bool transA, bool transB)
+{
+	ConstMatrixView lhs = transA ? a.view().transposed() : a.view();
+	ConstMatrixView rhs = transB ? b.view().transposed() : b.view();
+	if (lhs.getCols() != rhs.getRows())
+	{
+		cerr << MULT_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	Matrix out(lhs.getRows(), rhs.getCols(), MatrixUninitialized);
+	gemm(lhs, rhs, out.view());
+	return out;
+}
 
+/**
+ *
+ * @param in
+ * @param ldIn
+ * @param out
+ * @param ldOut
+ * @param rows
+ * @param cols
+ */
+void transposeInto(const float *in, int ldIn, float *out, int ldOut, int rows, int cols)
+{
+	transposeBlock(in, ldIn, out, ldOut, rows, cols);
+}
@@ -5,6 +5,9 @@
 
 #include <iostream>
 #include <cstdlib>
+#include "MatrixExpr.h"
+#include "BufferPool.h"
+#include "MatrixView.h"
 
 /**
  * @struct MatrixDims
@@ -16,16 +19,65 @@ typedef struct MatrixDims
 } MatrixDims;
 
 
+/**
+ * @enum MatrixInit
+ * @brief initial values of a new matrix
+ */
+enum MatrixInit
+{
+	MatrixZeros,
+	// for outputs that are fully overwritten anyway
+	MatrixUninitialized
+};
+
 /**
  * class which represent the
  * mathematical object matrix
- * and some of its utilities
+ * and some of its utilities.
+ * + and scalar * build lazy expressions (see MatrixExpr.h)
+ * that are evaluated in one pass when assigned to a Matrix.
+ * buffers come from the pool (see BufferPool.h), POOL_ALIGN aligned
  */
-class Matrix
+class Matrix : public MatrixExpr<Matrix>
 {
 private:
 	MatrixDims shape;
 	float *values;
+	// false for a borrowed buffer (see borrow), which is never released
+	bool owner;
+
+	/**
+	 * borrowing constructor, see borrow
+	 * @param buffer the values
+	 * @param dims the shape
+	 */
+	Matrix(float *buffer, MatrixDims dims);
+
+	/**
+	 * drop the current buffer (releasing it if owned)
+	 * and own a new uninitialized one
+	 * @param len number of values
+	 */
+	void _reallocate(int len);
+
+	/**
+	 * write the value of an expression of the same size into values
+	 * @param expr the expression to evaluate
+	 */
+	template<class E>
+	void _assign(const E &expr);
+
+	/**
+	 * a + b of two matrices, done by the simd add kernel
+	 * @param expr the sum
+	 */
+	void _assign(const SumExpr<Matrix, Matrix> &expr);
+
+	/**
+	 * a * s of a matrix, done by the simd scale kernel
+	 * @param expr the product
+	 */
+	void _assign(const ScaleExpr<Matrix> &expr);
 public:
 	/**
 	 * regular constructor.
@@ -35,6 +87,15 @@ public:
 	 */
 	Matrix(int rows, int cols);
 
+	/**
+	 * regular constructor without the zero fill,
+	 * for outputs that are written in full before being read
+	 * @param rows row dim
+	 * @param cols col dim
+	 * @param init MatrixZeros or MatrixUninitialized
+	 */
+	Matrix(int rows, int cols, MatrixInit init);
+
 	/**
 	 * default constructor. create a 1x1 matrix
 	 * using the regular constructor
@@ -47,6 +108,40 @@ public:
 	 */
 	Matrix(const Matrix &matrix);
 
+	/**
+	 * move constructor. takes the buffer of matrix, which
+	 * is left the default 1x1 zero matrix, still valid
+	 * @param matrix the matrix to move from
+	 */
+	Matrix(Matrix &&matrix) noexcept;
+
+	/**
+	 * from expression constructor. evaluates the
+	 * expression in a single pass into a new buffer
+	 * @param expr the expression to evaluate
+	 */
+	template<class E>
+	Matrix(const MatrixExpr<E> &expr);
+
+	/**
+	 * from view constructor, copies the viewed values
+	 * into a new matrix of the view's shape
+	 * @param view the values to copy
+	 */
+	explicit Matrix(ConstMatrixView view);
+
+	/**
+	 * a matrix on a buffer it does not own, e.g. a memory mapped
+	 * model file. no values are copied; the buffer must outlive
+	 * the matrix (and anything it is moved to). writes go to the buffer.
+	 * copies of it own their buffer as usual
+	 * @param buffer rows * cols row-major values
+	 * @param rows row dim
+	 * @param cols col dim
+	 * @return the matrix
+	 */
+	static Matrix borrow(float *buffer, int rows, int cols);
+
 	/**
 	 * de-constructor of a Matrix instance
 	 */
@@ -64,6 +159,34 @@ public:
 	 */
 	int getCols() const;
 
+	/**
+	 * the raw row-major buffer, for kernels that
+	 * walk it without the checked accessors
+	 * @return pointer to the first value
+	 */
+	float *data();
+
+	/**
+	 * the raw row-major buffer, for kernels that
+	 * walk it without the checked accessors
+	 * @return pointer to the first value
+	 */
+	const float *data() const;
+
+	/**
+	 * the whole matrix as a view, to take blocks, rows,
+	 * columns, transposes or reshapes of it without copying.
+	 * valid until the matrix is destroyed or reallocated
+	 * @return writable view
+	 */
+	MatrixView view();
+
+	/**
+	 * the whole matrix as a read-only view
+	 * @return read-only view
+	 */
+	ConstMatrixView view() const;
+
 	/**
 	 * matrix vectorized representation
 	 * (as reshape to nx1 shape)
@@ -72,7 +195,18 @@ public:
 	Matrix &vectorize();
 
 	/**
-	 * print the matrix in shape
+	 * the transpose, copied by a cache-oblivious blocked walk:
+	 * the block is halved along its longer side until it fits in
+	 * a few cache lines, so both matrices are read and written
+	 * a cache line at a time at every cache level
+	 * @return cols x rows matrix
+	 */
+	Matrix transpose() const;
+
+	/**
+	 * print the matrix in shape, formatted as cout is set to format a
+	 * float (by to_chars when it is on its default %g), a row per write
+	 * and a single flush
 	 */
 	void plainPrint() const;
 
@@ -84,42 +218,56 @@ public:
 	Matrix &operator=(const Matrix &rhs);
 
 	/**
-	 * matrix multiplication
-	 * @param rhs the right hand matrix
-	 * @return Matrix which is the value
-	 * of the multiplication
+	 * move assignment. swaps the buffers, so rhs is
+	 * left a valid matrix, the old one of this
+	 * @param rhs the matrix to move from
+	 * @return Matrix assigned to
 	 */
-	Matrix operator*(const Matrix &rhs) const;
+	Matrix &operator=(Matrix &&rhs) noexcept;
 
 	/**
-	 * right hand by scalar multiplication
-	 * @param scalar the scalar to multiply with
-	 * @return new matrix after the multiplication
+	 * = operator from an expression. evaluates it in a single
+	 * pass, into the current buffer when the sizes match
+	 * @param expr the expression to evaluate
+	 * @return Matrix assigned to
 	 */
-	Matrix operator*(const float scalar) const;
+	template<class E>
+	Matrix &operator=(const MatrixExpr<E> &expr);
 
 	/**
-	 * left hand by scalar multiplication
-	 * @param scalar the scalar to multiply with
-	 * @param rhs the matrix to multiply with
-	 * @return the value of the multiplication
+	 * matrix multiplication by gemm, or by strassen for square
+	 * products of at least getStrassenThreshold() once a caller
+	 * opted in by setStrassenThreshold (see Strassen.h)
+	 * @param rhs the right hand matrix
+	 * @return Matrix which is the value
+	 * of the multiplication
 	 */
-	friend Matrix operator*(const float scalar, const Matrix &rhs);
+	Matrix operator*(const Matrix &rhs) const;
 
 	/**
 	 * matrix addition
-	 * @param rhs
-	 * @return new matrix which is
-	 * the sum of the two matrices
+	 * @param rhs matrix to add to this
+	 * @return this after addition
 	 */
-	Matrix operator+(const Matrix &rhs) const;
+	Matrix &operator+=(const Matrix &rhs);
 
 	/**
-	 * matrix addition
-	 * @param rhs matrix to add to this
+	 * expression addition, evaluated in a single pass
+	 * @param expr expression to add to this
 	 * @return this after addition
 	 */
-	Matrix &operator+=(const Matrix &rhs);
+	template<class E>
+	Matrix &operator+=(const MatrixExpr<E> &expr);
+
+	/**
+	 * unchecked element read used by the expressions
+	 * @param idx row-major index
+	 * @return values[idx]
+	 */
+	float eval(int idx) const
+	{
+		return values[idx];
+	}
 
 	/**
 	 * value in the matrix
@@ -170,5 +318,153 @@ public:
 	friend std::istream &operator>>(std::istream &is, const Matrix &matrix);
 };
 
+/**
+ * op(a) * op(b) where op transposes when asked to, without
+ * materializing the transposes: the product runs on transposed
+ * views, and the kernels walk each operand along its stored rows.
+ * so weights may be kept in whichever layout is fastest
+ * @param a left matrix
+ * @param b right matrix
+ * @param transA use a^T
+ * @param transB use b^T
+ * @return the product
+ */
+Matrix multiplyTransposed(const Matrix &a, const Matrix &b, bool transA, bool transB);
+
+/**
+ * bytes the binary and text writers hand to the stream at once
+ */
+#define MATRIX_IO_CHUNK (1 << 16)
+
+/**
+ * whether the host stores floats little endian. raw float files
+ * (writeBinary, the model files) are in the byte order of the host
+ * that wrote them, so a file of the other order needs swapBytes
+ * @return true on little endian hosts
+ */
+bool hostIsLittleEndian();
+
+/**
+ * write the values, row after row, as raw floats: one write of the
+ * whole buffer, or chunks of MATRIX_IO_CHUNK bytes when swapping
+ * @param os the stream, binary
+ * @param matrix the matrix
+ * @param swapBytes reverse the bytes of every float, for a reader
+ * of the other byte order (e.g. !hostIsLittleEndian() for a little
+ * endian file)
+ */
+void writeBinary(std::ostream &os, const Matrix &matrix, bool swapBytes = false);
+
+/**
+ * read the values of a matrix of a known shape as raw floats in one
+ * read, like operator>>; the stream fails if it has less
+ * @param is the stream, binary
+ * @param matrix the matrix, keeps its shape
+ * @param swapBytes reverse the bytes of every float after reading
+ */
+void readBinary(std::istream &is, Matrix &matrix, bool swapBytes = false);
+
+/**
+ * write the matrix as text, a line per row, by std::to_chars: the
+ * shortest text of every float that reads back to the same float,
+ * formatted into a buffer and written a chunk at a time
+ * @param os the stream
+ * @param matrix the matrix
+ * @param separator between the values of a row
+ */
+void writeCsv(std::ostream &os, const Matrix &matrix, char separator = ',');
+
+/**
+ * read a matrix written as text, a line per row, by std::from_chars
+ * over the whole rest of the stream read in bulk. blanks around the
+ * values and empty lines are skipped; exits if the rows differ
+ * in length or a value does not parse
+ * @param is the stream
+ * @param separator between the values of a row
+ * @return the matrix
+ */
+Matrix readCsv(std::istream &is, char separator = ',');
+
+/**
+ * out = in^T between raw row-major buffers, by the same cache-oblivious
+ * walk as Matrix::transpose (e.g. image-major rows into the one image
+ * per column layout of a batch)
+ * @param in rows x cols values
+ * @param ldIn distance between two rows of in
+ * @param out cols x rows values
+ * @param ldOut distance between two rows of out
+ * @param rows rows of in
+ * @param cols cols of in
+ */
+void transposeInto(const float *in, int ldIn, float *out, int ldOut, int rows, int cols);
+
+/**
+ *
+ * @param matrix
+ */
+inline MatrixLeaf::MatrixLeaf(const Matrix &matrix) :
+		data(matrix.data()), rows(matrix.getRows()), cols(matrix.getCols())
+{}
+
+/**
+ *
+ * @param expr
+ */
+template<class E>
+void Matrix::_assign(const E &expr)
+{
+	// a local copy lets the compiler keep the operand pointers in registers
+	const E e = expr;
+	float *out = values;
+	int len = shape.rows * shape.cols;
+	// element-wise: an operand may be this, but only at the same index
+#pragma GCC ivdep
+	for (int i = 0; i < len; i++)
+	{
+		out[i] = e.eval(i);
+	}
+}
+
+/**
+ *
+ * @param expr
+ */
+template<class E>
+Matrix::Matrix(const MatrixExpr<E> &expr) : shape({expr.self().getRows(), expr.self().getCols()}), owner(true)
+{
+	values = poolAllocate(shape.rows * shape.cols);
+	_assign(expr.self());
+}
+
+/**
+ *
+ * @param expr
+ * @return
+ */
+template<class E>
+Matrix &Matrix::operator=(const MatrixExpr<E> &expr)
+{
+	const E &e = expr.self();
+	if (shape.rows * shape.cols != e.getRows() * e.getCols())
+	{
+		// this can not be an operand of an expression of another size, safe to drop
+		_reallocate(e.getRows() * e.getCols());
+	}
+	shape = {e.getRows(), e.getCols()};
+	_assign(e);
+	return *this;
+}
+
+/**
+ *
+ * @param expr
+ * @return
+ */
+template<class E>
+Matrix &Matrix::operator+=(const MatrixExpr<E> &expr)
+{
+	return *this = *this + expr.self();
+}
+
 
 #endif //MATRIX_H
@@ -0,0 +1,291 @@
+// MatrixExpr.h
+
+#ifndef MATRIXEXPR_H
+#define MATRIXEXPR_H
+
+class Matrix;
+
+/**
+ * prints the matrix addition shape error and exits,
+ * shared by the expressions and Matrix
+ */
+[[noreturn]] void addShapeError();
+
+/**
+ * prints the matrix index error and exits,
+ * shared by the expressions and Matrix
+ */
+[[noreturn]] void indexError();
+
+/**
+ * base of the lazy element-wise matrix expressions (CRTP).
+ * E provides getRows(), getCols() and eval(idx), the value at
+ * row-major index idx. nothing is computed until the expression
+ * is assigned to a Matrix, which then evaluates it in one pass.
+ * expressions keep pointers to the buffers of their Matrix operands,
+ * so keep them inside one full expression: auto s = a + b; is not a
+ * Matrix and dangles once a or b is gone, write Matrix s = a + b;.
+ * for the same reason expressions can not be copied or assigned, only
+ * their enclosing expressions and Matrix copy them, and a Matrix
+ * temporary (auto s = f() + b;) is no operand: name it first
+ */
+template<class E>
+class MatrixExpr
+{
+public:
+	/**
+	 * the actual expression
+	 * @return this as E
+	 */
+	const E &self() const
+	{
+		return static_cast<const E &>(*this);
+	}
+
+	/**
+	 * evaluate one element, exits if it is out of range
+	 * @param idx row-major index
+	 * @return the value of the expression at idx
+	 */
+	float operator[](const int idx) const
+	{
+		if (idx < 0 || idx >= self().getRows() * self().getCols())
+		{
+			indexError();
+		}
+		return self().eval(idx);
+	}
+
+	/**
+	 * evaluate one element, exits if it is out of range
+	 * @param row the row
+	 * @param col the col
+	 * @return the value of the expression at (row, col)
+	 */
+	float operator()(const int row, const int col) const
+	{
+		if (row < 0 || row >= self().getRows() || col < 0 || col >= self().getCols())
+		{
+			indexError();
+		}
+		return self().eval(row * self().getCols() + col);
+	}
+};
+
+/**
+ * a Matrix operand inside an expression: its buffer and shape,
+ * copied by value so the evaluation loop keeps them in registers
+ */
+struct MatrixLeaf
+{
+	const float *data;
+	int rows, cols;
+
+	/**
+	 * from Matrix constructor (defined in Matrix.h)
+	 * @param matrix the operand
+	 */
+	MatrixLeaf(const Matrix &matrix);
+
+	int getRows() const
+	{
+		return rows;
+	}
+
+	int getCols() const
+	{
+		return cols;
+	}
+
+	float eval(int idx) const
+	{
+		return data[idx];
+	}
+};
+
+/**
+ * how an expression holds an operand: matrices as a MatrixLeaf,
+ * sub-expressions (a few words each) by value
+ */
+template<class E>
+struct ExprOperand
+{
+	typedef E type;
+};
+
+template<>
+struct ExprOperand<Matrix>
+{
+	typedef MatrixLeaf type;
+};
+
+template<class L, class R>
+class SumExpr;
+
+template<class E>
+class ScaleExpr;
+
+/**
+ * lazy lhs + rhs
+ */
+template<class L, class R>
+class SumExpr : public MatrixExpr<SumExpr<L, R>>
+{
+private:
+	typename ExprOperand<L>::type _lhs;
+	typename ExprOperand<R>::type _rhs;
+
+	// copied only as an operand of an enclosing expression or by Matrix
+	template<class, class> friend class SumExpr;
+	template<class> friend class ScaleExpr;
+	friend class Matrix;
+
+	SumExpr(const SumExpr &) = default;
+public:
+	SumExpr &operator=(const SumExpr &) = delete;
+
+	/**
+	 * regular constructor, checks the shapes match
+	 * @param lhs left operand
+	 * @param rhs right operand
+	 */
+	SumExpr(const L &lhs, const R &rhs) : _lhs(lhs), _rhs(rhs)
+	{
+		if (lhs.getRows() != rhs.getRows() || lhs.getCols() != rhs.getCols())
+		{
+			addShapeError();
+		}
+	}
+
+	int getRows() const
+	{
+		return _lhs.getRows();
+	}
+
+	int getCols() const
+	{
+		return _lhs.getCols();
+	}
+
+	float eval(int idx) const
+	{
+		return _lhs.eval(idx) + _rhs.eval(idx);
+	}
+
+	const typename ExprOperand<L>::type &lhs() const
+	{
+		return _lhs;
+	}
+
+	const typename ExprOperand<R>::type &rhs() const
+	{
+		return _rhs;
+	}
+};
+
+/**
+ * lazy operand * scalar
+ */
+template<class E>
+class ScaleExpr : public MatrixExpr<ScaleExpr<E>>
+{
+private:
+	typename ExprOperand<E>::type _operand;
+	float _scalar;
+
+	// copied only as an operand of an enclosing expression or by Matrix
+	template<class, class> friend class SumExpr;
+	template<class> friend class ScaleExpr;
+	friend class Matrix;
+
+	ScaleExpr(const ScaleExpr &) = default;
+public:
+	ScaleExpr &operator=(const ScaleExpr &) = delete;
+
+	/**
+	 * regular constructor
+	 * @param operand the scaled expression
+	 * @param scalar the factor
+	 */
+	ScaleExpr(const E &operand, float scalar) : _operand(operand), _scalar(scalar)
+	{}
+
+	int getRows() const
+	{
+		return _operand.getRows();
+	}
+
+	int getCols() const
+	{
+		return _operand.getCols();
+	}
+
+	float eval(int idx) const
+	{
+		return _operand.eval(idx) * _scalar;
+	}
+
+	const typename ExprOperand<E>::type &operand() const
+	{
+		return _operand;
+	}
+
+	float scalar() const
+	{
+		return _scalar;
+	}
+};
+
+/**
+ * matrix addition
+ * @param lhs left expression
+ * @param rhs right expression
+ * @return lazy sum of the two, same shape
+ */
+template<class L, class R>
+SumExpr<L, R> operator+(const MatrixExpr<L> &lhs, const MatrixExpr<R> &rhs)
+{
+	return SumExpr<L, R>(lhs.self(), rhs.self());
+}
+
+/**
+ * a Matrix temporary is gone by the end of the full expression,
+ * before an expression kept by auto evaluates it
+ */
+template<class R>
+void operator+(Matrix &&lhs, const MatrixExpr<R> &rhs) = delete;
+
+template<class L>
+void operator+(const MatrixExpr<L> &lhs, Matrix &&rhs) = delete;
+
+void operator+(Matrix &&lhs, Matrix &&rhs) = delete;
+
+void operator*(Matrix &&matrix, float scalar) = delete;
+
+void operator*(float scalar, Matrix &&matrix) = delete;
+
+/**
+ * right hand by scalar multiplication
+ * @param expr the expression to multiply
+ * @param scalar the scalar to multiply with
+ * @return lazy product
+ */
+template<class E>
+ScaleExpr<E> operator*(const MatrixExpr<E> &expr, float scalar)
+{
+	return ScaleExpr<E>(expr.self(), scalar);
+}
+
+/**
+ * left hand by scalar multiplication
+ * @param scalar the scalar to multiply with
+ * @param expr the expression to multiply
+ * @return lazy product
+ */
+template<class E>
+ScaleExpr<E> operator*(float scalar, const MatrixExpr<E> &expr)
+{
+	return ScaleExpr<E>(expr.self(), scalar);
+}
+
+#endif //MATRIXEXPR_H
@@ -0,0 +1,175 @@
+// MatrixView.h
+
+#ifndef MATRIXVIEW_H
+#define MATRIXVIEW_H
+
+#include <iostream>
+#include <cstdlib>
+#include <type_traits>
+
+#define VIEW_IDX_ERR_MSG "Error: bad view indexes or shape"
+
+/**
+ * a non-owning window on row-major floats: element (i, j) is
+ * data[i * rowStride + j * colStride]. sub-blocks, single rows or
+ * columns, transposes and reshapes of a matrix are all views of its
+ * buffer, made without copying. the accessors are unchecked;
+ * build with -DMATRIX_DEBUG to check every index and shape.
+ * a view is only valid while the buffer it looks at is alive
+ * @tparam T float, or const float for a read-only view
+ */
+template<class T>
+class BasicMatrixView
+{
+private:
+	T *_data;
+	int _rows, _cols;
+	int _rowStride, _colStride;
+
+	/**
+	 * exits on a failed check of a debug build, nothing otherwise
+	 * @param valid the checked condition
+	 */
+	static void _check(bool valid)
+	{
+#ifdef MATRIX_DEBUG
+		if (!valid)
+		{
+			std::cerr << VIEW_IDX_ERR_MSG << std::endl;
+			exit(EXIT_FAILURE);
+		}
+#else
+		(void) valid;
+#endif
+	}
+
+public:
+	/**
+	 * regular constructor
+	 * @param data element (0, 0)
+	 * @param rows row dim
+	 * @param cols col dim
+	 * @param rowStride distance between two rows
+	 * @param colStride distance between two cols
+	 */
+	BasicMatrixView(T *data, int rows, int cols, int rowStride, int colStride = 1) :
+			_data(data), _rows(rows), _cols(cols), _rowStride(rowStride), _colStride(colStride)
+	{}
+
+	/**
+	 * a writable view is also a read-only one
+	 * @param view the view
+	 */
+	template<class U, class = typename std::enable_if<std::is_convertible<U *, T *>::value>::type>
+	BasicMatrixView(const BasicMatrixView<U> &view) :
+			_data(view.data()), _rows(view.getRows()), _cols(view.getCols()), _rowStride(view.getRowStride()),
+			_colStride(view.getColStride())
+	{}
+
+	T *data() const
+	{
+		return _data;
+	}
+
+	int getRows() const
+	{
+		return _rows;
+	}
+
+	int getCols() const
+	{
+		return _cols;
+	}
+
+	int getRowStride() const
+	{
+		return _rowStride;
+	}
+
+	int getColStride() const
+	{
+		return _colStride;
+	}
+
+	/**
+	 * rows are stored one after the other, no gaps
+	 * @return true if the view is one contiguous row-major run
+	 */
+	bool isContiguous() const
+	{
+		return _colStride == 1 && (_rowStride == _cols || _rows == 1);
+	}
+
+	/**
+	 * value in the view
+	 * @param row row idx
+	 * @param col col idx
+	 * @return the value by ref
+	 */
+	T &operator()(int row, int col) const
+	{
+		_check(row >= 0 && row < _rows && col >= 0 && col < _cols);
+		return _data[(long) row * _rowStride + (long) col * _colStride];
+	}
+
+	/**
+	 * a sub-block
+	 * @param row first row
+	 * @param col first col
+	 * @param rows rows in the block
+	 * @param cols cols in the block
+	 * @return view of the block
+	 */
+	BasicMatrixView block(int row, int col, int rows, int cols) const
+	{
+		_check(row >= 0 && col >= 0 && rows > 0 && cols > 0 && row + rows <= _rows && col + cols <= _cols);
+		return BasicMatrixView(&(*this)(row, col), rows, cols, _rowStride, _colStride);
+	}
+
+	/**
+	 * one row, as a 1 x cols view
+	 * @param row row idx
+	 * @return view of the row
+	 */
+	BasicMatrixView row(int row) const
+	{
+		return block(row, 0, 1, _cols);
+	}
+
+	/**
+	 * one column, as a rows x 1 view
+	 * @param col col idx
+	 * @return view of the column
+	 */
+	BasicMatrixView col(int col) const
+	{
+		return block(0, col, _rows, 1);
+	}
+
+	/**
+	 * the transpose, by swapping the strides
+	 * @return cols x rows view
+	 */
+	BasicMatrixView transposed() const
+	{
+		return BasicMatrixView(_data, _cols, _rows, _colStride, _rowStride);
+	}
+
+	/**
+	 * the same values in another shape (row-major order),
+	 * only for contiguous views
+	 * @param rows new row dim
+	 * @param cols new col dim
+	 * @return the reshaped view
+	 */
+	BasicMatrixView reshaped(int rows, int cols) const
+	{
+		_check(isContiguous() && rows > 0 && cols > 0 && (long) rows * cols == (long) _rows * _cols);
+		return BasicMatrixView(_data, rows, cols, cols, 1);
+	}
+};
+
+typedef BasicMatrixView<float> MatrixView;
+typedef BasicMatrixView<const float> ConstMatrixView;
+
+#endif //MATRIXVIEW_H
@@ -3,26 +3,45 @@
 //
 
 #include "MlpNetwork.h"
+#include "Profile.h"
 #include <iostream>
+#include <algorithm>
 
 using std::cerr;
 using std::endl;
+using std::vector;
 
 #define BAD_SIZE_ERR_MSG "Error: bad size of input to the MlpNetwork NN"
+#define BAD_MODEL_ERR_MSG "Error: the layers of the MlpNetwork NN do not chain"
+#define LAYER_IDX_ERR_MSG "Error: bad layer index of the MlpNetwork NN"
 
 /**
  *
- * @param vec
+ * @param logits
+ * @param len
+ * @return
+ */
+Digit MlpNetwork::_logitsToDigit(const float *logits, int len) const
+{
+	int index;
+	float probability = softmaxArgmax(logits, len, &index);
+	return {(unsigned int) index, probability};
+}
+
+/**
+ *
+ * @param outputs
+ * @param len
  * @return
  */
-Digit MlpNetwork::_probabilitiesToDigit(const Matrix &vec) const
+Digit MlpNetwork::_outputsToDigit(const float *outputs, int len) const
 {
-	Digit best = {(unsigned int) 0, (float) 0};
-	for (int i = 0; i < vec.getRows() * vec.getCols(); i++)
+	Digit best = {(unsigned int) 0, outputs[0]};
+	for (int i = 1; i < len; i++)
 	{
-		if (vec[i] > best.probability)
+		if (outputs[i] > best.probability)
 		{
-			best = {(unsigned int) i, (float) vec[i]};
+			best = {(unsigned int) i, outputs[i]};
 		}
 	}
 	return best;
@@ -30,19 +49,157 @@ Digit MlpNetwork::_probabilitiesToDigit(const Matrix &vec) const
 
 /**
  *
- * @param weights
- * @param biases
+ * @param probs
+ * @param col
+ * @return
  */
-MlpNetwork::MlpNetwork(Matrix weights[], Matrix biases[]) :
-		_layers
+Digit MlpNetwork::_columnToDigit(const Matrix &probs, int col) const
+{
+	ConstMatrixView column = probs.view().col(col);
+	Digit best = {(unsigned int) 0, column(0, 0)};
+	for (int i = 1; i < column.getRows(); i++)
+	{
+		if (column(i, 0) > best.probability)
 		{
-				Dense(weights[0], biases[0], Relu),
-				Dense(weights[1], biases[1], Relu),
-				Dense(weights[2], biases[2], Relu),
-				Dense(weights[3], biases[3], Softmax)
+			best = {(unsigned int) i, column(i, 0)};
 		}
+	}
+	return best;
+}
+
+/**
+ *
+ * @param weights
+ * @param biases
+ * @param format
+ */
+MlpNetwork::MlpNetwork(Matrix weights[], Matrix biases[], WeightFormat format) :
+		MlpNetwork(weights, biases, mlpActivations, MLP_SIZE, format)
 {}
 
+/**
+ *
+ * @param weights
+ * @param biases
+ * @param activations
+ * @param layers
+ * @param format
+ */
+MlpNetwork::MlpNetwork(Matrix weights[], Matrix biases[], const ActivationType activations[], int layers,
+					   WeightFormat format)
+{
+	_layers.reserve(std::max(layers, 0));
+	for (int i = 0; i < layers; i++)
+	{
+		_layers.emplace_back(weights[i], biases[i], activations[i]);
+	}
+	_init(format);
+}
+
+/**
+ *
+ * @param model
+ * @param format
+ */
+MlpNetwork::MlpNetwork(const MappedModel &model, WeightFormat format)
+{
+	_layers.reserve(model.getLayers());
+	for (int i = 0; i < model.getLayers(); i++)
+	{
+		_layers.emplace_back(model.weights(i), model.bias(i), model.activation(i));
+	}
+	_init(format);
+}
+
+/**
+ *
+ * @param format
+ */
+void MlpNetwork::_init(WeightFormat format)
+{
+	bool valid = !_layers.empty();
+	int widest = 0;
+	for (int i = 0; valid && i < (int) _layers.size(); i++)
+	{
+		const Matrix &w = _layers[i].getWeights();
+		const Matrix &b = _layers[i].getBias();
+		valid = b.getRows() == w.getRows() && b.getCols() == 1 &&
+				(i == 0 || w.getCols() == _layers[i - 1].getWeights().getRows());
+		widest = std::max(widest, w.getRows());
+	}
+	if (!valid)
+	{
+		cerr << BAD_MODEL_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	_widest = widest;
+	_plan.clear();
+	for (int i = 0; i < (int) _layers.size(); i++)
+	{
+		_layers[i].setWeightFormat(format);
+		bool last = i == (int) _layers.size() - 1;
+		_plan.push_back({i == 0 ? -1 : (i - 1) % 2, i % 2,
+						 last && _layers[i].getActivation().getActivationType() == Softmax});
+	}
+}
+
+/**
+ *
+ * @return
+ */
+int MlpNetwork::getLayers() const
+{
+	return (int) _layers.size();
+}
+
+/**
+ *
+ * @param layer
+ * @return
+ */
+const Dense &MlpNetwork::getLayer(int layer) const
+{
+	if (layer < 0 || layer >= (int) _layers.size())
+	{
+		cerr << LAYER_IDX_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	return _layers[layer];
+}
+
+/**
+ *
+ * @param layer
+ * @return
+ */
+Dense &MlpNetwork::getLayer(int layer)
+{
+	return const_cast<Dense &>(static_cast<const MlpNetwork &>(*this).getLayer(layer));
+}
+
+/**
+ *
+ * @return
+ */
+int MlpNetwork::getInputSize() const
+{
+	return _layers.front().getWeights().getCols();
+}
+
+/**
+ *
+ * @param layer
+ * @param batch
+ * @return
+ */
+Matrix MlpNetwork::_forwardLayerBatch(int layer, const Matrix &batch) const
+{
+	PROFILE_INDEXED_SCOPE(scope, "layer/batch", layer);
+	PROFILE_COUNT(scope, 2.0 * _layers[layer].getWeights().getRows() * _layers[layer].getWeights().getCols() *
+						 batch.getCols(), _layers[layer].weightBytes());
+	return _layers[layer].forwardBatch(batch);
+}
+
 /**
  *
  * @param vec
@@ -50,18 +207,96 @@ MlpNetwork::MlpNetwork(Matrix weights[], Matrix biases[]) :
  */
 Digit MlpNetwork::operator()(Matrix &vec) const
 {
-	if (vec.getRows() * vec.getCols() == imgDims.rows * imgDims.cols)
+	if (vec.getRows() * vec.getCols() == getInputSize())
 	{
-		Matrix vec2 = Matrix(vec);
-		for (int i = 0; i < MLP_SIZE; i++)
+		PROFILE_SCOPE(call, "mlp");
+		// per thread, so calls on a shared const network do not race
+		static thread_local vector<float> workspace;
+		if (workspace.size() < 2 * (size_t) _widest)
 		{
-			vec2 = _layers[i](vec2);
+			workspace.resize(2 * (size_t) _widest);
 		}
-		return _probabilitiesToDigit(vec2);
+		const float *out = nullptr;
+		for (int i = 0; i < (int) _plan.size(); i++)
+		{
+			PROFILE_INDEXED_SCOPE(layer, "layer", i);
+			PROFILE_COUNT(layer, 2.0 * _layers[i].getWeights().getRows() * _layers[i].getWeights().getCols(),
+						  _layers[i].weightBytes());
+			const Step &step = _plan[i];
+			const float *in = step.in < 0 ? vec.data() : workspace.data() + step.in * _widest;
+			float *to = workspace.data() + step.out * _widest;
+			if (step.linear)
+			{
+				_layers[i].forwardLinear(in, to);
+			}
+			else
+			{
+				_layers[i].forward(in, to);
+			}
+			out = to;
+		}
+		PROFILE_SCOPE(argmax, "argmax");
+		int len = _layers.back().getBias().getRows();
+		return _plan.back().linear ? _logitsToDigit(out, len) : _outputsToDigit(out, len);
 	}
 	cerr << BAD_SIZE_ERR_MSG << endl;
 	exit(EXIT_FAILURE);
 }
 
+/**
+ *
+ * @param images
+ * @return
+ */
+vector<Digit> MlpNetwork::classifyBatch(const Matrix &images) const
+{
+	if (images.getRows() != getInputSize())
+	{
+		cerr << BAD_SIZE_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	PROFILE_SCOPE(call, "mlp/batch");
+	Matrix batch = _forwardLayerBatch(0, images);
+	for (int i = 1; i < (int) _layers.size(); i++)
+	{
+		batch = _forwardLayerBatch(i, batch);
+	}
+	PROFILE_SCOPE(argmax, "argmax");
+	vector<Digit> digits(batch.getCols());
+	for (int j = 0; j < batch.getCols(); j++)
+	{
+		digits[j] = _columnToDigit(batch, j);
+	}
+	return digits;
+}
 
-
+/**
+ *
+ * @param images
+ * @param count
+ * @return
+ */
+vector<Digit> MlpNetwork::classifyBatch(const Matrix images[], int count) const
+{
+	if (count <= 0)
+	{
+		return vector<Digit>();
+	}
+	int len = getInputSize();
+	Matrix batch(len, count, MatrixUninitialized);
+	for (int j = 0; j < count; j++)
+	{
+		if (images[j].getRows() * images[j].getCols() != len)
+		{
+			cerr << BAD_SIZE_ERR_MSG << endl;
+			exit(EXIT_FAILURE);
+		}
+		const float *in = images[j].data();
+		MatrixView column = batch.view().col(j);
+		for (int i = 0; i < len; i++)
+		{
+			column(i, 0) = in[i];
+		}
+	}
+	return classifyBatch(batch);
+}
@@ -7,50 +7,188 @@
 #include "Matrix.h"
 #include "Dense.h"
 #include "Digit.h"
+#include "ModelFile.h"
+#include <vector>
 
 #define MLP_SIZE 4
 
-const MatrixDims imgDims = {28, 28};
-const MatrixDims weightsDims[] = {{128, 784},
-								  {64,  128},
-								  {20,  64},
-								  {10,  20}};
-const MatrixDims biasDims[] = {{128, 1},
-							   {64,  1},
-							   {20,  1},
-							   {10,  1}};
+constexpr MatrixDims imgDims = {28, 28};
+constexpr MatrixDims weightsDims[] = {{128, 784},
+									  {64,  128},
+									  {20,  64},
+									  {10,  20}};
+constexpr MatrixDims biasDims[] = {{128, 1},
+								   {64,  1},
+								   {20,  1},
+								   {10,  1}};
+
+// the activations of the default topology above
+constexpr ActivationType mlpActivations[] = {Relu, Relu, Relu, Softmax};
 
 /**
- * class to hold and run the whole NN
+ * class to hold and run the whole NN.
+ * any depth and widths: the layers only have to chain, each taking
+ * the outputs of the one before. everything that does not depend on
+ * the input (the shapes, the workspace width, which buffer each layer
+ * reads and writes, whether the last layer stops at its logits) is
+ * planned once at construction, a call only walks the plan.
+ * the plan is indices, not pointers, so copies stay valid
  */
 class MlpNetwork
 {
 private:
-	Dense _layers[MLP_SIZE];
+	/**
+	 * @struct Step
+	 * @brief one layer of the plan
+	 */
+	typedef struct Step
+	{
+		// the workspace buffer the layer reads, -1 for the input vector
+		int in;
+		// the workspace buffer the layer writes
+		int out;
+		// stop at W * x + b: the softmax of the last layer is
+		// folded into _logitsToDigit
+		bool linear;
+	} Step;
+
+	std::vector<Dense> _layers;
+	std::vector<Step> _plan;
+
+	// outputs of the widest layer, the size of each of the two
+	// ping-pong buffers operator() runs the layers through
+	int _widest;
 
 	/**
-	 * return the digit object from the probabilities vector
-	 * @param vec the probabilities vector
+	 * return the digit object from the logits of the softmax layer,
+	 * computing only the probability of the chosen digit
+	 * @param logits the logits vector values
+	 * @param len number of values
 	 * @return Digit struct which contains the value
 	 * and the probability of the digit written in
 	 * the image
 	 */
-	Digit _probabilitiesToDigit(const Matrix &vec) const;
+	Digit _logitsToDigit(const float *logits, int len) const;
+
+	/**
+	 * the digit of an output vector that is not a softmax:
+	 * the largest output, with its value as the probability
+	 * @param outputs the output vector values
+	 * @param len number of values
+	 * @return Digit struct of the largest output
+	 */
+	Digit _outputsToDigit(const float *outputs, int len) const;
+
+	/**
+	 * the digit of one column of a probabilities batch
+	 * @param probs matrix whose columns are probabilities vectors
+	 * @param col the column to read
+	 * @return Digit struct of the column
+	 */
+	Digit _columnToDigit(const Matrix &probs, int col) const;
+
+	/**
+	 * one layer of classifyBatch
+	 * @param layer the layer index
+	 * @param batch matrix whose columns are the inputs of the layer
+	 * @return matrix whose columns are its outputs
+	 */
+	Matrix _forwardLayerBatch(int layer, const Matrix &batch) const;
+
+	/**
+	 * check the layers chain, set their weight format, find the
+	 * workspace width and build the plan. exits if the layers do not chain
+	 * @param format the weight format of every layer
+	 */
+	void _init(WeightFormat format);
 
 public:
 	/**
 	 * constructor
 	 * constructs the whole NN
 	 * structure from Matrices and so
+	 * @param weights the weights of the layers
+	 * @param biases the biases of the layers
+	 * @param format WeightsInt8 quantizes the weights of every
+	 * layer to int8 once, here (see Dense::setWeightFormat)
 	 */
-	MlpNetwork(Matrix weights[], Matrix biases[]);
+	MlpNetwork(Matrix weights[], Matrix biases[], WeightFormat format = WeightsFloat);
 
 	/**
-	 * apply the NN on a vector
-	 * @param vec the vector which the NN will be applied on
-	 * @return the digit
+	 * construct a NN of any depth from its layers
+	 * @param weights the weights of the layers
+	 * @param biases the biases of the layers
+	 * @param activations the activations of the layers
+	 * @param layers number of layers, at least 1
+	 * @param format as in the default topology constructor
+	 */
+	MlpNetwork(Matrix weights[], Matrix biases[], const ActivationType activations[], int layers,
+			   WeightFormat format = WeightsFloat);
+
+	/**
+	 * construct the NN described by a mapped model file, of any
+	 * depth: the float layers run on the mapping without copying
+	 * the weights. the model must outlive the network
+	 * @param model the mapped model
+	 * @param format as in the matrices constructor
+	 */
+	explicit MlpNetwork(const MappedModel &model, WeightFormat format = WeightsFloat);
+
+	/**
+	 * number of layers
+	 * @return the depth
+	 */
+	int getLayers() const;
+
+	/**
+	 * one layer of the network
+	 * @param layer layer index
+	 * @return the layer
+	 */
+	const Dense &getLayer(int layer) const;
+
+	/**
+	 * one layer of the network, for training it in place
+	 * (see Dense::trainableWeights). the plan stays valid:
+	 * training does not change the shapes
+	 * @param layer layer index
+	 * @return the layer
+	 */
+	Dense &getLayer(int layer);
+
+	/**
+	 * length of the input vector, the cols of the first layer
+	 * @return the input size
+	 */
+	int getInputSize() const;
+
+	/**
+	 * apply the NN on a vector.
+	 * runs on workspaces kept per calling thread, sized at the first
+	 * call of each thread: later calls perform no heap allocation and
+	 * concurrent calls on one instance are safe
+	 * @param vec the vector which the NN will be applied on,
+	 * getInputSize() values in any shape
+	 * @return the digit (the index of the most probable output)
 	 */
 	Digit operator()(Matrix &vec) const;
+
+	/**
+	 * apply the NN on a batch of images at once.
+	 * every layer runs as one matrix product over
+	 * the whole batch instead of one product per image
+	 * @param images matrix of getInputSize() rows, one image per column
+	 * @return the digit of each column, in order
+	 */
+	std::vector<Digit> classifyBatch(const Matrix &images) const;
+
+	/**
+	 * apply the NN on a batch of images at once
+	 * @param images array of images, each of getInputSize() values in any shape
+	 * @param count number of images in the array
+	 * @return the digit of each image, in order
+	 */
+	std::vector<Digit> classifyBatch(const Matrix images[], int count) const;
 };
 
 #endif // MLPNETWORK_H
@@ -0,0 +1,232 @@
+// ModelFile.cpp
+
+#include "ModelFile.h"
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WRITE_ERR_MSG "Error: can not write the model file"
+#define OPEN_ERR_MSG "Error: can not open the model file"
+#define FORMAT_ERR_MSG "Error: not a model file of this version and byte order"
+#define LAYER_ERR_MSG "Error: bad layer index of the model"
+#define ACTIVATION_ERR_MSG "Error: unknown activation in the model file: "
+
+using std::cerr;
+using std::endl;
+
+/**
+ * round up to the tensor alignment
+ * @param offset a file offset
+ * @return the next multiple of MODEL_ALIGN
+ */
+static uint64_t alignOffset(uint64_t offset)
+{
+	return (offset + MODEL_ALIGN - 1) / MODEL_ALIGN * MODEL_ALIGN;
+}
+
+/**
+ * check a tensor of the file lies inside the mapping and fits a Matrix,
+ * without the offset + bytes sum that a hostile offset can wrap
+ * @param offset file offset of the tensor
+ * @param rows rows of the tensor, positive
+ * @param cols cols of the tensor, positive
+ * @param size bytes of the file
+ * @return true if the tensor can be read
+ */
+static bool tensorFits(uint64_t offset, int32_t rows, int32_t cols, uint64_t size)
+{
+	uint64_t len = (uint64_t) rows * (uint64_t) cols;
+	return len <= INT_MAX && offset <= size && sizeof(float) * len <= size - offset;
+}
+
+/**
+ *
+ * @param path
+ * @param weights
+ * @param biases
+ * @param activations
+ * @param layers
+ */
+void writeModel(const char *path, const Matrix weights[], const Matrix biases[], const ActivationType activations[],
+				int layers)
+{
+	ModelHeader header = {};
+	std::memcpy(header.magic, MODEL_MAGIC, MODEL_MAGIC_LEN);
+	header.version = MODEL_VERSION;
+	header.byteOrder = MODEL_BYTE_ORDER;
+	header.layers = (uint32_t) layers;
+
+	std::vector<ModelLayer> entries(layers);
+	uint64_t offset = alignOffset(sizeof(ModelHeader) + layers * sizeof(ModelLayer));
+	for (int i = 0; i < layers; i++)
+	{
+		entries[i].weightRows = weights[i].getRows();
+		entries[i].weightCols = weights[i].getCols();
+		entries[i].biasRows = biases[i].getRows();
+		entries[i].biasCols = biases[i].getCols();
+		std::strncpy(entries[i].activation, activationInfo(activations[i]).name, MODEL_NAME_LEN - 1);
+		entries[i].weightOffset = offset;
+		offset = alignOffset(offset + sizeof(float) * weights[i].getRows() * weights[i].getCols());
+		entries[i].biasOffset = offset;
+		offset = alignOffset(offset + sizeof(float) * biases[i].getRows() * biases[i].getCols());
+	}
+
+	std::ofstream os(path, std::ios::binary | std::ios::trunc);
+	const char padding[MODEL_ALIGN] = {};
+	os.write((const char *) &header, sizeof(header));
+	os.write((const char *) entries.data(), layers * sizeof(ModelLayer));
+	for (int i = 0; i < layers; i++)
+	{
+		const Matrix *tensors[] = {&weights[i], &biases[i]};
+		for (const Matrix *tensor : tensors)
+		{
+			uint64_t at = (uint64_t) os.tellp();
+			os.write(padding, (std::streamsize) (alignOffset(at) - at));
+			os.write((const char *) tensor->data(),
+					 (std::streamsize) (sizeof(float) * tensor->getRows() * tensor->getCols()));
+		}
+	}
+	uint64_t at = (uint64_t) os.tellp();
+	os.write(padding, (std::streamsize) (alignOffset(at) - at));
+	os.close();
+	if (!os)
+	{
+		cerr << WRITE_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ *
+ * @param path
+ */
+MappedModel::MappedModel(const char *path) : _base(MAP_FAILED), _size(0), _header(nullptr), _layers(nullptr)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		cerr << OPEN_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	_size = (size_t) st.st_size;
+	if (_size >= sizeof(ModelHeader))
+	{
+		// private and writable: the matrices get non-const buffers,
+		// a page is copied only if someone writes to it
+		_base = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (_base == MAP_FAILED)
+	{
+		cerr << OPEN_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	_header = (const ModelHeader *) _base;
+	_layers = (const ModelLayer *) (_header + 1);
+	bool valid = std::memcmp(_header->magic, MODEL_MAGIC, MODEL_MAGIC_LEN) == 0 &&
+				 _header->version == MODEL_VERSION && _header->byteOrder == MODEL_BYTE_ORDER &&
+				 sizeof(ModelHeader) + (uint64_t) _header->layers * sizeof(ModelLayer) <= _size;
+	for (uint32_t i = 0; valid && i < _header->layers; i++)
+	{
+		const ModelLayer &l = _layers[i];
+		valid = l.weightRows > 0 && l.weightCols > 0 && l.biasRows > 0 && l.biasCols > 0 &&
+				l.weightOffset % MODEL_ALIGN == 0 && l.biasOffset % MODEL_ALIGN == 0 &&
+				tensorFits(l.weightOffset, l.weightRows, l.weightCols, _size) &&
+				tensorFits(l.biasOffset, l.biasRows, l.biasCols, _size) &&
+				std::memchr(l.activation, 0, MODEL_NAME_LEN) != nullptr;
+	}
+	if (!valid)
+	{
+		cerr << FORMAT_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ *
+ */
+MappedModel::~MappedModel()
+{
+	munmap(_base, _size);
+}
+
+/**
+ *
+ * @return
+ */
+int MappedModel::getLayers() const
+{
+	return (int) _header->layers;
+}
+
+/**
+ *
+ * @param layer
+ * @return
+ */
+const ModelLayer &MappedModel::getLayer(int layer) const
+{
+	if (layer < 0 || layer >= getLayers())
+	{
+		cerr << LAYER_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	return _layers[layer];
+}
+
+/**
+ *
+ * @param offset
+ * @param rows
+ * @param cols
+ * @return
+ */
+Matrix MappedModel::_tensor(uint64_t offset, int rows, int cols) const
+{
+	return Matrix::borrow((float *) ((char *) _base + offset), rows, cols);
+}
+
+/**
+ *
+ * @param layer
+ * @return
+ */
+Matrix MappedModel::weights(int layer) const
+{
+	const ModelLayer &l = getLayer(layer);
+	return _tensor(l.weightOffset, l.weightRows, l.weightCols);
+}
+
+/**
+ *
+ * @param layer
+ * @return
+ */
+Matrix MappedModel::bias(int layer) const
+{
+	const ModelLayer &l = getLayer(layer);
+	return _tensor(l.biasOffset, l.biasRows, l.biasCols);
+}
+
+/**
+ *
+ * @param layer
+ * @return
+ */
+ActivationType MappedModel::activation(int layer) const
+{
+	const ModelLayer &l = getLayer(layer);
+	ActivationType type = Relu;
+	if (!findActivation(l.activation, &type))
+	{
+		cerr << ACTIVATION_ERR_MSG << l.activation << endl;
+		exit(EXIT_FAILURE);
+	}
+	return type;
+}
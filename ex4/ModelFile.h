@@ -0,0 +1,138 @@
+// ModelFile.h
+
+#ifndef MODELFILE_H
+#define MODELFILE_H
+
+#include "Matrix.h"
+#include "Activation.h"
+#include <cstddef>
+#include <cstdint>
+
+#define MODEL_MAGIC "MLPMODEL"
+#define MODEL_MAGIC_LEN 8
+// 2 added the activation of every layer
+#define MODEL_VERSION 2
+// written as is; reads back differently on a machine of the other byte order
+#define MODEL_BYTE_ORDER 0x01020304u
+// every tensor starts at a multiple of this (a cache line, the widest simd load)
+#define MODEL_ALIGN 64
+// room for an activation name and its terminating 0
+#define MODEL_NAME_LEN 16
+
+/**
+ * @struct ModelLayer
+ * @brief one layer of a model file: where its tensors are and
+ * what runs on them. the table of these entries is the manifest
+ * of the network, its depth is the number of entries
+ */
+typedef struct ModelLayer
+{
+	int32_t weightRows, weightCols;
+	int32_t biasRows, biasCols;
+	// from the start of the file, multiples of MODEL_ALIGN
+	uint64_t weightOffset, biasOffset;
+	// registry name of the activation (see findActivation), 0 terminated
+	char activation[MODEL_NAME_LEN];
+} ModelLayer;
+
+/**
+ * @struct ModelHeader
+ * @brief start of a model file, followed by layers ModelLayer entries.
+ * the tensors are raw row-major floats in the byte order of the writer
+ */
+typedef struct ModelHeader
+{
+	char magic[MODEL_MAGIC_LEN];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t layers;
+	uint32_t reserved;
+} ModelHeader;
+
+/**
+ * write the layers of a network as one model file. exits on failure
+ * @param path the file to create
+ * @param weights the weights of the layers
+ * @param biases the biases of the layers
+ * @param activations the activations of the layers
+ * @param layers number of layers
+ */
+void writeModel(const char *path, const Matrix weights[], const Matrix biases[], const ActivationType activations[],
+				int layers);
+
+/**
+ * a model file mapped into memory. the matrices it hands out
+ * borrow the mapping, nothing is read or copied up front: pages
+ * are loaded on first touch and shared with every process mapping
+ * the same file. the mapping is private, writes stay in this process.
+ * keep it alive while anything built from it is in use
+ */
+class MappedModel
+{
+private:
+	void *_base;
+	size_t _size;
+	const ModelHeader *_header;
+	const ModelLayer *_layers;
+
+	/**
+	 * the float tensor at an offset of the mapping
+	 * @param offset from the start of the file
+	 * @param rows rows of the tensor
+	 * @param cols cols of the tensor
+	 * @return matrix borrowing the tensor
+	 */
+	Matrix _tensor(uint64_t offset, int rows, int cols) const;
+
+public:
+	/**
+	 * map and check a model file. exits if it is not one
+	 * @param path the model file
+	 */
+	explicit MappedModel(const char *path);
+
+	/**
+	 * unmaps the file
+	 */
+	~MappedModel();
+
+	MappedModel(const MappedModel &) = delete;
+
+	MappedModel &operator=(const MappedModel &) = delete;
+
+	/**
+	 * number of layers in the file
+	 * @return the layers
+	 */
+	int getLayers() const;
+
+	/**
+	 * shape and place of the tensors of a layer
+	 * @param layer layer index
+	 * @return the entry
+	 */
+	const ModelLayer &getLayer(int layer) const;
+
+	/**
+	 * the weights of a layer, on the mapping (see Matrix::borrow)
+	 * @param layer layer index
+	 * @return borrowed matrix
+	 */
+	Matrix weights(int layer) const;
+
+	/**
+	 * the bias of a layer, on the mapping (see Matrix::borrow)
+	 * @param layer layer index
+	 * @return borrowed matrix
+	 */
+	Matrix bias(int layer) const;
+
+	/**
+	 * the activation of a layer, exits if its name is not registered
+	 * @param layer layer index
+	 * @return the type
+	 */
+	ActivationType activation(int layer) const;
+};
+
+#endif //MODELFILE_H
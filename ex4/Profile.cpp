@@ -0,0 +1,454 @@
+// Profile.cpp
+
+#include "Profile.h"
+#include "BufferPool.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+#define PROFILE_SECTIONS_ERR_MSG "Error: more than PROFILE_MAX_SECTIONS profile sections"
+
+namespace
+{
+/**
+ * @struct TraceEvent
+ * @brief one finished scope
+ */
+typedef struct TraceEvent
+{
+	const ProfileSection *section;
+	// ns since the epoch
+	long start, duration;
+} TraceEvent;
+
+/**
+ * @struct ThreadProfile
+ * @brief the counters and trace events of one thread, kept after it exits
+ */
+typedef struct ThreadProfile
+{
+	int thread;
+	ProfileCounters counters[PROFILE_MAX_SECTIONS];
+	// the events grow while the dumps read or clear them: under eventsLock,
+	// which only a dump contends for
+	std::mutex eventsLock;
+	std::vector<TraceEvent> events;
+	long dropped;
+} ThreadProfile;
+
+// the times of the trace are relative to it
+const long epoch = profileTicks();
+std::atomic<bool> tracing(false);
+
+std::mutex registryLock;
+
+/**
+ * every section, under registryLock
+ * @return the sections
+ */
+std::vector<std::unique_ptr<ProfileSection>> &sections()
+{
+	static std::vector<std::unique_ptr<ProfileSection>> all;
+	return all;
+}
+
+/**
+ * every thread's profile, under registryLock
+ * @return the profiles
+ */
+std::vector<std::unique_ptr<ThreadProfile>> &threadProfiles()
+{
+	static std::vector<std::unique_ptr<ThreadProfile>> all;
+	return all;
+}
+
+/**
+ * the calling thread's profile, registered on first use
+ * @return the profile
+ */
+ThreadProfile &threadProfile()
+{
+	static thread_local ThreadProfile *profile = nullptr;
+	if (profile == nullptr)
+	{
+		// value-initialized: every counter starts at 0
+		std::unique_ptr<ThreadProfile> created(new ThreadProfile());
+		std::lock_guard<std::mutex> guard(registryLock);
+		created->thread = (int) threadProfiles().size();
+		threadProfiles().push_back(std::move(created));
+		profile = threadProfiles().back().get();
+	}
+	return *profile;
+}
+
+/**
+ * add to a counter only the calling thread writes
+ * @param counter the counter
+ * @param value what to add
+ */
+inline void bump(std::atomic<long> &counter, long value)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+ * the histogram bucket of a time
+ * @param nanos the time
+ * @return floor(log2(nanos)), clamped to the buckets
+ */
+inline int bucketOf(long nanos)
+{
+	int b = 63 - __builtin_clzl((unsigned long) nanos | 1);
+	return b < PROFILE_BUCKETS ? b : PROFILE_BUCKETS - 1;
+}
+
+/**
+ * zero a thread's counters of a section
+ * @param counters the counters
+ */
+void clearCounters(ProfileCounters &counters)
+{
+	counters.calls = 0;
+	counters.nanos = 0;
+	counters.minNanos = 0;
+	counters.maxNanos = 0;
+	counters.flops = 0;
+	counters.bytes = 0;
+	counters.allocations = 0;
+	for (std::atomic<long> &bucket : counters.histogram)
+	{
+		bucket = 0;
+	}
+}
+
+/**
+ * the name of a section as a JSON string, with its index as "[i]"
+ * @param section the section
+ * @return the quoted name
+ */
+std::string sectionName(const ProfileSection &section)
+{
+	std::string name = std::string("\"") + section.getName();
+	if (section.getIndex() >= 0)
+	{
+		name += "[" + std::to_string(section.getIndex()) + "]";
+	}
+	return name + "\"";
+}
+}
+
+/**
+ *
+ * @return
+ */
+double profileNanosPerTick()
+{
+	static const double nanosPerTick = []
+	{
+		Clock::time_point start = Clock::now();
+		long ticks = profileTicks();
+		Clock::time_point now;
+		do
+		{
+			now = Clock::now();
+		} while (now - start < std::chrono::microseconds(PROFILE_CALIBRATE_MICROS));
+		long elapsed = profileTicks() - ticks;
+		double nanos = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+		return elapsed > 0 ? nanos / (double) elapsed : 1.0;
+	}();
+	return nanosPerTick;
+}
+
+// _____________________________ ProfileSection _____________________________
+
+/**
+ *
+ * @param name
+ * @param index
+ * @param id
+ */
+ProfileSection::ProfileSection(const char *name, int index, int id) : _name(name), _index(index), _id(id)
+{}
+
+const char *ProfileSection::getName() const
+{
+	return _name;
+}
+
+int ProfileSection::getIndex() const
+{
+	return _index;
+}
+
+int ProfileSection::getId() const
+{
+	return _id;
+}
+
+/**
+ *
+ * @param name
+ * @param index
+ * @return
+ */
+ProfileSection &profileSection(const char *name, int index)
+{
+	std::lock_guard<std::mutex> guard(registryLock);
+	for (const std::unique_ptr<ProfileSection> &section : sections())
+	{
+		if (section->getIndex() == index && std::string(section->getName()) == name)
+		{
+			return *section;
+		}
+	}
+	int id = (int) sections().size();
+	if (id >= PROFILE_MAX_SECTIONS)
+	{
+		std::cerr << PROFILE_SECTIONS_ERR_MSG << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	sections().push_back(std::unique_ptr<ProfileSection>(new ProfileSection(name, index, id)));
+	return *sections().back();
+}
+
+// _____________________________ ProfileSite _____________________________
+
+/**
+ *
+ * @param name
+ */
+ProfileSite::ProfileSite(const char *name) : _name(name), _sections()
+{}
+
+/**
+ *
+ * @param index
+ * @return
+ */
+ProfileSection &ProfileSite::section(int index)
+{
+	int slot = index + 1;
+	if (slot < 0 || slot >= PROFILE_SITE_INDICES)
+	{
+		return profileSection(_name, index);
+	}
+	ProfileSection *cached = _sections[slot].load(std::memory_order_acquire);
+	if (cached == nullptr)
+	{
+		cached = &profileSection(_name, index);
+		_sections[slot].store(cached, std::memory_order_release);
+	}
+	return *cached;
+}
+
+// _____________________________ ProfileScope _____________________________
+
+/**
+ *
+ * @param section
+ */
+ProfileScope::ProfileScope(const ProfileSection &section) :
+		_section(section), _counters(threadProfile().counters[section.getId()]),
+		_allocations(poolThreadRequests()), _start(profileTicks())
+{}
+
+/**
+ *
+ */
+ProfileScope::~ProfileScope()
+{
+	long end = profileTicks();
+	long elapsed = (long) ((double) (end - _start) * profileNanosPerTick());
+	long calls = _counters.calls.load(std::memory_order_relaxed);
+	bump(_counters.calls, 1);
+	bump(_counters.nanos, elapsed);
+	bump(_counters.allocations, poolThreadRequests() - _allocations);
+	bump(_counters.histogram[bucketOf(elapsed)], 1);
+	if (calls == 0 || elapsed < _counters.minNanos.load(std::memory_order_relaxed))
+	{
+		_counters.minNanos.store(elapsed, std::memory_order_relaxed);
+	}
+	if (elapsed > _counters.maxNanos.load(std::memory_order_relaxed))
+	{
+		_counters.maxNanos.store(elapsed, std::memory_order_relaxed);
+	}
+	if (tracing.load(std::memory_order_relaxed))
+	{
+		ThreadProfile &profile = threadProfile();
+		std::lock_guard<std::mutex> guard(profile.eventsLock);
+		if ((long) profile.events.size() < PROFILE_TRACE_EVENTS)
+		{
+			long start = (long) ((double) (_start - epoch) * profileNanosPerTick());
+			profile.events.push_back({&_section, start, elapsed});
+		}
+		else
+		{
+			profile.dropped++;
+		}
+	}
+}
+
+/**
+ *
+ * @param flops
+ * @param bytes
+ */
+void ProfileScope::count(double flops, double bytes)
+{
+	bump(_counters.flops, (long) flops);
+	bump(_counters.bytes, (long) bytes);
+}
+
+// _____________________________ dumps _____________________________
+
+/**
+ *
+ * @return
+ */
+bool profileEnabled()
+{
+#ifdef MLP_PROFILE
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ *
+ * @param on
+ */
+void setProfileTracing(bool on)
+{
+	tracing = on;
+}
+
+/**
+ *
+ */
+void resetProfile()
+{
+	std::lock_guard<std::mutex> guard(registryLock);
+	for (const std::unique_ptr<ThreadProfile> &profile : threadProfiles())
+	{
+		for (ProfileCounters &counters : profile->counters)
+		{
+			clearCounters(counters);
+		}
+		std::lock_guard<std::mutex> events(profile->eventsLock);
+		profile->events.clear();
+		profile->dropped = 0;
+	}
+}
+
+/**
+ *
+ * @param path
+ * @return
+ */
+bool writeProfileJson(const char *path)
+{
+	std::lock_guard<std::mutex> guard(registryLock);
+	std::ofstream os(path, std::ios::trunc);
+	os << "{\n  \"enabled\": " << (profileEnabled() ? "true" : "false") << ",\n  \"sections\": [";
+	bool first = true;
+	for (const std::unique_ptr<ProfileSection> &section : sections())
+	{
+		// the sum of the threads
+		long calls = 0, nanos = 0, minNanos = 0, maxNanos = 0, flops = 0, bytes = 0, allocations = 0;
+		long histogram[PROFILE_BUCKETS] = {};
+		for (const std::unique_ptr<ThreadProfile> &profile : threadProfiles())
+		{
+			const ProfileCounters &counters = profile->counters[section->getId()];
+			long threadCalls = counters.calls;
+			if (threadCalls == 0)
+			{
+				continue;
+			}
+			minNanos = calls == 0 ? counters.minNanos.load() : std::min(minNanos, counters.minNanos.load());
+			maxNanos = std::max(maxNanos, counters.maxNanos.load());
+			calls += threadCalls;
+			nanos += counters.nanos;
+			flops += counters.flops;
+			bytes += counters.bytes;
+			allocations += counters.allocations;
+			for (int b = 0; b < PROFILE_BUCKETS; b++)
+			{
+				histogram[b] += counters.histogram[b];
+			}
+		}
+		if (calls == 0)
+		{
+			continue;
+		}
+		os << (first ? "\n" : ",\n") << "    {\n";
+		first = false;
+		os << "      \"name\": " << sectionName(*section) << ",\n";
+		os << "      \"calls\": " << calls << ",\n";
+		os << "      \"total_ns\": " << nanos << ",\n";
+		os << "      \"mean_ns\": " << (double) nanos / calls << ",\n";
+		os << "      \"min_ns\": " << minNanos << ",\n";
+		os << "      \"max_ns\": " << maxNanos << ",\n";
+		os << "      \"flops_per_call\": " << (double) flops / calls << ",\n";
+		os << "      \"bytes_per_call\": " << (double) bytes / calls << ",\n";
+		os << "      \"gflops\": " << (nanos > 0 ? (double) flops / nanos : 0) << ",\n";
+		os << "      \"allocations_per_call\": " << (double) allocations / calls << ",\n";
+		// the non-empty buckets as [lowest ns, calls]
+		os << "      \"histogram_ns\": [";
+		bool firstBucket = true;
+		for (int b = 0; b < PROFILE_BUCKETS; b++)
+		{
+			if (histogram[b] > 0)
+			{
+				os << (firstBucket ? "" : ", ") << "[" << (1L << b) << ", " << histogram[b] << "]";
+				firstBucket = false;
+			}
+		}
+		os << "]\n    }";
+	}
+	os << "\n  ]\n}\n";
+	os.close();
+	return !os.fail();
+}
+
+/**
+ *
+ * @param path
+ * @return
+ */
+bool writeProfileTrace(const char *path)
+{
+	std::lock_guard<std::mutex> guard(registryLock);
+	std::ofstream os(path, std::ios::trunc);
+	os << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+	bool first = true;
+	long dropped = 0;
+	std::vector<TraceEvent> events;
+	for (const std::unique_ptr<ThreadProfile> &trace : threadProfiles())
+	{
+		// copied, so the thread is not held up while they are formatted
+		{
+			std::lock_guard<std::mutex> guard(trace->eventsLock);
+			events = trace->events;
+			dropped += trace->dropped;
+		}
+		for (const TraceEvent &event : events)
+		{
+			// complete events, times in microseconds
+			os << (first ? "\n" : ",\n") << "{\"name\": " << sectionName(*event.section)
+			   << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << trace->thread << ", \"ts\": " << event.start / 1e3
+			   << ", \"dur\": " << event.duration / 1e3 << "}";
+			first = false;
+		}
+	}
+	os << "\n], \"otherData\": {\"dropped_events\": " << dropped << "}}\n";
+	os.close();
+	return !os.fail();
+}
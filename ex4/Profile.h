@@ -0,0 +1,209 @@
+// Profile.h
+// opt-in instrumentation of inference: scoped timers around the
+// layers and their steps, FLOP, byte and matrix allocation counters,
+// aggregated over calls into per section histograms and dumped as
+// JSON or as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+// compiled in by -DMLP_PROFILE (make PROFILE=1); without it the
+// PROFILE_ macros expand to nothing and the dumps are empty
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <atomic>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * the latency histogram of a section: bucket b counts the calls
+ * of [2^b, 2^(b+1)) ns, the last one everything longer
+ */
+#define PROFILE_BUCKETS 40
+
+/**
+ * the most sections (name and index pairs) a process can have
+ */
+#define PROFILE_MAX_SECTIONS 128
+
+/**
+ * indexed sections (the layers) a PROFILE_INDEXED_SCOPE site caches,
+ * higher indices are looked up every call
+ */
+#define PROFILE_SITE_INDICES 64
+
+/**
+ * how long the tick rate is measured against steady_clock,
+ * once, on the first instrumented call
+ */
+#define PROFILE_CALIBRATE_MICROS 2000
+
+/**
+ * trace events kept per thread while tracing, later ones are dropped
+ */
+#define PROFILE_TRACE_EVENTS (1 << 18)
+
+/**
+ * a timestamp of the profile clock: the time stamp counter on x86,
+ * half the cost of a steady_clock read, steady_clock ns elsewhere
+ * @return the ticks
+ */
+inline long profileTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (long) __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * the length of a tick of profileTicks, measured on the first call
+ * @return ns per tick
+ */
+double profileNanosPerTick();
+
+/**
+ * @struct ProfileCounters
+ * @brief what one thread counted in one section. only the thread
+ * writes them, with plain loads and stores, so a scope costs no
+ * atomic read-modify-write; the dumps sum the threads
+ */
+typedef struct ProfileCounters
+{
+	std::atomic<long> calls, nanos, minNanos, maxNanos;
+	std::atomic<long> flops, bytes, allocations;
+	std::atomic<long> histogram[PROFILE_BUCKETS];
+} ProfileCounters;
+
+/**
+ * an instrumented section, a name and an index (e.g. the layer)
+ */
+class ProfileSection
+{
+private:
+	const char *_name;
+	int _index;
+	int _id;
+public:
+	/**
+	 * @param name the name, a string literal
+	 * @param index e.g. the layer, -1 for none
+	 * @param id its slot in the counters of every thread
+	 */
+	ProfileSection(const char *name, int index, int id);
+
+	const char *getName() const;
+
+	int getIndex() const;
+
+	int getId() const;
+};
+
+/**
+ * the section of a name and index, created on first use.
+ * exits past PROFILE_MAX_SECTIONS
+ * @param name the name, a string literal
+ * @param index e.g. the layer, -1 for none
+ * @return the section, lives as long as the process
+ */
+ProfileSection &profileSection(const char *name, int index);
+
+/**
+ * the sections of one PROFILE_ macro, cached so a call finds its
+ * section without a lock
+ */
+class ProfileSite
+{
+private:
+	const char *_name;
+	std::atomic<ProfileSection *> _sections[PROFILE_SITE_INDICES];
+public:
+	explicit ProfileSite(const char *name);
+
+	/**
+	 * @param index e.g. the layer, -1 for none
+	 * @return the section of the index
+	 */
+	ProfileSection &section(int index);
+};
+
+/**
+ * times its lifetime into the calling thread's counters of a section,
+ * and the matrix buffers the thread allocated meanwhile
+ * (see poolThreadRequests)
+ */
+class ProfileScope
+{
+private:
+	const ProfileSection &_section;
+	ProfileCounters &_counters;
+	long _allocations;
+	long _start;
+public:
+	explicit ProfileScope(const ProfileSection &section);
+
+	ProfileScope(const ProfileScope &other) = delete;
+
+	ProfileScope &operator=(const ProfileScope &other) = delete;
+
+	~ProfileScope();
+
+	/**
+	 * add to the work of the section
+	 * @param flops floating point operations
+	 * @param bytes bytes read and written, e.g. the weights
+	 */
+	void count(double flops, double bytes);
+};
+
+#ifdef MLP_PROFILE
+#define PROFILE_SCOPE(scope, name) \
+	static ProfileSite scope##Site(name); \
+	ProfileScope scope(scope##Site.section(-1))
+#define PROFILE_INDEXED_SCOPE(scope, name, index) \
+	static ProfileSite scope##Site(name); \
+	ProfileScope scope(scope##Site.section(index))
+#define PROFILE_COUNT(scope, flops, bytes) scope.count(flops, bytes)
+#else
+#define PROFILE_SCOPE(scope, name) ((void) 0)
+#define PROFILE_INDEXED_SCOPE(scope, name, index) ((void) 0)
+#define PROFILE_COUNT(scope, flops, bytes) ((void) 0)
+#endif
+
+/**
+ * whether the PROFILE_ macros are compiled in
+ * @return true with MLP_PROFILE
+ */
+bool profileEnabled();
+
+/**
+ * also keep every scope as a trace event, off by default
+ * @param on whether to trace
+ */
+void setProfileTracing(bool on);
+
+/**
+ * zero every section and drop the trace events. may run while
+ * instrumented threads do, a scope ending meanwhile may be half counted
+ */
+void resetProfile();
+
+/**
+ * write the sections: calls, time (total, mean, min, max, and the
+ * non-empty histogram buckets), FLOPs, bytes and allocations per call
+ * @param path the file
+ * @return false if it could not be written
+ */
+bool writeProfileJson(const char *path);
+
+/**
+ * write the trace events in the Chrome trace event format, a copy of
+ * each thread's taken under its lock, so tracing threads may go on
+ * @param path the file
+ * @return false if it could not be written
+ */
+bool writeProfileTrace(const char *path);
+
+#endif //PROFILE_H
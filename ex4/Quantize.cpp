@@ -0,0 +1,120 @@
+// Quantize.cpp
+
+#include "Quantize.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+
+/**
+ *
+ * @param len
+ * @return
+ */
+int quantizedLength(int len)
+{
+	return (len + QUANT_ROW_ALIGN - 1) / QUANT_ROW_ALIGN * QUANT_ROW_ALIGN;
+}
+
+/**
+ *
+ * @param in
+ * @param len
+ * @param out
+ * @return
+ */
+float quantizeVector(const float *in, int len, int8_t *out)
+{
+	float largest = 0;
+	for (int i = 0; i < len; i++)
+	{
+		largest = std::max(largest, std::fabs(in[i]));
+	}
+	int padded = quantizedLength(len);
+	if (largest == 0)
+	{
+		std::fill(out, out + padded, 0);
+		return 0;
+	}
+	float inverse = QUANT_MAX / largest;
+	for (int i = 0; i < len; i++)
+	{
+		// round half away from zero; |q| <= QUANT_MAX by the choice of scale
+		float q = in[i] * inverse;
+		out[i] = (int8_t) (q + (q < 0 ? -0.5f : 0.5f));
+	}
+	std::fill(out + len, out + padded, 0);
+	return largest / QUANT_MAX;
+}
+
+/**
+ *
+ */
+QuantizedMatrix::QuantizedMatrix() : _rows(0), _cols(0), _stride(0)
+{}
+
+/**
+ *
+ * @param matrix
+ */
+QuantizedMatrix::QuantizedMatrix(const Matrix &matrix) :
+		_rows(matrix.getRows()), _cols(matrix.getCols()), _stride(quantizedLength(matrix.getCols())),
+		_values((size_t) _rows * _stride), _scales(_rows), _rowSums(_rows)
+{
+	for (int i = 0; i < _rows; i++)
+	{
+		int8_t *row = _values.data() + (size_t) i * _stride;
+		_scales[i] = quantizeVector(matrix.data() + (size_t) i * _cols, _cols, row);
+		int32_t sum = 0;
+		for (int j = 0; j < _cols; j++)
+		{
+			sum += row[j];
+		}
+		_rowSums[i] = sum;
+	}
+}
+
+/**
+ *
+ * @return
+ */
+int QuantizedMatrix::getRows() const
+{
+	return _rows;
+}
+
+/**
+ *
+ * @return
+ */
+int QuantizedMatrix::getCols() const
+{
+	return _cols;
+}
+
+/**
+ *
+ * @return
+ */
+int QuantizedMatrix::getStride() const
+{
+	return _stride;
+}
+
+/**
+ *
+ * @return
+ */
+const float *QuantizedMatrix::scales() const
+{
+	return _scales.data();
+}
+
+/**
+ *
+ * @param x
+ * @param acc
+ */
+void QuantizedMatrix::multiply(const int8_t *x, int32_t *acc) const
+{
+	simd().int8Rows(_values.data(), _stride, x, _rowSums.data(), acc, _rows, _stride);
+}
@@ -0,0 +1,97 @@
+// Quantize.h
+
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include "Matrix.h"
+#include <cstdint>
+#include <vector>
+
+/**
+ * the largest magnitude of a symmetric int8 value
+ */
+#define QUANT_MAX 127
+
+/**
+ * quantized rows are zero padded to a multiple of this many values,
+ * the widest int8 step of the simd kernels
+ */
+#define QUANT_ROW_ALIGN 64
+
+/**
+ * number of int8 values a quantized row of len values takes
+ * @param len the values in the row
+ * @return len rounded up to QUANT_ROW_ALIGN
+ */
+int quantizedLength(int len);
+
+/**
+ * symmetric int8 quantization of a float vector:
+ * out[i] = round(in[i] / scale) with scale = max|in| / QUANT_MAX.
+ * out is zero padded up to quantizedLength(len)
+ * @param in the values
+ * @param len number of values
+ * @param out quantizedLength(len) int8 values
+ * @return the scale, in[i] ~ out[i] * scale (0 for an all zero vector)
+ */
+float quantizeVector(const float *in, int len, int8_t *out);
+
+/**
+ * a weight matrix quantized per row to int8 (post training):
+ * row i is stored as int8 values q and one float scale s_i with
+ * W(i, j) ~ q(i, j) * s_i. a row scale keeps the error of every
+ * output relative to its own weights, not the largest in the matrix
+ */
+class QuantizedMatrix
+{
+private:
+	int _rows, _cols, _stride;
+	std::vector<int8_t> _values;
+	std::vector<float> _scales;
+	std::vector<int32_t> _rowSums;
+public:
+	/**
+	 * empty (0x0) constructor
+	 */
+	QuantizedMatrix();
+
+	/**
+	 * quantize a float matrix
+	 * @param matrix the weights to quantize
+	 */
+	explicit QuantizedMatrix(const Matrix &matrix);
+
+	/**
+	 * getter for rows dim
+	 * @return rows dim
+	 */
+	int getRows() const;
+
+	/**
+	 * getter for cols dim
+	 * @return cols dim
+	 */
+	int getCols() const;
+
+	/**
+	 * distance between two rows of the int8 values,
+	 * cols padded to QUANT_ROW_ALIGN
+	 * @return the stride
+	 */
+	int getStride() const;
+
+	/**
+	 * the per row scales
+	 * @return getRows() scales
+	 */
+	const float *scales() const;
+
+	/**
+	 * acc = Q * x with exact int32 sums, on the simd int8 kernel
+	 * @param x getStride() int8 values, zero padded (see quantizeVector)
+	 * @param acc getRows() sums
+	 */
+	void multiply(const int8_t *x, int32_t *acc) const;
+};
+
+#endif //QUANTIZE_H
@@ -0,0 +1,542 @@
+// Simd.cpp
+
+#include "Simd.h"
+#include <cmath>
+#include <cpuid.h>
+#include <cstring>
+#include <immintrin.h>
+
+// cpuid leaf 1, ecx
+#define CPUID_FMA (1u << 12)
+#define CPUID_OSXSAVE (1u << 27)
+#define CPUID_F16C (1u << 29)
+#define CPUID_AVX (1u << 28)
+// cpuid leaf 7, ebx
+#define CPUID_AVX2 (1u << 5)
+#define CPUID_AVX512F (1u << 16)
+#define CPUID_AVX512BW (1u << 30)
+// cpuid leaf 7, ecx
+#define CPUID_AVX512VNNI (1u << 11)
+// xcr0 state the os saves on context switch
+#define XCR0_AVX 0x06u
+#define XCR0_AVX512 0xe6u
+
+// _____________________________ sse2 (x86-64 baseline) _____________________________
+
+namespace
+{
+namespace sse2
+{
+typedef __m128 Vec;
+const int WIDTH = 4;
+
+const int GEMM_MR = 4;
+const int GEMM_NR = 8;
+
+inline Vec vload(const float *p)
+{ return _mm_loadu_ps(p); }
+
+inline void vstore(float *p, Vec v)
+{ _mm_storeu_ps(p, v); }
+
+inline Vec vset1(float x)
+{ return _mm_set1_ps(x); }
+
+inline Vec vadd(Vec a, Vec b)
+{ return _mm_add_ps(a, b); }
+
+inline Vec vmul(Vec a, Vec b)
+{ return _mm_mul_ps(a, b); }
+
+inline Vec vmax(Vec a, Vec b)
+{ return _mm_max_ps(a, b); }
+
+inline Vec vmin(Vec a, Vec b)
+{ return _mm_min_ps(a, b); }
+
+inline Vec vdiv(Vec a, Vec b)
+{ return _mm_div_ps(a, b); }
+
+// base[idx[0..WIDTH)], sse2 has no gather
+inline Vec vgather(const float *base, const int *idx)
+{ return _mm_setr_ps(base[idx[0]], base[idx[1]], base[idx[2]], base[idx[3]]); }
+
+// p[0..4) in every group of four lanes
+inline Vec vload4(const float *p)
+{ return _mm_loadu_ps(p); }
+
+// a < b ? x : y per lane
+inline Vec vselectLess(Vec a, Vec b, Vec x, Vec y)
+{
+	__m128 m = _mm_cmplt_ps(a, b);
+	return _mm_or_ps(_mm_and_ps(m, x), _mm_andnot_ps(m, y));
+}
+
+// 2^n for integral n in [-126, 127], built in the exponent bits
+inline Vec vpow2n(Vec n)
+{
+	__m128i e = _mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127));
+	return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+}
+
+inline Vec vfmadd(Vec a, Vec b, Vec c)
+{ return _mm_add_ps(_mm_mul_ps(a, b), c); }
+
+// 4 fp16 widened without F16C: the exponent and mantissa shifted into
+// place are the value * 2^-112 (subnormals included), inf and NaN get
+// the full exponent back
+inline Vec vloadFp16(const uint16_t *p)
+{
+	__m128i h = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *) p), _mm_setzero_si128());
+	__m128i sign = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16);
+	__m128i bits = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+	__m128 f = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(bits, 13)), _mm_set1_ps(0x1p112f));
+	__m128i special = _mm_and_si128(_mm_cmpgt_epi32(bits, _mm_set1_epi32(0x7bff)), _mm_set1_epi32(0x7f800000));
+	return _mm_or_ps(_mm_or_ps(f, _mm_castsi128_ps(special)), _mm_castsi128_ps(sign));
+}
+
+// 4 bf16 are the top halves of their floats
+inline Vec vloadBf16(const uint16_t *p)
+{ return _mm_castsi128_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), _mm_loadl_epi64((const __m128i *) p))); }
+
+// 4 unsigned bytes zero extended twice
+inline Vec vloadBytes(const uint8_t *p)
+{
+	int bytes;
+	std::memcpy(&bytes, p, sizeof(bytes));
+	__m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), _mm_setzero_si128());
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(b, _mm_setzero_si128()));
+}
+
+inline float vhsum(Vec v)
+{
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+	return _mm_cvtss_f32(v);
+}
+
+typedef __m128i IVec;
+const int I8_STEP = 16;
+
+// I8_STEP bytes sign extended to int16, low and high halves
+struct IWide
+{
+	__m128i lo, hi;
+};
+
+inline IVec ivzero()
+{ return _mm_setzero_si128(); }
+
+inline IWide ivwiden(const int8_t *p)
+{
+	// sse2 has no sign extension of bytes: interleave with the sign mask
+	__m128i v = _mm_loadu_si128((const __m128i *) p);
+	__m128i sign = _mm_cmpgt_epi8(_mm_setzero_si128(), v);
+	return {_mm_unpacklo_epi8(v, sign), _mm_unpackhi_epi8(v, sign)};
+}
+
+inline IVec ivdot(IVec acc, IWide w, IWide x)
+{
+	acc = _mm_add_epi32(acc, _mm_madd_epi16(w.lo, x.lo));
+	return _mm_add_epi32(acc, _mm_madd_epi16(w.hi, x.hi));
+}
+
+inline int ivhsum(IVec v)
+{
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4e));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xb1));
+	return _mm_cvtsi128_si32(v);
+}
+
+#include "SimdBody.h"
+}
+}
+
+// _____________________________ avx2 _____________________________
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,f16c")
+
+namespace
+{
+namespace avx2
+{
+typedef __m256 Vec;
+const int WIDTH = 8;
+
+const int GEMM_MR = 6;
+const int GEMM_NR = 16;
+
+inline Vec vload(const float *p)
+{ return _mm256_loadu_ps(p); }
+
+inline void vstore(float *p, Vec v)
+{ _mm256_storeu_ps(p, v); }
+
+inline Vec vset1(float x)
+{ return _mm256_set1_ps(x); }
+
+inline Vec vadd(Vec a, Vec b)
+{ return _mm256_add_ps(a, b); }
+
+inline Vec vmul(Vec a, Vec b)
+{ return _mm256_mul_ps(a, b); }
+
+inline Vec vmax(Vec a, Vec b)
+{ return _mm256_max_ps(a, b); }
+
+inline Vec vmin(Vec a, Vec b)
+{ return _mm256_min_ps(a, b); }
+
+inline Vec vdiv(Vec a, Vec b)
+{ return _mm256_div_ps(a, b); }
+
+inline Vec vgather(const float *base, const int *idx)
+{ return _mm256_i32gather_ps(base, _mm256_loadu_si256((const __m256i *) idx), 4); }
+
+inline Vec vload4(const float *p)
+{ return _mm256_broadcast_ps((const __m128 *) p); }
+
+inline Vec vselectLess(Vec a, Vec b, Vec x, Vec y)
+{ return _mm256_blendv_ps(y, x, _mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+
+inline Vec vpow2n(Vec n)
+{
+	__m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+	return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+}
+
+inline Vec vfmadd(Vec a, Vec b, Vec c)
+{ return _mm256_fmadd_ps(a, b, c); }
+
+inline Vec vloadFp16(const uint16_t *p)
+{ return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) p)); }
+
+inline Vec vloadBf16(const uint16_t *p)
+{ return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) p)), 16)); }
+
+inline Vec vloadBytes(const uint8_t *p)
+{ return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) p))); }
+
+inline float vhsum(Vec v)
+{
+	__m128 h = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+	h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+	return _mm_cvtss_f32(h);
+}
+
+typedef __m256i IVec;
+const int I8_STEP = 32;
+
+// I8_STEP bytes sign extended to int16, low and high halves
+struct IWide
+{
+	__m256i lo, hi;
+};
+
+inline IVec ivzero()
+{ return _mm256_setzero_si256(); }
+
+inline IWide ivwiden(const int8_t *p)
+{
+	return {_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) p)),
+			_mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) (p + 16)))};
+}
+
+inline IVec ivdot(IVec acc, IWide w, IWide x)
+{
+	// widened to int16 and madd: exact, unlike maddubs which saturates
+	acc = _mm256_add_epi32(acc, _mm256_madd_epi16(w.lo, x.lo));
+	return _mm256_add_epi32(acc, _mm256_madd_epi16(w.hi, x.hi));
+}
+
+inline int ivhsum(IVec v)
+{
+	__m128i h = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+	h = _mm_add_epi32(h, _mm_shuffle_epi32(h, 0x4e));
+	h = _mm_add_epi32(h, _mm_shuffle_epi32(h, 0xb1));
+	return _mm_cvtsi128_si32(h);
+}
+
+#include "SimdBody.h"
+}
+}
+
+#pragma GCC pop_options
+
+// _____________________________ avx-512 _____________________________
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx2,fma,f16c")
+// gcc 12 flags the _mm512_undefined_ps() passthrough of the unmasked intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+namespace
+{
+namespace avx512
+{
+typedef __m512 Vec;
+const int WIDTH = 16;
+
+const int GEMM_MR = 6;
+const int GEMM_NR = 32;
+
+inline Vec vload(const float *p)
+{ return _mm512_loadu_ps(p); }
+
+inline void vstore(float *p, Vec v)
+{ _mm512_storeu_ps(p, v); }
+
+inline Vec vset1(float x)
+{ return _mm512_set1_ps(x); }
+
+inline Vec vadd(Vec a, Vec b)
+{ return _mm512_add_ps(a, b); }
+
+inline Vec vmul(Vec a, Vec b)
+{ return _mm512_mul_ps(a, b); }
+
+inline Vec vmax(Vec a, Vec b)
+{ return _mm512_max_ps(a, b); }
+
+inline Vec vmin(Vec a, Vec b)
+{ return _mm512_min_ps(a, b); }
+
+inline Vec vdiv(Vec a, Vec b)
+{ return _mm512_div_ps(a, b); }
+
+inline Vec vgather(const float *base, const int *idx)
+{ return _mm512_i32gather_ps(_mm512_loadu_si512(idx), base, 4); }
+
+inline Vec vload4(const float *p)
+{ return _mm512_broadcast_f32x4(_mm_loadu_ps(p)); }
+
+inline Vec vselectLess(Vec a, Vec b, Vec x, Vec y)
+{ return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ), y, x); }
+
+inline Vec vpow2n(Vec n)
+{
+	__m512i e = _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127));
+	return _mm512_castsi512_ps(_mm512_slli_epi32(e, 23));
+}
+
+inline Vec vfmadd(Vec a, Vec b, Vec c)
+{ return _mm512_fmadd_ps(a, b, c); }
+
+inline Vec vloadFp16(const uint16_t *p)
+{ return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *) p)); }
+
+inline Vec vloadBf16(const uint16_t *p)
+{ return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *) p)), 16)); }
+
+inline Vec vloadBytes(const uint8_t *p)
+{ return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *) p))); }
+
+inline float vhsum(Vec v)
+{ return _mm512_reduce_add_ps(v); }
+
+typedef __m512i IVec;
+const int I8_STEP = 64;
+
+// I8_STEP bytes sign extended to int16, low and high halves
+struct IWide
+{
+	__m512i lo, hi;
+};
+
+inline IVec ivzero()
+{ return _mm512_setzero_si512(); }
+
+inline IWide ivwiden(const int8_t *p)
+{
+	return {_mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *) p)),
+			_mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *) (p + 32)))};
+}
+
+inline IVec ivdot(IVec acc, IWide w, IWide x)
+{
+	acc = _mm512_add_epi32(acc, _mm512_madd_epi16(w.lo, x.lo));
+	return _mm512_add_epi32(acc, _mm512_madd_epi16(w.hi, x.hi));
+}
+
+inline int ivhsum(IVec v)
+{ return _mm512_reduce_add_epi32(v); }
+
+#include "SimdBody.h"
+}
+}
+
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+
+// _____________________________ avx-512 vnni _____________________________
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vnni,avx2,fma,f16c")
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+namespace
+{
+namespace vnni
+{
+/**
+ * kernelInt8Rows on vpdpbusd, which multiplies unsigned by signed bytes
+ * and adds groups of four straight into int32 without saturating.
+ * x is made unsigned by adding 128 (xor of the sign bit), the extra
+ * 128 * sum(row) is taken back with rowSums. four rows share each
+ * load and flip of x
+ */
+void kernelInt8Rows(const int8_t *w, int ldw, const int8_t *x, const int32_t *rowSums, int32_t *acc,
+					int rows, int cols)
+{
+	const __m512i signBit = _mm512_set1_epi8((char) 0x80);
+	int i = 0;
+	for (; i + 4 <= rows; i += 4)
+	{
+		const int8_t *w0 = w + i * ldw;
+		__m512i s0 = _mm512_setzero_si512();
+		__m512i s1 = _mm512_setzero_si512();
+		__m512i s2 = _mm512_setzero_si512();
+		__m512i s3 = _mm512_setzero_si512();
+		for (int p = 0; p < cols; p += 64)
+		{
+			__m512i u = _mm512_xor_si512(_mm512_loadu_si512(x + p), signBit);
+			s0 = _mm512_dpbusd_epi32(s0, u, _mm512_loadu_si512(w0 + p));
+			s1 = _mm512_dpbusd_epi32(s1, u, _mm512_loadu_si512(w0 + ldw + p));
+			s2 = _mm512_dpbusd_epi32(s2, u, _mm512_loadu_si512(w0 + 2 * ldw + p));
+			s3 = _mm512_dpbusd_epi32(s3, u, _mm512_loadu_si512(w0 + 3 * ldw + p));
+		}
+		acc[i] = _mm512_reduce_add_epi32(s0) - 128 * rowSums[i];
+		acc[i + 1] = _mm512_reduce_add_epi32(s1) - 128 * rowSums[i + 1];
+		acc[i + 2] = _mm512_reduce_add_epi32(s2) - 128 * rowSums[i + 2];
+		acc[i + 3] = _mm512_reduce_add_epi32(s3) - 128 * rowSums[i + 3];
+	}
+	for (; i < rows; i++)
+	{
+		const int8_t *row = w + i * ldw;
+		__m512i sum = _mm512_setzero_si512();
+		for (int p = 0; p < cols; p += 64)
+		{
+			__m512i u = _mm512_xor_si512(_mm512_loadu_si512(x + p), signBit);
+			sum = _mm512_dpbusd_epi32(sum, u, _mm512_loadu_si512(row + p));
+		}
+		acc[i] = _mm512_reduce_add_epi32(sum) - 128 * rowSums[i];
+	}
+}
+}
+}
+
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+
+// _____________________________ dispatch _____________________________
+
+namespace
+{
+const SimdKernels KERNELS[] = {
+		{SimdSse2,   "sse2",   sse2::kernelAdd,   sse2::kernelScale,   sse2::kernelRelu,
+				sse2::GEMM_MR,   sse2::GEMM_NR,   sse2::kernelGemmTile,   sse2::kernelDenseRows,
+				sse2::kernelInt8Rows, sse2::kernelAxpy, sse2::kernelExpSum, sse2::kernelMaxValue,
+				sse2::kernelSigmoid, sse2::kernelTanh, sse2::kernelGelu, sse2::kernelLeakyRelu,
+				sse2::kernelCsrRows, sse2::kernelBsrRows, sse2::kernelBsrBatch,
+				sse2::kernelHalfRows, sse2::kernelHalfToFloat, sse2::kernelBytesToFloat},
+		{SimdAvx2,   "avx2",   avx2::kernelAdd,   avx2::kernelScale,   avx2::kernelRelu,
+				avx2::GEMM_MR,   avx2::GEMM_NR,   avx2::kernelGemmTile,   avx2::kernelDenseRows,
+				avx2::kernelInt8Rows, avx2::kernelAxpy, avx2::kernelExpSum, avx2::kernelMaxValue,
+				avx2::kernelSigmoid, avx2::kernelTanh, avx2::kernelGelu, avx2::kernelLeakyRelu,
+				avx2::kernelCsrRows, avx2::kernelBsrRows, avx2::kernelBsrBatch,
+				avx2::kernelHalfRows, avx2::kernelHalfToFloat, avx2::kernelBytesToFloat},
+		{SimdAvx512, "avx512", avx512::kernelAdd, avx512::kernelScale, avx512::kernelRelu,
+				avx512::GEMM_MR, avx512::GEMM_NR, avx512::kernelGemmTile, avx512::kernelDenseRows,
+				avx512::kernelInt8Rows, avx512::kernelAxpy, avx512::kernelExpSum, avx512::kernelMaxValue,
+				avx512::kernelSigmoid, avx512::kernelTanh, avx512::kernelGelu, avx512::kernelLeakyRelu,
+				avx512::kernelCsrRows, avx512::kernelBsrRows, avx512::kernelBsrBatch,
+				avx512::kernelHalfRows, avx512::kernelHalfToFloat, avx512::kernelBytesToFloat},
+		{SimdAvx512Vnni, "avx512vnni", avx512::kernelAdd, avx512::kernelScale, avx512::kernelRelu,
+				avx512::GEMM_MR, avx512::GEMM_NR, avx512::kernelGemmTile, avx512::kernelDenseRows,
+				vnni::kernelInt8Rows, avx512::kernelAxpy, avx512::kernelExpSum, avx512::kernelMaxValue,
+				avx512::kernelSigmoid, avx512::kernelTanh, avx512::kernelGelu, avx512::kernelLeakyRelu,
+				avx512::kernelCsrRows, avx512::kernelBsrRows, avx512::kernelBsrBatch,
+				avx512::kernelHalfRows, avx512::kernelHalfToFloat, avx512::kernelBytesToFloat}
+};
+
+/**
+ * read an extended control register
+ * @param index the register
+ * @return its value
+ */
+unsigned int xgetbv(unsigned int index)
+{
+	unsigned int eax, edx;
+	__asm__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+	return eax;
+}
+
+/**
+ * the table for the detected level
+ * @return the active table, set once
+ */
+const SimdKernels *&active()
+{
+	static const SimdKernels *kernels = &KERNELS[detectSimdLevel()];
+	return kernels;
+}
+}
+
+/**
+ *
+ * @return
+ */
+SimdLevel detectSimdLevel()
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+	{
+		return SimdSse2;
+	}
+	unsigned int needed = CPUID_OSXSAVE | CPUID_AVX | CPUID_FMA | CPUID_F16C;
+	if ((ecx & needed) != needed)
+	{
+		return SimdSse2;
+	}
+	unsigned int xcr0 = xgetbv(0);
+	if ((xcr0 & XCR0_AVX) != XCR0_AVX || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+	{
+		return SimdSse2;
+	}
+	if ((ebx & CPUID_AVX512F) && (ebx & CPUID_AVX512BW) && (xcr0 & XCR0_AVX512) == XCR0_AVX512)
+	{
+		return (ecx & CPUID_AVX512VNNI) ? SimdAvx512Vnni : SimdAvx512;
+	}
+	return (ebx & CPUID_AVX2) ? SimdAvx2 : SimdSse2;
+}
+
+/**
+ *
+ * @return
+ */
+const SimdKernels &simd()
+{
+	return *active();
+}
+
+/**
+ *
+ * @param level
+ * @return
+ */
+SimdLevel setSimdLevel(SimdLevel level)
+{
+	SimdLevel best = detectSimdLevel();
+	if (level > best)
+	{
+		level = best;
+	}
+	active() = &KERNELS[level];
+	return level;
+}
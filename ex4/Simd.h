@@ -0,0 +1,226 @@
+// Simd.h
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstdint>
+
+/**
+ * @enum SimdLevel
+ * @brief instruction sets the kernels are built for
+ */
+enum SimdLevel
+{
+	SimdSse2,
+	SimdAvx2,
+	SimdAvx512,
+	// avx-512 with the int8 dot product instructions
+	SimdAvx512Vnni
+};
+
+/**
+ * @enum FusedEpilogue
+ * @brief what denseRows applies to each output before storing it
+ */
+enum FusedEpilogue
+{
+	EpilogueNone,
+	// softmax is not an epilogue: it needs the max of all outputs first
+	EpilogueRelu
+};
+
+/**
+ * @enum HalfType
+ * @brief 16 bit float formats of stored weights (see HalfMatrix)
+ */
+enum HalfType
+{
+	// IEEE binary16: 5 exponent bits, 10 mantissa bits
+	HalfFp16,
+	// bfloat16: the top half of a float, 8 exponent bits, 7 mantissa bits
+	HalfBf16
+};
+
+/**
+ * error bounds of SimdKernels::expSum against the correctly rounded
+ * exp, in ULP. measured worst cases over [-87.3, 88.3] are 1 and 661
+ */
+#define EXP_ACCURATE_ULP 2
+#define EXP_FAST_ULP 1024
+
+/**
+ * @enum ExpMode
+ * @brief precision of the vectorized exp (see SimdKernels::expSum)
+ */
+enum ExpMode
+{
+	ExpAccurate,
+	ExpFast
+};
+
+/**
+ * @struct SimdKernels
+ * @brief table of vectorized kernels for one instruction set.
+ * element-wise kernels take plain float arrays of len elements, out may alias an input.
+ * add, scale and relu do the very same IEEE operation per element as the
+ * scalar loops they replace, so every level gives bit-identical results
+ * (0 ULP tolerance, NaN in relu gives 0 like the scalar path)
+ */
+typedef struct SimdKernels
+{
+	SimdLevel level;
+	const char *name;
+
+	/**
+	 * out = a + b
+	 */
+	void (*add)(const float *a, const float *b, float *out, int len);
+
+	/**
+	 * out = a * scalar
+	 */
+	void (*scale)(const float *a, float scalar, float *out, int len);
+
+	/**
+	 * out = max(a, 0)
+	 */
+	void (*relu)(const float *a, float *out, int len);
+
+	/**
+	 * register tile of gemmTile, the gemm packing follows it
+	 */
+	int gemmMr, gemmNr;
+
+	/**
+	 * gemmMr x gemmNr tile of C (+)= packed A panel * packed B panel.
+	 * the A panel holds gemmMr values per depth step, the B panel gemmNr.
+	 * only the first mr x nr values of the tile are written
+	 */
+	void (*gemmTile)(int kc, const float *a, const float *b, float *c, int ldc, int mr, int nr,
+					 bool accumulate);
+
+	/**
+	 * y = epilogue(W * x + bias) for a rows x cols W with row distance ldw,
+	 * in one pass over W. bias may be null. returns the sum of y.
+	 * dot products are summed in a different order than the scalar loop,
+	 * results match it within a few ULP times cols
+	 */
+	float (*denseRows)(const float *w, int ldw, const float *x, const float *bias, float *y,
+					   int rows, int cols, int epilogue);
+
+	/**
+	 * acc = W * x for int8 W (rows x cols, row distance ldw) and int8 x,
+	 * with exact int32 sums. cols must be a multiple of 64, pad with zeros.
+	 * rowSums holds the sum of every row of W (used by vnni)
+	 */
+	void (*int8Rows)(const int8_t *w, int ldw, const int8_t *x, const int32_t *rowSums, int32_t *acc,
+					 int rows, int cols);
+
+	/**
+	 * y += alpha * x (fused multiply-add where the set has one)
+	 */
+	void (*axpy)(float alpha, const float *x, float *y, int len);
+
+	/**
+	 * out = exp(a - shift) for an ExpMode, returns the sum of out.
+	 * out may be a, or null to get only the sum.
+	 * exp(x) = 2^n * p(r) after reducing x to |r| <= ln2 / 2;
+	 * ExpAccurate (degree 7) is within EXP_ACCURATE_ULP of the exact
+	 * exp, ExpFast (degree 4) within EXP_FAST_ULP, at every level.
+	 * inputs are clamped to [-87.3, 88.3], so no inf and no denormals
+	 */
+	float (*expSum)(const float *a, float shift, float *out, int len, int mode);
+
+	/**
+	 * the largest of a[0..len), len > 0
+	 */
+	float (*maxValue)(const float *a, int len);
+
+	/**
+	 * out = 1 / (1 + exp(-a)), on the ExpAccurate exp
+	 */
+	void (*sigmoid)(const float *a, float *out, int len);
+
+	/**
+	 * out = tanh(a): an odd polynomial near 0, 1 - 2 / (exp(2a) + 1) beyond
+	 */
+	void (*tanh)(const float *a, float *out, int len);
+
+	/**
+	 * out = gelu(a) in its tanh form,
+	 * 0.5 a (1 + tanh(sqrt(2 / pi) (a + 0.044715 a^3)))
+	 */
+	void (*gelu)(const float *a, float *out, int len);
+
+	/**
+	 * out = a < 0 ? slope * a : a
+	 */
+	void (*leakyRelu)(const float *a, float slope, float *out, int len);
+
+	/**
+	 * y = W * x for a CSR W (see CsrMatrix): row i holds the values
+	 * [rowStart[i], rowStart[i + 1]) at the cols colIndex, gathered
+	 * from x a vector at a time
+	 */
+	void (*csrRows)(const int *rowStart, const int *colIndex, const float *values, const float *x, float *y,
+					int rows);
+
+	/**
+	 * y = W * x for a rows x cols W of 4x4 row-major blocks (see
+	 * BsrMatrix): block row i holds the blocks [blockStart[i],
+	 * blockStart[i + 1]) at the block cols blockCol
+	 */
+	void (*bsrRows)(const int *blockStart, const int *blockCol, const float *values, const float *x, float *y,
+					int rows, int cols);
+
+	/**
+	 * Y = W * X for the same BSR W and a row-major X of n cols
+	 * (row distance ldx, Y ldy): each block row keeps its 4 rows of
+	 * sums for 2 vectors of cols in registers over all its blocks
+	 */
+	void (*bsrBatch)(const int *blockStart, const int *blockCol, const float *values, const float *x, int ldx,
+					 float *y, int ldy, int rows, int cols, int n);
+
+	/**
+	 * y = W * x for a row-major W of 16 bit floats (HalfType type),
+	 * widened to float in registers (F16C / a shift for bf16) right
+	 * before the multiply-add, so only half the bytes of float weights
+	 * are read. four rows at a time like denseRows
+	 */
+	void (*halfRows)(const uint16_t *w, int ldw, int type, const float *x, float *y, int rows, int cols);
+
+	/**
+	 * out = in widened from 16 bit floats of HalfType type, exactly
+	 */
+	void (*halfToFloat)(const uint16_t *in, int type, float *out, int len);
+
+	/**
+	 * out = in * scale, unsigned bytes widened to float (e.g. pixels
+	 * normalized to [0, 1]). the same multiply as the scalar loop
+	 */
+	void (*bytesToFloat)(const uint8_t *in, float scale, float *out, int len);
+} SimdKernels;
+
+/**
+ * the kernels of the best instruction set the cpu supports.
+ * detected once (cpuid + xgetbv) on first use
+ * @return the active kernel table
+ */
+const SimdKernels &simd();
+
+/**
+ * force a level, e.g. to compare levels in the benchmark.
+ * levels the cpu does not support are lowered to the best supported one.
+ * not thread safe, call it before running kernels
+ * @param level the wanted level
+ * @return the level actually set
+ */
+SimdLevel setSimdLevel(SimdLevel level);
+
+/**
+ * the best level supported by the cpu and the os
+ * @return the level
+ */
+SimdLevel detectSimdLevel();
+
+#endif //SIMD_H
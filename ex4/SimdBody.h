@@ -0,0 +1,839 @@
+// SimdBody.h
+// kernel bodies shared by every instruction set. Simd.cpp includes this file
+// once per set, inside a namespace that defines Vec, WIDTH and the v* helpers,
+// so there is no include guard on purpose.
+
+/**
+ * out = a + b
+ */
+static void kernelAdd(const float *a, const float *b, float *out, int len)
+{
+	int i = 0;
+	for (; i + WIDTH <= len; i += WIDTH)
+	{
+		vstore(out + i, vadd(vload(a + i), vload(b + i)));
+	}
+	for (; i < len; i++)
+	{
+		out[i] = a[i] + b[i];
+	}
+}
+
+/**
+ * out = a * scalar
+ */
+static void kernelScale(const float *a, float scalar, float *out, int len)
+{
+	Vec s = vset1(scalar);
+	int i = 0;
+	for (; i + WIDTH <= len; i += WIDTH)
+	{
+		vstore(out + i, vmul(vload(a + i), s));
+	}
+	for (; i < len; i++)
+	{
+		out[i] = a[i] * scalar;
+	}
+}
+
+/**
+ * out = max(a, 0)
+ */
+static void kernelRelu(const float *a, float *out, int len)
+{
+	Vec zero = vset1(0);
+	int i = 0;
+	for (; i + WIDTH <= len; i += WIDTH)
+	{
+		// max returns its second operand for NaN, as the scalar path does
+		vstore(out + i, vmax(vload(a + i), zero));
+	}
+	for (; i < len; i++)
+	{
+		out[i] = 0 < a[i] ? a[i] : 0;
+	}
+}
+
+/**
+ * y += alpha * x
+ */
+static void kernelAxpy(float alpha, const float *x, float *y, int len)
+{
+	Vec a = vset1(alpha);
+	int i = 0;
+	for (; i + WIDTH <= len; i += WIDTH)
+	{
+		vstore(y + i, vfmadd(a, vload(x + i), vload(y + i)));
+	}
+	for (; i < len; i++)
+	{
+		y[i] += alpha * x[i];
+	}
+}
+
+// exp: x = n ln2 + r with |r| <= ln2 / 2, exp(x) = 2^n exp(r).
+// ln2 is split in two (Cody-Waite) so n * EXP_LN2_HI is exact
+const float EXP_LO = -87.3f;
+const float EXP_HI = 88.3f;
+const float EXP_LOG2E = 1.44269504f;
+const float EXP_LN2_HI = 0.693359375f;
+const float EXP_LN2_LO = -2.12194440e-4f;
+// adding and taking back 1.5 * 2^23 rounds to the nearest integer
+const float EXP_ROUND = 12582912.0f;
+
+/**
+ * exp of every lane. accurate: the degree 7 polynomial of cephes
+ * expf; fast: degree 4 Taylor. inputs are clamped to [EXP_LO, EXP_HI]
+ */
+static inline Vec vexp(Vec x, bool fast)
+{
+	x = vmin(vmax(x, vset1(EXP_LO)), vset1(EXP_HI));
+	Vec n = vadd(vadd(vmul(x, vset1(EXP_LOG2E)), vset1(EXP_ROUND)), vset1(-EXP_ROUND));
+	Vec r = vfmadd(n, vset1(-EXP_LN2_HI), x);
+	r = vfmadd(n, vset1(-EXP_LN2_LO), r);
+	Vec p;
+	if (fast)
+	{
+		p = vfmadd(r, vset1(1 / 24.0f), vset1(1 / 6.0f));
+		p = vfmadd(p, r, vset1(0.5f));
+	}
+	else
+	{
+		p = vfmadd(r, vset1(1.9875691500e-4f), vset1(1.3981999507e-3f));
+		p = vfmadd(p, r, vset1(8.3334519073e-3f));
+		p = vfmadd(p, r, vset1(4.1665795894e-2f));
+		p = vfmadd(p, r, vset1(1.6666665459e-1f));
+		p = vfmadd(p, r, vset1(5.0000001201e-1f));
+	}
+	// 1 + r + r^2 * p
+	p = vfmadd(vmul(r, r), p, vadd(r, vset1(1)));
+	return vmul(p, vpow2n(n));
+}
+
+/**
+ * out = exp(a - shift), returns the sum of out. out may be null
+ */
+static float kernelExpSum(const float *a, float shift, float *out, int len, int mode)
+{
+	bool fast = mode == ExpFast;
+	Vec s = vset1(-shift);
+	Vec sum = vset1(0);
+	int i = 0;
+	for (; i + WIDTH <= len; i += WIDTH)
+	{
+		Vec e = vexp(vadd(vload(a + i), s), fast);
+		if (out)
+		{
+			vstore(out + i, e);
+		}
+		sum = vadd(sum, e);
+	}
+	float total = vhsum(sum);
+	if (i < len)
+	{
+		// the tail goes through the same vector code, so every element
+		// gets the same result wherever it is in the array
+		float lanes[WIDTH] = {};
+		for (int j = i; j < len; j++)
+		{
+			lanes[j - i] = a[j];
+		}
+		vstore(lanes, vexp(vadd(vload(lanes), s), fast));
+		for (int j = i; j < len; j++)
+		{
+			if (out)
+			{
+				out[j] = lanes[j - i];
+			}
+			total += lanes[j - i];
+		}
+	}
+	return total;
+}
+
+/**
+ * out = f(a) for a vector function f. the tail goes through f as
+ * well, so every element gets the same result wherever it is
+ */
+template<class F>
+static inline void unaryKernel(const float *a, float *out, int len, F f)
+{
+	int i = 0;
+	for (; i + WIDTH <= len; i += WIDTH)
+	{
+		vstore(out + i, f(vload(a + i)));
+	}
+	if (i < len)
+	{
+		float lanes[WIDTH] = {};
+		for (int j = i; j < len; j++)
+		{
+			lanes[j - i] = a[j];
+		}
+		vstore(lanes, f(vload(lanes)));
+		for (int j = i; j < len; j++)
+		{
+			out[j] = lanes[j - i];
+		}
+	}
+}
+
+// below it the sigmoid of a float is under FLT_MIN: clamping there keeps
+// the result normal, denormals would slow every later operation on it
+const float SIGMOID_LO = -87.0f;
+
+/**
+ * 1 / (1 + exp(-x)) of every lane
+ */
+static inline Vec vsigmoid(Vec x)
+{
+	Vec one = vset1(1);
+	x = vmax(x, vset1(SIGMOID_LO));
+	return vdiv(one, vadd(one, vexp(vmul(x, vset1(-1)), false)));
+}
+
+/**
+ * out = 1 / (1 + exp(-a))
+ */
+static void kernelSigmoid(const float *a, float *out, int len)
+{
+	unaryKernel(a, out, len, vsigmoid);
+}
+
+// below it tanh is the odd polynomial of cephes tanhf, 1 - 2 / (exp(2x) + 1) cancels there
+const float TANH_SMALL = 0.625f;
+// above it tanh rounds to 1 in float
+const float TANH_HI = 9.0f;
+
+/**
+ * tanh of every lane
+ */
+static inline Vec vtanh(Vec x)
+{
+	Vec one = vset1(1);
+	Vec t = vmin(vmax(x, vmul(x, vset1(-1))), vset1(TANH_HI));
+	Vec big = vadd(one, vdiv(vset1(-2), vadd(vexp(vadd(t, t), false), one)));
+	big = vselectLess(x, vset1(0), vmul(big, vset1(-1)), big);
+	Vec z = vmul(x, x);
+	Vec p = vfmadd(z, vset1(-5.70498872745e-3f), vset1(2.06390887954e-2f));
+	p = vfmadd(p, z, vset1(-5.37397155531e-2f));
+	p = vfmadd(p, z, vset1(1.33314422036e-1f));
+	p = vfmadd(p, z, vset1(-3.33332819422e-1f));
+	Vec small = vfmadd(vmul(x, z), p, x);
+	return vselectLess(t, vset1(TANH_SMALL), small, big);
+}
+
+/**
+ * out = tanh(a)
+ */
+static void kernelTanh(const float *a, float *out, int len)
+{
+	unaryKernel(a, out, len, vtanh);
+}
+
+// sqrt(2 / pi) and the cubic term of the tanh form of gelu
+const float GELU_SQRT_2_PI = 0.797884561f;
+const float GELU_CUBIC = 0.044715f;
+
+/**
+ * gelu of every lane: 0.5 x (1 + tanh(u)) with u = sqrt(2 / pi) (x + 0.044715 x^3),
+ * computed as x * sigmoid(2 u) so there is no cancellation
+ */
+static inline Vec vgelu(Vec x)
+{
+	Vec u = vmul(vfmadd(vmul(vmul(x, x), x), vset1(GELU_CUBIC), x), vset1(GELU_SQRT_2_PI));
+	return vmul(x, vsigmoid(vadd(u, u)));
+}
+
+/**
+ * out = gelu(a)
+ */
+static void kernelGelu(const float *a, float *out, int len)
+{
+	unaryKernel(a, out, len, vgelu);
+}
+
+/**
+ * out = a < 0 ? slope * a : a
+ */
+static void kernelLeakyRelu(const float *a, float slope, float *out, int len)
+{
+	Vec s = vset1(slope);
+	Vec zero = vset1(0);
+	int i = 0;
+	for (; i + WIDTH <= len; i += WIDTH)
+	{
+		Vec x = vload(a + i);
+		vstore(out + i, vselectLess(x, zero, vmul(x, s), x));
+	}
+	for (; i < len; i++)
+	{
+		out[i] = a[i] < 0 ? slope * a[i] : a[i];
+	}
+}
+
+/**
+ * the largest of a[0..len), len > 0
+ */
+static float kernelMaxValue(const float *a, int len)
+{
+	float best = a[0];
+	int i = 0;
+	if (len >= WIDTH)
+	{
+		Vec m = vload(a);
+		for (i = WIDTH; i + WIDTH <= len; i += WIDTH)
+		{
+			m = vmax(m, vload(a + i));
+		}
+		float lanes[WIDTH];
+		vstore(lanes, m);
+		best = lanes[0];
+		for (int j = 1; j < WIDTH; j++)
+		{
+			best = lanes[j] > best ? lanes[j] : best;
+		}
+	}
+	for (; i < len; i++)
+	{
+		best = a[i] > best ? a[i] : best;
+	}
+	return best;
+}
+
+/**
+ * GEMM_MR x GEMM_NR tile of C (+)= packed A panel * packed B panel.
+ * A panel holds GEMM_MR values per depth step, B panel GEMM_NR values
+ * @param kc depth of the panels
+ * @param a packed A panel
+ * @param b packed B panel
+ * @param c tile start in C
+ * @param ldc distance between two rows of C
+ * @param mr valid rows of the tile
+ * @param nr valid cols of the tile
+ * @param accumulate add to C instead of overwriting it
+ */
+static void kernelGemmTile(int kc, const float *a, const float *b, float *c, int ldc, int mr, int nr,
+						   bool accumulate)
+{
+	const int NV = GEMM_NR / WIDTH;
+	Vec acc[GEMM_MR][NV];
+#pragma GCC unroll 8
+	for (int i = 0; i < GEMM_MR; i++)
+	{
+#pragma GCC unroll 4
+		for (int v = 0; v < NV; v++)
+		{
+			acc[i][v] = vset1(0);
+		}
+	}
+	for (int p = 0; p < kc; p++)
+	{
+		Vec bv[NV];
+#pragma GCC unroll 4
+		for (int v = 0; v < NV; v++)
+		{
+			bv[v] = vload(b + v * WIDTH);
+		}
+#pragma GCC unroll 8
+		for (int i = 0; i < GEMM_MR; i++)
+		{
+			Vec ai = vset1(a[i]);
+#pragma GCC unroll 4
+			for (int v = 0; v < NV; v++)
+			{
+				acc[i][v] = vfmadd(ai, bv[v], acc[i][v]);
+			}
+		}
+		a += GEMM_MR;
+		b += GEMM_NR;
+	}
+	if (mr == GEMM_MR && nr == GEMM_NR)
+	{
+		for (int i = 0; i < GEMM_MR; i++)
+		{
+			float *row = c + i * ldc;
+			for (int v = 0; v < NV; v++)
+			{
+				Vec out = accumulate ? vadd(vload(row + v * WIDTH), acc[i][v]) : acc[i][v];
+				vstore(row + v * WIDTH, out);
+			}
+		}
+		return;
+	}
+	// edge tile: spill and copy the valid part
+	float tile[GEMM_MR * GEMM_NR];
+	for (int i = 0; i < GEMM_MR; i++)
+	{
+		for (int v = 0; v < NV; v++)
+		{
+			vstore(tile + i * GEMM_NR + v * WIDTH, acc[i][v]);
+		}
+	}
+	for (int i = 0; i < mr; i++)
+	{
+		float *row = c + i * ldc;
+		for (int j = 0; j < nr; j++)
+		{
+			row[j] = accumulate ? row[j] + tile[i * GEMM_NR + j] : tile[i * GEMM_NR + j];
+		}
+	}
+}
+
+/**
+ * the epilogue of one dense output, see FusedEpilogue
+ */
+static inline float denseEpilogue(float z, int epilogue)
+{
+	if (epilogue == EpilogueRelu)
+	{
+		return 0 < z ? z : 0;
+	}
+	return z;
+}
+
+/**
+ * dot product of one row with x
+ */
+static inline float rowDot(const float *row, const float *x, int cols)
+{
+	Vec acc = vset1(0);
+	int p = 0;
+	for (; p + WIDTH <= cols; p += WIDTH)
+	{
+		acc = vfmadd(vload(row + p), vload(x + p), acc);
+	}
+	float s = vhsum(acc);
+	for (; p < cols; p++)
+	{
+		s += row[p] * x[p];
+	}
+	return s;
+}
+
+/**
+ * y = epilogue(W * x + bias), four rows of W at a time so every
+ * load of x feeds four accumulators. each output goes through the
+ * epilogue right after its dot product, while still in a register
+ * @return the sum of the written outputs
+ */
+static float kernelDenseRows(const float *w, int ldw, const float *x, const float *bias, float *y,
+							 int rows, int cols, int epilogue)
+{
+	float total = 0;
+	int i = 0;
+	for (; i + 4 <= rows; i += 4)
+	{
+		const float *w0 = w + i * ldw;
+		const float *w1 = w0 + ldw;
+		const float *w2 = w1 + ldw;
+		const float *w3 = w2 + ldw;
+		Vec a0 = vset1(0);
+		Vec a1 = vset1(0);
+		Vec a2 = vset1(0);
+		Vec a3 = vset1(0);
+		int p = 0;
+		for (; p + WIDTH <= cols; p += WIDTH)
+		{
+			Vec xv = vload(x + p);
+			a0 = vfmadd(vload(w0 + p), xv, a0);
+			a1 = vfmadd(vload(w1 + p), xv, a1);
+			a2 = vfmadd(vload(w2 + p), xv, a2);
+			a3 = vfmadd(vload(w3 + p), xv, a3);
+		}
+		float s[4] = {vhsum(a0), vhsum(a1), vhsum(a2), vhsum(a3)};
+		for (; p < cols; p++)
+		{
+			s[0] += w0[p] * x[p];
+			s[1] += w1[p] * x[p];
+			s[2] += w2[p] * x[p];
+			s[3] += w3[p] * x[p];
+		}
+		for (int r = 0; r < 4; r++)
+		{
+			y[i + r] = denseEpilogue(s[r] + (bias ? bias[i + r] : 0), epilogue);
+			total += y[i + r];
+		}
+	}
+	for (; i < rows; i++)
+	{
+		float s = rowDot(w + i * ldw, x, cols);
+		y[i] = denseEpilogue(s + (bias ? bias[i] : 0), epilogue);
+		total += y[i];
+	}
+	return total;
+}
+
+/**
+ * y = W * x for a CSR W, WIDTH values of a row per gather
+ */
+static void kernelCsrRows(const int *rowStart, const int *colIndex, const float *values, const float *x, float *y,
+						  int rows)
+{
+	for (int i = 0; i < rows; i++)
+	{
+		int k = rowStart[i];
+		int end = rowStart[i + 1];
+		Vec acc = vset1(0);
+		for (; k + WIDTH <= end; k += WIDTH)
+		{
+			acc = vfmadd(vload(values + k), vgather(x, colIndex + k), acc);
+		}
+		float s = vhsum(acc);
+		for (; k < end; k++)
+		{
+			s += values[k] * x[colIndex[k]];
+		}
+		y[i] = s;
+	}
+}
+
+/**
+ * y = W * x for a BSR W of 4x4 blocks. the 4 values of x a block
+ * reads are repeated across the lanes, so the 16 products of a block
+ * are 16 / WIDTH multiply-adds; each group of 4 lanes sums into
+ * one output row
+ */
+static void kernelBsrRows(const int *blockStart, const int *blockCol, const float *values, const float *x, float *y,
+						  int rows, int cols)
+{
+	const int BLOCK = 4;
+	const int NV = BLOCK * BLOCK / WIDTH;
+	int blockRows = (rows + BLOCK - 1) / BLOCK;
+	for (int bi = 0; bi < blockRows; bi++)
+	{
+		Vec acc[NV];
+		for (int v = 0; v < NV; v++)
+		{
+			acc[v] = vset1(0);
+		}
+		for (int k = blockStart[bi]; k < blockStart[bi + 1]; k++)
+		{
+			const float *block = values + (long) k * BLOCK * BLOCK;
+			int first = blockCol[k] * BLOCK;
+			Vec xv;
+			if (first + BLOCK <= cols)
+			{
+				xv = vload4(x + first);
+			}
+			else
+			{
+				// the zero padded edge block must not read past x
+				float edge[BLOCK] = {};
+				for (int c = first; c < cols; c++)
+				{
+					edge[c - first] = x[c];
+				}
+				xv = vload4(edge);
+			}
+			for (int v = 0; v < NV; v++)
+			{
+				acc[v] = vfmadd(vload(block + v * WIDTH), xv, acc[v]);
+			}
+		}
+		float lanes[BLOCK * BLOCK];
+		for (int v = 0; v < NV; v++)
+		{
+			vstore(lanes + v * WIDTH, acc[v]);
+		}
+		for (int r = 0; r < BLOCK && bi * BLOCK + r < rows; r++)
+		{
+			const float *l = lanes + r * BLOCK;
+			y[bi * BLOCK + r] = (l[0] + l[1]) + (l[2] + l[3]);
+		}
+	}
+}
+
+/**
+ * NV vectors of cols of one block row of Y = W * X for a BSR W:
+ * the 4 x NV sums stay in registers over every block of the row, and
+ * each block adds its 16 weights (broadcast) times 4 rows of X
+ */
+template<int NV>
+static inline void bsrBatchStrip(const int *blockCol, const float *values, int first, int last, const float *x,
+								 int ldx, float *y, int ldy, int rows, int cols)
+{
+	const int BLOCK = 4;
+	Vec acc[BLOCK][NV];
+	for (int r = 0; r < BLOCK; r++)
+	{
+		for (int v = 0; v < NV; v++)
+		{
+			acc[r][v] = vset1(0);
+		}
+	}
+	for (int k = first; k < last; k++)
+	{
+		const float *block = values + (long) k * BLOCK * BLOCK;
+		int col = blockCol[k] * BLOCK;
+		// the zero padded edge block must not read past X
+		int valid = cols - col < BLOCK ? cols - col : BLOCK;
+		for (int c = 0; c < valid; c++)
+		{
+			const float *xRow = x + (long) (col + c) * ldx;
+			Vec xv[NV];
+			for (int v = 0; v < NV; v++)
+			{
+				xv[v] = vload(xRow + v * WIDTH);
+			}
+			for (int r = 0; r < BLOCK; r++)
+			{
+				Vec w = vset1(block[r * BLOCK + c]);
+				for (int v = 0; v < NV; v++)
+				{
+					acc[r][v] = vfmadd(w, xv[v], acc[r][v]);
+				}
+			}
+		}
+	}
+	for (int r = 0; r < rows; r++)
+	{
+		for (int v = 0; v < NV; v++)
+		{
+			vstore(y + (long) r * ldy + v * WIDTH, acc[r][v]);
+		}
+	}
+}
+
+/**
+ * Y = W * X for a BSR W of 4x4 blocks and a row-major X of n cols,
+ * by strips of 2 vectors of cols (see bsrBatchStrip)
+ */
+static void kernelBsrBatch(const int *blockStart, const int *blockCol, const float *values, const float *x, int ldx,
+						   float *y, int ldy, int rows, int cols, int n)
+{
+	const int BLOCK = 4;
+	int blockRows = (rows + BLOCK - 1) / BLOCK;
+	for (int bi = 0; bi < blockRows; bi++)
+	{
+		int first = blockStart[bi];
+		int last = blockStart[bi + 1];
+		int outRows = rows - bi * BLOCK < BLOCK ? rows - bi * BLOCK : BLOCK;
+		float *yBlock = y + (long) bi * BLOCK * ldy;
+		int j = 0;
+		for (; j + 2 * WIDTH <= n; j += 2 * WIDTH)
+		{
+			bsrBatchStrip<2>(blockCol, values, first, last, x + j, ldx, yBlock + j, ldy, outRows, cols);
+		}
+		for (; j + WIDTH <= n; j += WIDTH)
+		{
+			bsrBatchStrip<1>(blockCol, values, first, last, x + j, ldx, yBlock + j, ldy, outRows, cols);
+		}
+		for (; j < n; j++)
+		{
+			for (int r = 0; r < outRows; r++)
+			{
+				float sum = 0;
+				for (int k = first; k < last; k++)
+				{
+					const float *block = values + (long) k * BLOCK * BLOCK + r * BLOCK;
+					int col = blockCol[k] * BLOCK;
+					for (int c = 0; c < BLOCK && col + c < cols; c++)
+					{
+						sum += block[c] * x[(long) (col + c) * ldx + j];
+					}
+				}
+				yBlock[(long) r * ldy + j] = sum;
+			}
+		}
+	}
+}
+
+/**
+ * WIDTH 16 bit floats of HalfType TYPE widened to float
+ */
+template<int TYPE>
+static inline Vec vloadHalf(const uint16_t *p)
+{
+	return TYPE == HalfBf16 ? vloadBf16(p) : vloadFp16(p);
+}
+
+/**
+ * the last len < WIDTH 16 bit floats of a row, zero padded
+ */
+template<int TYPE>
+static inline Vec vloadHalfTail(const uint16_t *p, int len)
+{
+	uint16_t padded[WIDTH] = {};
+	for (int i = 0; i < len; i++)
+	{
+		padded[i] = p[i];
+	}
+	return vloadHalf<TYPE>(padded);
+}
+
+/**
+ * y = W * x on 16 bit weights of HalfType TYPE, four rows at a time
+ */
+template<int TYPE>
+static void halfRowsOf(const uint16_t *w, int ldw, const float *x, float *y, int rows, int cols)
+{
+	int tail = cols % WIDTH;
+	int body = cols - tail;
+	float xTail[WIDTH] = {};
+	for (int p = 0; p < tail; p++)
+	{
+		xTail[p] = x[body + p];
+	}
+	int i = 0;
+	for (; i + 4 <= rows; i += 4)
+	{
+		const uint16_t *w0 = w + (long) i * ldw;
+		const uint16_t *w1 = w0 + ldw;
+		const uint16_t *w2 = w1 + ldw;
+		const uint16_t *w3 = w2 + ldw;
+		Vec a0 = vset1(0);
+		Vec a1 = vset1(0);
+		Vec a2 = vset1(0);
+		Vec a3 = vset1(0);
+		for (int p = 0; p < body; p += WIDTH)
+		{
+			Vec xv = vload(x + p);
+			a0 = vfmadd(vloadHalf<TYPE>(w0 + p), xv, a0);
+			a1 = vfmadd(vloadHalf<TYPE>(w1 + p), xv, a1);
+			a2 = vfmadd(vloadHalf<TYPE>(w2 + p), xv, a2);
+			a3 = vfmadd(vloadHalf<TYPE>(w3 + p), xv, a3);
+		}
+		if (tail)
+		{
+			Vec xv = vload(xTail);
+			a0 = vfmadd(vloadHalfTail<TYPE>(w0 + body, tail), xv, a0);
+			a1 = vfmadd(vloadHalfTail<TYPE>(w1 + body, tail), xv, a1);
+			a2 = vfmadd(vloadHalfTail<TYPE>(w2 + body, tail), xv, a2);
+			a3 = vfmadd(vloadHalfTail<TYPE>(w3 + body, tail), xv, a3);
+		}
+		y[i] = vhsum(a0);
+		y[i + 1] = vhsum(a1);
+		y[i + 2] = vhsum(a2);
+		y[i + 3] = vhsum(a3);
+	}
+	for (; i < rows; i++)
+	{
+		const uint16_t *row = w + (long) i * ldw;
+		Vec acc = vset1(0);
+		for (int p = 0; p < body; p += WIDTH)
+		{
+			acc = vfmadd(vloadHalf<TYPE>(row + p), vload(x + p), acc);
+		}
+		if (tail)
+		{
+			acc = vfmadd(vloadHalfTail<TYPE>(row + body, tail), vload(xTail), acc);
+		}
+		y[i] = vhsum(acc);
+	}
+}
+
+/**
+ * y = W * x on 16 bit weights of HalfType type
+ */
+static void kernelHalfRows(const uint16_t *w, int ldw, int type, const float *x, float *y, int rows, int cols)
+{
+	if (type == HalfBf16)
+	{
+		halfRowsOf<HalfBf16>(w, ldw, x, y, rows, cols);
+	}
+	else
+	{
+		halfRowsOf<HalfFp16>(w, ldw, x, y, rows, cols);
+	}
+}
+
+/**
+ * out = in widened from 16 bit floats of HalfType TYPE
+ */
+template<int TYPE>
+static void halfToFloatOf(const uint16_t *in, float *out, int len)
+{
+	int i = 0;
+	for (; i + WIDTH <= len; i += WIDTH)
+	{
+		vstore(out + i, vloadHalf<TYPE>(in + i));
+	}
+	if (i < len)
+	{
+		float padded[WIDTH];
+		vstore(padded, vloadHalfTail<TYPE>(in + i, len - i));
+		for (int p = 0; i + p < len; p++)
+		{
+			out[i + p] = padded[p];
+		}
+	}
+}
+
+/**
+ * out = in widened from 16 bit floats of HalfType type
+ */
+static void kernelHalfToFloat(const uint16_t *in, int type, float *out, int len)
+{
+	if (type == HalfBf16)
+	{
+		halfToFloatOf<HalfBf16>(in, out, len);
+	}
+	else
+	{
+		halfToFloatOf<HalfFp16>(in, out, len);
+	}
+}
+
+/**
+ * out = in * scale for unsigned bytes
+ */
+static void kernelBytesToFloat(const uint8_t *in, float scale, float *out, int len)
+{
+	Vec s = vset1(scale);
+	int i = 0;
+	for (; i + WIDTH <= len; i += WIDTH)
+	{
+		vstore(out + i, vmul(vloadBytes(in + i), s));
+	}
+	for (; i < len; i++)
+	{
+		out[i] = (float) in[i] * scale;
+	}
+}
+
+/**
+ * acc = W * x on int8 values with exact int32 sums.
+ * cols must be a multiple of 64 (quantized rows are zero padded).
+ * like kernelDenseRows, four rows share each widened load of x.
+ * the sums are exact, so rowSums (used by vnni) is not needed here
+ */
+static void kernelInt8Rows(const int8_t *w, int ldw, const int8_t *x, const int32_t *rowSums, int32_t *acc,
+						   int rows, int cols)
+{
+	(void) rowSums;
+	int i = 0;
+	for (; i + 4 <= rows; i += 4)
+	{
+		const int8_t *w0 = w + i * ldw;
+		const int8_t *w1 = w0 + ldw;
+		const int8_t *w2 = w1 + ldw;
+		const int8_t *w3 = w2 + ldw;
+		IVec a0 = ivzero();
+		IVec a1 = ivzero();
+		IVec a2 = ivzero();
+		IVec a3 = ivzero();
+		for (int p = 0; p < cols; p += I8_STEP)
+		{
+			IWide xv = ivwiden(x + p);
+			a0 = ivdot(a0, ivwiden(w0 + p), xv);
+			a1 = ivdot(a1, ivwiden(w1 + p), xv);
+			a2 = ivdot(a2, ivwiden(w2 + p), xv);
+			a3 = ivdot(a3, ivwiden(w3 + p), xv);
+		}
+		acc[i] = ivhsum(a0);
+		acc[i + 1] = ivhsum(a1);
+		acc[i + 2] = ivhsum(a2);
+		acc[i + 3] = ivhsum(a3);
+	}
+	for (; i < rows; i++)
+	{
+		const int8_t *row = w + i * ldw;
+		IVec sum = ivzero();
+		for (int p = 0; p < cols; p += I8_STEP)
+		{
+			sum = ivdot(sum, ivwiden(row + p), ivwiden(x + p));
+		}
+		acc[i] = ivhsum(sum);
+	}
+}
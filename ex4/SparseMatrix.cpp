@@ -0,0 +1,296 @@
+// SparseMatrix.cpp
+
+#include "SparseMatrix.h"
+#include "Simd.h"
+#include <algorithm>
+
+#define SPARSE_SHAPE_ERR_MSG "Error: the shapes of the sparse product do not match"
+
+using std::cerr;
+using std::endl;
+
+/**
+ * exits unless x can be multiplied by a rows x cols matrix
+ * @param cols cols of the sparse matrix
+ * @param x the dense operand
+ */
+static void checkOperand(int cols, const Matrix &x)
+{
+	if (x.getRows() != cols)
+	{
+		cerr << SPARSE_SHAPE_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * size a product buffer, keeping it when it has the shape already
+ * @param rows rows of the product
+ * @param cols cols of the product
+ * @param out the buffer
+ */
+static void shapeOutput(int rows, int cols, Matrix &out)
+{
+	if (out.getRows() != rows || out.getCols() != cols)
+	{
+		out = Matrix(rows, cols, MatrixUninitialized);
+	}
+}
+
+/**
+ *
+ * @param matrix
+ * @return
+ */
+float weightDensity(const Matrix &matrix)
+{
+	long len = (long) matrix.getRows() * matrix.getCols();
+	const float *values = matrix.data();
+	long nonZeros = 0;
+	for (long i = 0; i < len; i++)
+	{
+		nonZeros += values[i] != 0;
+	}
+	return (float) nonZeros / (float) len;
+}
+
+/**
+ *
+ * @param matrix
+ * @return
+ */
+float blockFill(const Matrix &matrix)
+{
+	int rows = matrix.getRows();
+	int cols = matrix.getCols();
+	const float *values = matrix.data();
+	long nonZeros = 0;
+	long blocks = 0;
+	for (int bi = 0; bi < rows; bi += BSR_BLOCK)
+	{
+		for (int bj = 0; bj < cols; bj += BSR_BLOCK)
+		{
+			int inBlock = 0;
+			for (int i = bi; i < std::min(bi + BSR_BLOCK, rows); i++)
+			{
+				for (int j = bj; j < std::min(bj + BSR_BLOCK, cols); j++)
+				{
+					inBlock += values[(long) i * cols + j] != 0;
+				}
+			}
+			nonZeros += inBlock;
+			blocks += inBlock != 0;
+		}
+	}
+	return blocks == 0 ? 1 : (float) nonZeros / (float) (blocks * BSR_BLOCK * BSR_BLOCK);
+}
+
+// _____________________________ CsrMatrix _____________________________
+
+/**
+ *
+ */
+CsrMatrix::CsrMatrix() : _rows(0), _cols(0), _rowStart(1, 0)
+{}
+
+/**
+ *
+ * @param matrix
+ */
+CsrMatrix::CsrMatrix(const Matrix &matrix) : _rows(matrix.getRows()), _cols(matrix.getCols()), _rowStart(_rows + 1)
+{
+	const float *values = matrix.data();
+	for (int i = 0; i < _rows; i++)
+	{
+		_rowStart[i] = (int) _values.size();
+		for (int j = 0; j < _cols; j++)
+		{
+			float v = values[(long) i * _cols + j];
+			if (v != 0)
+			{
+				_colIndex.push_back(j);
+				_values.push_back(v);
+			}
+		}
+	}
+	_rowStart[_rows] = (int) _values.size();
+}
+
+int CsrMatrix::getRows() const
+{
+	return _rows;
+}
+
+int CsrMatrix::getCols() const
+{
+	return _cols;
+}
+
+/**
+ *
+ * @return
+ */
+int CsrMatrix::getNonZeros() const
+{
+	return (int) _values.size();
+}
+
+/**
+ *
+ * @return
+ */
+size_t CsrMatrix::bytes() const
+{
+	return _values.size() * sizeof(float) + (_colIndex.size() + _rowStart.size()) * sizeof(int);
+}
+
+/**
+ *
+ * @param x
+ * @param y
+ */
+void CsrMatrix::multiply(const float *x, float *y) const
+{
+	simd().csrRows(_rowStart.data(), _colIndex.data(), _values.data(), x, y, _rows);
+}
+
+/**
+ *
+ * @param x
+ * @return
+ */
+Matrix CsrMatrix::multiply(const Matrix &x) const
+{
+	Matrix out(_rows, x.getCols(), MatrixUninitialized);
+	multiply(x, out);
+	return out;
+}
+
+/**
+ *
+ * @param x
+ * @param out
+ */
+void CsrMatrix::multiply(const Matrix &x, Matrix &out) const
+{
+	checkOperand(_cols, x);
+	int n = x.getCols();
+	shapeOutput(_rows, n, out);
+	const SimdKernels &kernels = simd();
+	for (int i = 0; i < _rows; i++)
+	{
+		float *row = out.data() + (long) i * n;
+		std::fill(row, row + n, 0.0f);
+		for (int k = _rowStart[i]; k < _rowStart[i + 1]; k++)
+		{
+			kernels.axpy(_values[k], x.data() + (long) _colIndex[k] * n, row, n);
+		}
+	}
+}
+
+// _____________________________ BsrMatrix _____________________________
+
+/**
+ *
+ */
+BsrMatrix::BsrMatrix() : _rows(0), _cols(0), _blockStart(1, 0)
+{}
+
+/**
+ *
+ * @param matrix
+ */
+BsrMatrix::BsrMatrix(const Matrix &matrix) : _rows(matrix.getRows()), _cols(matrix.getCols())
+{
+	const float *values = matrix.data();
+	int blockRows = (_rows + BSR_BLOCK - 1) / BSR_BLOCK;
+	_blockStart.resize(blockRows + 1);
+	for (int bi = 0; bi < blockRows; bi++)
+	{
+		_blockStart[bi] = (int) _blockCol.size();
+		for (int bj = 0; bj * BSR_BLOCK < _cols; bj++)
+		{
+			float block[BSR_BLOCK * BSR_BLOCK] = {};
+			bool empty = true;
+			for (int r = 0; r < BSR_BLOCK && bi * BSR_BLOCK + r < _rows; r++)
+			{
+				for (int c = 0; c < BSR_BLOCK && bj * BSR_BLOCK + c < _cols; c++)
+				{
+					block[r * BSR_BLOCK + c] = values[(long) (bi * BSR_BLOCK + r) * _cols + bj * BSR_BLOCK + c];
+					empty = empty && block[r * BSR_BLOCK + c] == 0;
+				}
+			}
+			if (!empty)
+			{
+				_blockCol.push_back(bj);
+				_values.insert(_values.end(), block, block + BSR_BLOCK * BSR_BLOCK);
+			}
+		}
+	}
+	_blockStart[blockRows] = (int) _blockCol.size();
+}
+
+int BsrMatrix::getRows() const
+{
+	return _rows;
+}
+
+int BsrMatrix::getCols() const
+{
+	return _cols;
+}
+
+/**
+ *
+ * @return
+ */
+int BsrMatrix::getBlocks() const
+{
+	return (int) _blockCol.size();
+}
+
+/**
+ *
+ * @return
+ */
+size_t BsrMatrix::bytes() const
+{
+	return _values.size() * sizeof(float) + (_blockCol.size() + _blockStart.size()) * sizeof(int);
+}
+
+/**
+ *
+ * @param x
+ * @param y
+ */
+void BsrMatrix::multiply(const float *x, float *y) const
+{
+	static_assert(BSR_BLOCK == 4, "SimdKernels::bsrRows works on 4x4 blocks");
+	simd().bsrRows(_blockStart.data(), _blockCol.data(), _values.data(), x, y, _rows, _cols);
+}
+
+/**
+ *
+ * @param x
+ * @return
+ */
+Matrix BsrMatrix::multiply(const Matrix &x) const
+{
+	Matrix out(_rows, x.getCols(), MatrixUninitialized);
+	multiply(x, out);
+	return out;
+}
+
+/**
+ *
+ * @param x
+ * @param out
+ */
+void BsrMatrix::multiply(const Matrix &x, Matrix &out) const
+{
+	checkOperand(_cols, x);
+	int n = x.getCols();
+	shapeOutput(_rows, n, out);
+	simd().bsrBatch(_blockStart.data(), _blockCol.data(), _values.data(), x.data(), n, out.data(), n, _rows, _cols,
+					n);
+}
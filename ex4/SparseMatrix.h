@@ -0,0 +1,166 @@
+// SparseMatrix.h
+
+#ifndef SPARSEMATRIX_H
+#define SPARSEMATRIX_H
+
+#include "Matrix.h"
+#include <cstddef>
+#include <vector>
+
+/**
+ * side of the square blocks of BsrMatrix
+ */
+#define BSR_BLOCK 4
+
+/**
+ * fraction of the values of a matrix that are not zero
+ * @param matrix the matrix
+ * @return the density, in [0, 1]
+ */
+float weightDensity(const Matrix &matrix);
+
+/**
+ * fraction of the values inside the non-zero BSR_BLOCK x BSR_BLOCK
+ * blocks of a matrix that are not zero: how much of its work a
+ * BsrMatrix of it would spend on real values
+ * @param matrix the matrix
+ * @return the fill, in [0, 1] (1 for an all zero matrix)
+ */
+float blockFill(const Matrix &matrix);
+
+/**
+ * a sparse matrix in compressed sparse row form: the non-zero
+ * values of each row, one after the other, with their columns.
+ * works for any pattern of zeros, every value is one gather of x
+ */
+class CsrMatrix
+{
+private:
+	int _rows, _cols;
+	// the values of row i are [_rowStart[i], _rowStart[i + 1])
+	std::vector<int> _rowStart;
+	std::vector<int> _colIndex;
+	std::vector<float> _values;
+public:
+	/**
+	 * empty (0x0) constructor
+	 */
+	CsrMatrix();
+
+	/**
+	 * compress a dense matrix, keeping its values that are not 0
+	 * @param matrix the matrix
+	 */
+	explicit CsrMatrix(const Matrix &matrix);
+
+	int getRows() const;
+
+	int getCols() const;
+
+	/**
+	 * number of stored values
+	 * @return the non-zeros
+	 */
+	int getNonZeros() const;
+
+	/**
+	 * memory the matrix takes
+	 * @return bytes of the values and indices
+	 */
+	size_t bytes() const;
+
+	/**
+	 * y = W * x (SpMV)
+	 * @param x getCols() values
+	 * @param y getRows() values, overwritten
+	 */
+	void multiply(const float *x, float *y) const;
+
+	/**
+	 * W * X for a dense X (SpMM): each stored value adds a
+	 * multiple of one row of X to one row of the product
+	 * @param x getCols() x n matrix
+	 * @return getRows() x n product
+	 */
+	Matrix multiply(const Matrix &x) const;
+
+	/**
+	 * W * X into a buffer kept by the caller, reallocated only
+	 * if it is not getRows() x n already
+	 * @param x getCols() x n matrix
+	 * @param out the product, overwritten
+	 */
+	void multiply(const Matrix &x, Matrix &out) const;
+};
+
+/**
+ * a sparse matrix of BSR_BLOCK x BSR_BLOCK blocks (block sparse row):
+ * the blocks that are not all zero, stored densely with their block
+ * column. one index per block instead of per value, and the inner
+ * loops have constant bounds, so it beats CsrMatrix when pruning
+ * left whole blocks (or most of them) in place.
+ * the edge blocks of dims that are not multiples of BSR_BLOCK are
+ * zero padded
+ */
+class BsrMatrix
+{
+private:
+	int _rows, _cols;
+	// the blocks of block row i are [_blockStart[i], _blockStart[i + 1])
+	std::vector<int> _blockStart;
+	std::vector<int> _blockCol;
+	// BSR_BLOCK * BSR_BLOCK row-major values per block
+	std::vector<float> _values;
+public:
+	/**
+	 * empty (0x0) constructor
+	 */
+	BsrMatrix();
+
+	/**
+	 * compress a dense matrix, keeping its blocks that are not all 0
+	 * @param matrix the matrix
+	 */
+	explicit BsrMatrix(const Matrix &matrix);
+
+	int getRows() const;
+
+	int getCols() const;
+
+	/**
+	 * number of stored blocks
+	 * @return the blocks
+	 */
+	int getBlocks() const;
+
+	/**
+	 * memory the matrix takes
+	 * @return bytes of the values and indices
+	 */
+	size_t bytes() const;
+
+	/**
+	 * y = W * x (SpMV)
+	 * @param x getCols() values
+	 * @param y getRows() values, overwritten
+	 */
+	void multiply(const float *x, float *y) const;
+
+	/**
+	 * W * X for a dense X (SpMM), on the bsrBatch simd kernel: the
+	 * sums of a block row stay in registers while its blocks pass
+	 * @param x getCols() x n matrix
+	 * @return getRows() x n product
+	 */
+	Matrix multiply(const Matrix &x) const;
+
+	/**
+	 * W * X into a buffer kept by the caller, reallocated only
+	 * if it is not getRows() x n already
+	 * @param x getCols() x n matrix
+	 * @param out the product, overwritten
+	 */
+	void multiply(const Matrix &x, Matrix &out) const;
+};
+
+#endif //SPARSEMATRIX_H
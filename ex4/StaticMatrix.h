@@ -0,0 +1,155 @@
+// StaticMatrix.h
+
+#ifndef STATICMATRIX_H
+#define STATICMATRIX_H
+
+#include "Matrix.h"
+#include <algorithm>
+
+#define STATIC_SHAPE_ERR_MSG "Error: the matrix does not have the static shape"
+
+/**
+ * a matrix whose shape is part of its type. the values live inline
+ * (no heap, no dims to read at run time), every loop bound is a
+ * compile time constant, and operations on mismatched shapes do
+ * not compile. meant for the fixed MLP topology; big ones belong in
+ * static or heap storage, not on the stack
+ * @tparam R row dim
+ * @tparam C col dim
+ */
+template<int R, int C>
+class StaticMatrix
+{
+	static_assert(R > 0 && C > 0, "a StaticMatrix needs positive dims");
+private:
+	alignas(POOL_ALIGN) float _values[R * C];
+public:
+	static constexpr int rows = R;
+	static constexpr int cols = C;
+
+	/**
+	 * zeros constructor
+	 */
+	StaticMatrix() : _values()
+	{}
+
+	/**
+	 * from Matrix constructor, exits if the shape is not R x C
+	 * (an R * C vector in any shape is taken as well)
+	 * @param matrix the matrix to copy
+	 */
+	explicit StaticMatrix(const Matrix &matrix) : _values()
+	{
+		if (matrix.getRows() * matrix.getCols() != R * C || (matrix.getRows() != R && C != 1))
+		{
+			std::cerr << STATIC_SHAPE_ERR_MSG << std::endl;
+			exit(EXIT_FAILURE);
+		}
+		std::copy(matrix.data(), matrix.data() + R * C, _values);
+	}
+
+	constexpr int getRows() const
+	{
+		return R;
+	}
+
+	constexpr int getCols() const
+	{
+		return C;
+	}
+
+	float *data()
+	{
+		return _values;
+	}
+
+	const float *data() const
+	{
+		return _values;
+	}
+
+	/**
+	 * unchecked value, the shape is known
+	 * @param row row idx
+	 * @param col col idx
+	 * @return the value by ref
+	 */
+	float &operator()(int row, int col)
+	{
+		return _values[row * C + col];
+	}
+
+	float operator()(int row, int col) const
+	{
+		return _values[row * C + col];
+	}
+
+	float &operator[](int idx)
+	{
+		return _values[idx];
+	}
+
+	float operator[](int idx) const
+	{
+		return _values[idx];
+	}
+
+	/**
+	 * copy to a dynamic Matrix
+	 * @return the matrix
+	 */
+	Matrix toMatrix() const
+	{
+		Matrix matrix(R, C, MatrixUninitialized);
+		std::copy(_values, _values + R * C, matrix.data());
+		return matrix;
+	}
+};
+
+/**
+ * matrix addition, only of the same shape
+ * @param lhs left matrix
+ * @param rhs right matrix
+ * @return the sum
+ */
+template<int R, int C>
+StaticMatrix<R, C> operator+(const StaticMatrix<R, C> &lhs, const StaticMatrix<R, C> &rhs)
+{
+	StaticMatrix<R, C> out;
+	for (int i = 0; i < R * C; i++)
+	{
+		out[i] = lhs[i] + rhs[i];
+	}
+	return out;
+}
+
+/**
+ * right hand by scalar multiplication
+ * @param matrix the matrix to multiply
+ * @param scalar the scalar to multiply with
+ * @return the product
+ */
+template<int R, int C>
+StaticMatrix<R, C> operator*(const StaticMatrix<R, C> &matrix, float scalar)
+{
+	StaticMatrix<R, C> out;
+	for (int i = 0; i < R * C; i++)
+	{
+		out[i] = matrix[i] * scalar;
+	}
+	return out;
+}
+
+/**
+ * left hand by scalar multiplication
+ * @param scalar the scalar to multiply with
+ * @param matrix the matrix to multiply
+ * @return the product
+ */
+template<int R, int C>
+StaticMatrix<R, C> operator*(float scalar, const StaticMatrix<R, C> &matrix)
+{
+	return matrix * scalar;
+}
+
+#endif //STATICMATRIX_H
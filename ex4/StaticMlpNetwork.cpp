@@ -0,0 +1,54 @@
+// StaticMlpNetwork.cpp
+
+#include "StaticMlpNetwork.h"
+
+/**
+ * exit unless the layers have the shapes of weightsDims and biasDims
+ * @param weights the weights of the layers
+ * @param biases the biases of the layers
+ * @return weights
+ */
+static Matrix *checkShapes(Matrix weights[], Matrix biases[])
+{
+	for (int l = 0; l < MLP_SIZE; l++)
+	{
+		if (weights[l].getRows() != weightsDims[l].rows || weights[l].getCols() != weightsDims[l].cols ||
+			biases[l].getRows() != biasDims[l].rows || biases[l].getCols() != biasDims[l].cols)
+		{
+			std::cerr << STATIC_SHAPE_ERR_MSG << std::endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+	return weights;
+}
+
+/**
+ *
+ * @param weights
+ * @param biases
+ */
+StaticMlpNetwork::StaticMlpNetwork(Matrix weights[], Matrix biases[]) :
+		_network(checkShapes(weights, biases), biases)
+{}
+
+/**
+ *
+ * @param img
+ * @return
+ */
+Digit StaticMlpNetwork::operator()(const Image &img) const
+{
+	// a view of the image, which the network only reads
+	Matrix vec = Matrix::borrow(const_cast<float *>(img.data()), img.getRows(), img.getCols());
+	return _network(vec);
+}
+
+/**
+ *
+ * @param img
+ * @return
+ */
+Digit StaticMlpNetwork::operator()(const Matrix &img) const
+{
+	return (*this)(Image(img));
+}
@@ -0,0 +1,56 @@
+// StaticMlpNetwork.h
+
+#ifndef STATICMLPNETWORK_H
+#define STATICMLPNETWORK_H
+
+#include "StaticMatrix.h"
+#include "MlpNetwork.h"
+
+// the layers must chain: each takes the outputs of the one before
+static_assert(MLP_SIZE == 4, "StaticMlpNetwork spells out four layers");
+static_assert(weightsDims[0].cols == imgDims.rows * imgDims.cols, "the first layer must take an image");
+static_assert(weightsDims[1].cols == weightsDims[0].rows && weightsDims[2].cols == weightsDims[1].rows &&
+			  weightsDims[3].cols == weightsDims[2].rows, "the layers of weightsDims do not chain");
+static_assert(biasDims[0].rows == weightsDims[0].rows && biasDims[1].rows == weightsDims[1].rows &&
+			  biasDims[2].rows == weightsDims[2].rows && biasDims[3].rows == weightsDims[3].rows,
+			  "the biases of biasDims do not fit the layers");
+
+/**
+ * the MLP of weightsDims with its shapes checked at compile time: the
+ * layers must chain and take an image, and an image is a vector of the
+ * input size by its type. the layers are checked against weightsDims
+ * once, at construction. the forward pass is MlpNetwork's, run on the
+ * Image in place, so it is as fast as MlpNetwork and no faster
+ */
+class StaticMlpNetwork
+{
+public:
+	typedef StaticMatrix<imgDims.rows * imgDims.cols, 1> Image;
+private:
+	MlpNetwork _network;
+public:
+	/**
+	 * constructor, exits unless the matrices have the
+	 * weightsDims and biasDims shapes
+	 * @param weights the weights of the layers
+	 * @param biases the biases of the layers
+	 */
+	StaticMlpNetwork(Matrix weights[], Matrix biases[]);
+
+	/**
+	 * apply the NN on an image
+	 * @param img the image
+	 * @return the digit
+	 */
+	Digit operator()(const Image &img) const;
+
+	/**
+	 * apply the NN on an image of 784 values in any shape,
+	 * exits on a wrong size
+	 * @param img the image
+	 * @return the digit
+	 */
+	Digit operator()(const Matrix &img) const;
+};
+
+#endif //STATICMLPNETWORK_H
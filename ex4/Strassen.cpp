@@ -0,0 +1,228 @@
+// Strassen.cpp
+
+#include "Strassen.h"
+#include "Gemm.h"
+#include "Simd.h"
+#include "BufferPool.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+// no smaller cutoff: the additions would cost more than the products save
+#define STRASSEN_MIN_CUTOFF 16
+
+static int cutoffDim = STRASSEN_CUTOFF;
+static int thresholdDim = STRASSEN_THRESHOLD;
+
+/**
+ * C = A + sign * B on strided rows x cols blocks, C may be A or B
+ * @param rows rows of the blocks
+ * @param cols cols of the blocks
+ * @param a the A block
+ * @param lda distance between two rows of A
+ * @param b the B block
+ * @param ldb distance between two rows of B
+ * @param sign 1 or -1
+ * @param c the C block
+ * @param ldc distance between two rows of C
+ */
+static void addBlocks(int rows, int cols, const float *a, int lda, const float *b, int ldb, float sign, float *c,
+					  int ldc)
+{
+	for (int i = 0; i < rows; i++, a += lda, b += ldb, c += ldc)
+	{
+		for (int j = 0; j < cols; j++)
+		{
+			c[j] = a[j] + sign * b[j];
+		}
+	}
+}
+
+/**
+ * whether a product is a leaf of the recursion
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param k cols of A and rows of B
+ * @return true if gemm takes it
+ */
+static bool isLeaf(int m, int n, int k)
+{
+	return std::min(m, std::min(n, k)) <= cutoffDim;
+}
+
+/**
+ *
+ * @param m
+ * @param n
+ * @param k
+ * @return
+ */
+long strassenWorkspace(int m, int n, int k)
+{
+	long floats = 0;
+	while (!isLeaf(m, n, k))
+	{
+		m /= 2;
+		n /= 2;
+		k /= 2;
+		floats += (long) m * k + (long) k * n + (long) m * n;
+	}
+	return floats;
+}
+
+/**
+ * one level of strassen, see there. the schedule of Douglas et al.
+ * (GEMMW): the quadrants of C hold four of the seven products until
+ * they are combined, so a level needs only three temporaries,
+ * X (an A quadrant), Y (a B quadrant) and Z (a C quadrant), taken
+ * from the front of the workspace; the levels below use the rest
+ * @param work the workspace, strassenWorkspace(m, n, k) floats
+ */
+static void strassenLevel(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc,
+						  float *work)
+{
+	if (isLeaf(m, n, k))
+	{
+		gemm(m, n, k, a, lda, b, ldb, c, ldc);
+		return;
+	}
+	int mh = m / 2;
+	int nh = n / 2;
+	int kh = k / 2;
+	const float *a11 = a, *a12 = a + kh, *a21 = a + (long) mh * lda, *a22 = a21 + kh;
+	const float *b11 = b, *b12 = b + nh, *b21 = b + (long) kh * ldb, *b22 = b21 + nh;
+	float *c11 = c, *c12 = c + nh, *c21 = c + (long) mh * ldc, *c22 = c21 + nh;
+	float *x = work;
+	float *y = x + (long) mh * kh;
+	float *z = y + (long) kh * nh;
+	float *rest = z + (long) mh * nh;
+
+	// S3 = A11 - A21, T3 = B22 - B12, P7 = S3 T3
+	addBlocks(mh, kh, a11, lda, a21, lda, -1, x, kh);
+	addBlocks(kh, nh, b22, ldb, b12, ldb, -1, y, nh);
+	strassenLevel(mh, nh, kh, x, kh, y, nh, c21, ldc, rest);
+	// S1 = A21 + A22, T1 = B12 - B11, P5 = S1 T1
+	addBlocks(mh, kh, a21, lda, a22, lda, 1, x, kh);
+	addBlocks(kh, nh, b12, ldb, b11, ldb, -1, y, nh);
+	strassenLevel(mh, nh, kh, x, kh, y, nh, c22, ldc, rest);
+	// S2 = S1 - A11, T2 = B22 - T1, P6 = S2 T2
+	addBlocks(mh, kh, x, kh, a11, lda, -1, x, kh);
+	addBlocks(kh, nh, b22, ldb, y, nh, -1, y, nh);
+	strassenLevel(mh, nh, kh, x, kh, y, nh, c12, ldc, rest);
+	// S4 = A12 - S2, P3 = S4 B22
+	addBlocks(mh, kh, a12, lda, x, kh, -1, x, kh);
+	strassenLevel(mh, nh, kh, x, kh, b22, ldb, c11, ldc, rest);
+	// P1 = A11 B11
+	strassenLevel(mh, nh, kh, a11, lda, b11, ldb, z, nh, rest);
+	// U2 = P1 + P6, U3 = U2 + P7, U4 = U2 + P5, U7 = U3 + P5 = C22, U5 = U4 + P3 = C12
+	addBlocks(mh, nh, z, nh, c12, ldc, 1, c12, ldc);
+	addBlocks(mh, nh, c12, ldc, c21, ldc, 1, c21, ldc);
+	addBlocks(mh, nh, c12, ldc, c22, ldc, 1, c12, ldc);
+	addBlocks(mh, nh, c21, ldc, c22, ldc, 1, c22, ldc);
+	addBlocks(mh, nh, c12, ldc, c11, ldc, 1, c12, ldc);
+	// T4 = T2 - B21, P4 = A22 T4, U6 = U3 - P4 = C21
+	addBlocks(kh, nh, y, nh, b21, ldb, -1, y, nh);
+	strassenLevel(mh, nh, kh, a22, lda, y, nh, c11, ldc, rest);
+	addBlocks(mh, nh, c21, ldc, c11, ldc, -1, c21, ldc);
+	// P2 = A12 B21, U1 = P1 + P2 = C11
+	strassenLevel(mh, nh, kh, a12, lda, b21, ldb, c11, ldc, rest);
+	addBlocks(mh, nh, z, nh, c11, ldc, 1, c11, ldc);
+
+	// the peeled odd row, col and rank-1 term
+	const SimdKernels &kernels = simd();
+	if (k % 2 != 0)
+	{
+		const float *bLast = b + (long) (k - 1) * ldb;
+		for (int i = 0; i < 2 * mh; i++)
+		{
+			kernels.axpy(a[(long) i * lda + k - 1], bLast, c + (long) i * ldc, 2 * nh);
+		}
+	}
+	if (m % 2 != 0)
+	{
+		gemm(1, 2 * nh, k, a + (long) (m - 1) * lda, lda, b, ldb, c + (long) (m - 1) * ldc, ldc);
+	}
+	if (n % 2 != 0)
+	{
+		gemm(m, 1, k, a, lda, b + n - 1, ldb, c + n - 1, ldc);
+	}
+}
+
+/**
+ *
+ * @param m
+ * @param n
+ * @param k
+ * @param a
+ * @param lda
+ * @param b
+ * @param ldb
+ * @param c
+ * @param ldc
+ */
+void strassen(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc)
+{
+	long floats = strassenWorkspace(m, n, k);
+	if (floats > INT_MAX)
+	{
+		// more than a pool buffer can hold
+		gemm(m, n, k, a, lda, b, ldb, c, ldc);
+		return;
+	}
+	// taken per call, not kept per thread: the workspace of an 8192 product
+	// is about 270MB, more than the pool keeps, so it goes back at once
+	float *work = floats > 0 ? poolAllocate((int) floats) : nullptr;
+	strassenLevel(m, n, k, a, lda, b, ldb, c, ldc, work);
+	poolRelease(work, (int) floats);
+}
+
+/**
+ *
+ * @param n
+ * @return
+ */
+double strassenErrorBound(int n)
+{
+	double n0 = n;
+	while (n0 > cutoffDim)
+	{
+		n0 = std::floor(n0 / 2);
+	}
+	return (std::pow(n / n0, std::log2(18.0)) * (n0 * n0 + 6 * n0) - 6.0 * n) * FLOAT_UNIT_ROUNDOFF;
+}
+
+/**
+ *
+ * @param cutoff
+ */
+void setStrassenCutoff(int cutoff)
+{
+	cutoffDim = std::max(cutoff, STRASSEN_MIN_CUTOFF);
+}
+
+/**
+ *
+ * @return
+ */
+int getStrassenCutoff()
+{
+	return cutoffDim;
+}
+
+/**
+ *
+ * @param dim
+ */
+void setStrassenThreshold(int dim)
+{
+	thresholdDim = dim;
+}
+
+/**
+ *
+ * @return
+ */
+int getStrassenThreshold()
+{
+	return thresholdDim;
+}
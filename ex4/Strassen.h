@@ -0,0 +1,95 @@
+// Strassen.h
+
+#ifndef STRASSEN_H
+#define STRASSEN_H
+
+/**
+ * default for setStrassenCutoff: blocks with a dim of at most this
+ * many go to gemm. 256 pays for the extra additions of one more level;
+ * 512 and 1024 are within the noise of each other (x0.93 to x1.17
+ * against gemm at 4096 across runs), 512 keeps one more level at 8192
+ */
+#define STRASSEN_CUTOFF 512
+
+/**
+ * default for setStrassenThreshold: 0, Matrix::operator* runs strassen
+ * only when a caller opts in. its gain over gemm here (x0.93 to x1.22
+ * at 1024 to 4096 across runs) is within the run-to-run noise, while
+ * its error bound is about 100x that of gemm
+ */
+#define STRASSEN_THRESHOLD 0
+
+/**
+ * the unit roundoff of float, 2^-24
+ */
+#define FLOAT_UNIT_ROUNDOFF 5.9604644775390625e-8
+
+/**
+ * C = A * B by the Winograd variant of Strassen's algorithm (7 block
+ * products and 15 block additions per level), recursing on the halves
+ * until a dim is at most the cutoff, where gemm takes over.
+ * odd dims are peeled: the even part recurses and the last row, col
+ * and rank-1 term are added by gemm. the block temporaries of every
+ * level come from one workspace taken from the pool for the call and
+ * given back at its end, so the levels do not allocate and nothing
+ * stays pinned to the thread after the call.
+ * less accurate than gemm, see strassenErrorBound
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param k cols of A and rows of B
+ * @param a the A buffer
+ * @param lda distance between two rows of A
+ * @param b the B buffer
+ * @param ldb distance between two rows of B
+ * @param c the C buffer, overwritten
+ * @param ldc distance between two rows of C
+ */
+void strassen(int m, int n, int k, const float *a, int lda, const float *b, int ldb, float *c, int ldc);
+
+/**
+ * floats of the workspace strassen uses for a product
+ * @param m rows of A and C
+ * @param n cols of B and C
+ * @param k cols of A and rows of B
+ * @return the floats
+ */
+long strassenWorkspace(int m, int n, int k);
+
+/**
+ * the forward error bound of strassen on n x n matrices that recurse
+ * down to n0 x n0 blocks, n0 <= the cutoff (Higham, Accuracy and
+ * Stability of Numerical Algorithms, ch. 23, the Winograd variant):
+ *     max|C - C'| <= [(n/n0)^log2(18) (n0^2 + 6 n0) - 6n] u max|A| max|B|
+ * to first order in the unit roundoff u. the conventional product
+ * has n^2 u in its place, so the bound grows faster with the levels
+ * of recursion (log2(18) = 4.17 per halving against 4 for n^2).
+ * bench checks the measured error against it
+ * @param n the dim
+ * @return the bound divided by max|A| max|B|
+ */
+double strassenErrorBound(int n);
+
+/**
+ * set the dim at which strassen stops recursing
+ * @param cutoff at least 16
+ */
+void setStrassenCutoff(int cutoff);
+
+/**
+ * @return the dim at which strassen stops recursing
+ */
+int getStrassenCutoff();
+
+/**
+ * opt Matrix::operator* in to strassen from a size on. only square
+ * products take it: the cutoff is measured on squares
+ * @param dim the smallest dim of such products, 0 (the default) to never use it
+ */
+void setStrassenThreshold(int dim);
+
+/**
+ * @return the smallest dim of the products Matrix::operator* runs by strassen, 0 for none
+ */
+int getStrassenThreshold();
+
+#endif //STRASSEN_H
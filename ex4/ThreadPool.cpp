@@ -0,0 +1,183 @@
+// ThreadPool.cpp
+
+#include "ThreadPool.h"
+#include <cstdlib>
+#include <iostream>
+
+#define THREADS_ENV "MLP_THREADS"
+#define NESTED_RESIZE_ERR_MSG "Error: setThreads called from inside a job of the same pool"
+
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+// the pool whose job the thread is running, so a nested parallelFor on that
+// pool runs inline instead of deadlocking, while one on another pool still fans out
+static thread_local const ThreadPool *insideJob = nullptr;
+
+/**
+ *
+ * @param threads
+ */
+ThreadPool::ThreadPool(int threads) : _threads(1), _job(nullptr), _tasks(0), _next(0), _pending(0), _generation(0),
+									  _stop(false)
+{
+	_start(threads);
+}
+
+/**
+ *
+ */
+ThreadPool::~ThreadPool()
+{
+	_stopWorkers();
+}
+
+/**
+ *
+ * @return
+ */
+ThreadPool &ThreadPool::global()
+{
+	static ThreadPool pool([]
+						   {
+							   const char *env = std::getenv(THREADS_ENV);
+							   int threads = env ? std::atoi(env) : (int) std::thread::hardware_concurrency();
+							   return threads > 0 ? threads : 1;
+						   }());
+	return pool;
+}
+
+/**
+ *
+ * @return
+ */
+int ThreadPool::getThreads() const
+{
+	return _threads.load(std::memory_order_relaxed);
+}
+
+/**
+ *
+ * @param threads
+ */
+void ThreadPool::setThreads(int threads)
+{
+	// the job holds _submit until it is done, and this would wait for it
+	if (insideJob == this)
+	{
+		std::cerr << NESTED_RESIZE_ERR_MSG << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	lock_guard<mutex> submit(_submit);
+	_stopWorkers();
+	_start(threads);
+}
+
+/**
+ *
+ * @param count
+ */
+void ThreadPool::_start(int count)
+{
+	_stop = false;
+	for (int i = 1; i < count; i++)
+	{
+		_workers.emplace_back(&ThreadPool::_workerLoop, this, _generation);
+	}
+	_threads = (int) _workers.size() + 1;
+}
+
+/**
+ *
+ */
+void ThreadPool::_stopWorkers()
+{
+	{
+		lock_guard<mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_all();
+	for (std::thread &worker : _workers)
+	{
+		worker.join();
+	}
+	_workers.clear();
+	_threads = 1;
+}
+
+/**
+ *
+ */
+void ThreadPool::_runTasks()
+{
+	int task;
+	while ((task = _next.fetch_add(1)) < _tasks)
+	{
+		(*_job)(task);
+	}
+}
+
+/**
+ *
+ * @param seen
+ */
+void ThreadPool::_workerLoop(long seen)
+{
+	insideJob = this;
+	unique_lock<mutex> lock(_mutex);
+	while (true)
+	{
+		_wake.wait(lock, [&]
+		{ return _stop || _generation != seen; });
+		if (_stop)
+		{
+			return;
+		}
+		seen = _generation;
+		lock.unlock();
+		_runTasks();
+		lock.lock();
+		if (--_pending == 0)
+		{
+			_done.notify_one();
+		}
+	}
+}
+
+/**
+ *
+ * @param tasks
+ * @param fn
+ */
+void ThreadPool::parallelFor(int tasks, const std::function<void(int)> &fn)
+{
+	if (tasks <= 1 || _threads.load(std::memory_order_relaxed) == 1 || insideJob == this)
+	{
+		for (int i = 0; i < tasks; i++)
+		{
+			fn(i);
+		}
+		return;
+	}
+	lock_guard<mutex> submit(_submit);
+	{
+		lock_guard<mutex> lock(_mutex);
+		_job = &fn;
+		_tasks = tasks;
+		_next = 0;
+		_pending = (int) _workers.size();
+		_generation++;
+	}
+	_wake.notify_all();
+
+	const ThreadPool *outer = insideJob;
+	insideJob = this;
+	_runTasks();
+	insideJob = outer;
+
+	unique_lock<mutex> lock(_mutex);
+	_done.wait(lock, [&]
+	{ return _pending == 0; });
+	_job = nullptr;
+}
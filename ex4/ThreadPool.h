@@ -0,0 +1,111 @@
+// ThreadPool.h
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * persistent pool of worker threads. workers are created once and
+ * sleep between jobs, so handing out work costs a wake-up, not a
+ * thread creation. the calling thread works on the job too.
+ * one job runs at a time; parallelFor called from inside a job of
+ * the same pool runs serially on the calling thread, one on another
+ * pool runs over that pool (two pools must not each call into the
+ * other from their jobs, the two jobs would wait on each other)
+ */
+class ThreadPool
+{
+private:
+	std::vector<std::thread> _workers;
+	// _workers.size() + 1, readable without _submit while setThreads
+	// resizes _workers under it
+	std::atomic<int> _threads;
+	std::mutex _mutex;
+	std::mutex _submit;
+	std::condition_variable _wake;
+	std::condition_variable _done;
+	const std::function<void(int)> *_job;
+	int _tasks;
+	std::atomic<int> _next;
+	int _pending;
+	long _generation;
+	bool _stop;
+
+	/**
+	 * body of every worker: wait for a job, take tasks, repeat
+	 * @param seen the last job generation when the worker was started.
+	 * read by the starter, so a job posted before the thread first
+	 * runs is not missed
+	 */
+	void _workerLoop(long seen);
+
+	/**
+	 * take tasks of the current job until none is left
+	 */
+	void _runTasks();
+
+	/**
+	 * start count - 1 workers
+	 * @param count threads including the caller
+	 */
+	void _start(int count);
+
+	/**
+	 * stop and join all workers
+	 */
+	void _stopWorkers();
+
+public:
+	/**
+	 * regular constructor
+	 * @param threads number of threads working on a job,
+	 * including the calling one
+	 */
+	explicit ThreadPool(int threads);
+
+	/**
+	 * stops and joins the workers
+	 */
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	/**
+	 * the process wide pool used by the kernels. sized on first use
+	 * from the MLP_THREADS environment variable, or the number of cores
+	 * @return the pool
+	 */
+	static ThreadPool &global();
+
+	/**
+	 * get the number of threads working on a job
+	 * @return threads including the caller
+	 */
+	int getThreads() const;
+
+	/**
+	 * change the number of threads. joins and restarts the
+	 * workers, so call it between jobs, not per call; exits if
+	 * called from inside a job of this pool, which it would wait for
+	 * @param threads threads including the caller, at least 1
+	 */
+	void setThreads(int threads);
+
+	/**
+	 * run fn(0) .. fn(tasks - 1) over the pool and wait for all of them.
+	 * tasks are handed out one at a time, so uneven tasks balance out
+	 * @param tasks number of tasks
+	 * @param fn the task body, gets the task index
+	 */
+	void parallelFor(int tasks, const std::function<void(int)> &fn);
+};
+
+#endif //THREADPOOL_H
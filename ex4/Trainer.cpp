@@ -0,0 +1,330 @@
+// Trainer.cpp
+
+#include "Trainer.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+
+#define TRAIN_LAST_ERR_MSG "Error: training needs a softmax last layer"
+#define TRAIN_SOFTMAX_ERR_MSG "Error: training takes a softmax in the last layer only"
+#define TRAIN_BATCH_ERR_MSG "Error: the training batch size should be positive"
+#define TRAIN_ACTIVATION_ERR_MSG "Error: the activation has no backward pass: "
+#define TRAIN_DATA_ERR_MSG "Error: the dataset images do not fit the network input"
+// images classified at once by accuracy
+#define ACCURACY_CHUNK 256
+// keeps log finite for a probability rounded to 0
+#define LOG_FLOOR 1e-30
+
+using std::cerr;
+using std::endl;
+
+/**
+ *
+ * @param optimizer
+ * @return
+ */
+TrainConfig defaultTrainConfig(OptimizerType optimizer)
+{
+	TrainConfig config = {};
+	config.optimizer = optimizer;
+	config.learningRate = optimizer == OptimizerAdam ? 0.001f : 0.1f;
+	config.batchSize = 64;
+	config.beta1 = 0.9f;
+	config.beta2 = 0.999f;
+	config.epsilon = 1e-8f;
+	config.threads = 0;
+	config.seed = 0;
+	return config;
+}
+
+/**
+ *
+ * @param probs
+ * @param labels
+ * @param scale
+ * @param grad
+ * @return
+ */
+double softmaxCrossEntropy(const Matrix &probs, const int *labels, float scale, Matrix &grad)
+{
+	int classes = probs.getRows();
+	int n = probs.getCols();
+	if (grad.getRows() != classes || grad.getCols() != n)
+	{
+		grad = Matrix(classes, n, MatrixUninitialized);
+	}
+	const float *p = probs.data();
+	float *g = grad.data();
+	for (int i = 0; i < classes * n; i++)
+	{
+		g[i] = p[i] * scale;
+	}
+	double loss = 0;
+	for (int j = 0; j < n; j++)
+	{
+		loss -= std::log(std::max((double) p[labels[j] * n + j], LOG_FLOOR));
+		g[labels[j] * n + j] -= scale;
+	}
+	return loss;
+}
+
+// _____________________________ Optimizer _____________________________
+
+/**
+ *
+ * @param config
+ */
+Optimizer::Optimizer(const TrainConfig &config) : _config(config), _steps(0)
+{}
+
+/**
+ *
+ */
+void Optimizer::beginStep()
+{
+	_steps++;
+}
+
+/**
+ *
+ * @param slot
+ * @param param
+ * @param grad
+ * @param len
+ */
+void Optimizer::update(int slot, float *param, const float *grad, int len)
+{
+	if (_config.optimizer == OptimizerSgd)
+	{
+		simd().axpy(-_config.learningRate, grad, param, len);
+		return;
+	}
+	if ((int) _first.size() <= slot)
+	{
+		_first.resize(slot + 1);
+		_second.resize(slot + 1);
+	}
+	std::vector<float> &m = _first[slot];
+	std::vector<float> &v = _second[slot];
+	if ((int) m.size() != len)
+	{
+		m.assign(len, 0);
+		v.assign(len, 0);
+	}
+	float b1 = _config.beta1;
+	float b2 = _config.beta2;
+	// the bias correction of both moments folded into the rate
+	float rate = _config.learningRate * (float) (std::sqrt(1 - std::pow((double) b2, (double) _steps)) /
+												 (1 - std::pow((double) b1, (double) _steps)));
+	for (int i = 0; i < len; i++)
+	{
+		m[i] = b1 * m[i] + (1 - b1) * grad[i];
+		v[i] = b2 * v[i] + (1 - b2) * grad[i] * grad[i];
+		param[i] -= rate * m[i] / (std::sqrt(v[i]) + _config.epsilon);
+	}
+}
+
+// _____________________________ Trainer _____________________________
+
+/**
+ *
+ * @param network
+ * @param config
+ */
+Trainer::Trainer(MlpNetwork &network, const TrainConfig &config) :
+		_network(network), _config(config), _optimizer(config), _gen(config.seed)
+{
+	int layers = network.getLayers();
+	if (network.getLayer(layers - 1).getActivation().getActivationType() != Softmax)
+	{
+		cerr << TRAIN_LAST_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	if (config.batchSize <= 0)
+	{
+		cerr << TRAIN_BATCH_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	for (int l = 0; l < layers; l++)
+	{
+		const ActivationInfo &info = network.getLayer(l).getActivation().getInfo();
+		// softmax's backward leaves the gradient as is, which holds only under the loss
+		if (l < layers - 1 && network.getLayer(l).getActivation().getActivationType() == Softmax)
+		{
+			cerr << TRAIN_SOFTMAX_ERR_MSG << endl;
+			exit(EXIT_FAILURE);
+		}
+		if (info.backward == nullptr)
+		{
+			cerr << TRAIN_ACTIVATION_ERR_MSG << info.name << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+	int count = config.threads > 0 ? config.threads : ThreadPool::global().getThreads();
+	_replicas.resize(std::max(1, std::min(count, config.batchSize)));
+	for (Replica &replica : _replicas)
+	{
+		replica.outputs.resize(layers);
+		replica.grads.resize(layers);
+		for (int l = 0; l < layers; l++)
+		{
+			const Dense &layer = network.getLayer(l);
+			replica.gradWeights.emplace_back(layer.getWeights().getRows(), layer.getWeights().getCols());
+			replica.gradBiases.emplace_back(layer.getBias().getRows(), layer.getBias().getCols());
+		}
+		replica.loss = 0;
+	}
+}
+
+/**
+ *
+ * @param replica
+ * @param data
+ * @param indices
+ * @param count
+ * @param scale
+ */
+void Trainer::_runReplica(Replica &replica, const IdxDataset &data, const int *indices, int count, float scale)
+{
+	int size = data.getImageSize();
+	if (replica.input.getRows() != size || replica.input.getCols() != count)
+	{
+		replica.input = Matrix(size, count, MatrixUninitialized);
+	}
+	replica.labels.resize(count);
+	for (int j = 0; j < count; j++)
+	{
+		const float *img = data.image(indices[j]);
+		MatrixView column = replica.input.view().col(j);
+		for (int i = 0; i < size; i++)
+		{
+			column(i, 0) = img[i];
+		}
+		replica.labels[j] = data.label(indices[j]);
+	}
+
+	int layers = _network.getLayers();
+	const Matrix *in = &replica.input;
+	for (int l = 0; l < layers; l++)
+	{
+		_network.getLayer(l).forwardBatch(*in, replica.outputs[l]);
+		in = &replica.outputs[l];
+	}
+	replica.loss = softmaxCrossEntropy(replica.outputs[layers - 1], replica.labels.data(), scale,
+									   replica.grads[layers - 1]);
+	for (int l = layers - 1; l >= 0; l--)
+	{
+		Matrix *gradIn = nullptr;
+		if (l > 0)
+		{
+			Matrix &below = replica.grads[l - 1];
+			if (below.getRows() != replica.outputs[l - 1].getRows() || below.getCols() != count)
+			{
+				below = Matrix(replica.outputs[l - 1].getRows(), count, MatrixUninitialized);
+			}
+			gradIn = &below;
+		}
+		const Matrix &layerIn = l > 0 ? replica.outputs[l - 1] : replica.input;
+		_network.getLayer(l).backwardBatch(layerIn, replica.outputs[l], replica.grads[l], replica.gradWeights[l],
+										   replica.gradBiases[l], gradIn);
+	}
+}
+
+/**
+ *
+ * @param used
+ */
+void Trainer::_step(int used)
+{
+	const SimdKernels &kernels = simd();
+	Replica &sum = _replicas[0];
+	_optimizer.beginStep();
+	for (int l = 0; l < _network.getLayers(); l++)
+	{
+		Matrix &gw = sum.gradWeights[l];
+		Matrix &gb = sum.gradBiases[l];
+		int wLen = gw.getRows() * gw.getCols();
+		int bLen = gb.getRows() * gb.getCols();
+		for (int r = 1; r < used; r++)
+		{
+			kernels.add(gw.data(), _replicas[r].gradWeights[l].data(), gw.data(), wLen);
+			kernels.add(gb.data(), _replicas[r].gradBiases[l].data(), gb.data(), bLen);
+		}
+		Dense &layer = _network.getLayer(l);
+		_optimizer.update(2 * l, layer.trainableWeights().data(), gw.data(), wLen);
+		_optimizer.update(2 * l + 1, layer.trainableBias().data(), gb.data(), bLen);
+	}
+}
+
+/**
+ *
+ * @param data
+ * @return
+ */
+double Trainer::trainEpoch(const IdxDataset &data)
+{
+	if (data.getImageSize() != _network.getInputSize())
+	{
+		cerr << TRAIN_DATA_ERR_MSG << endl;
+		exit(EXIT_FAILURE);
+	}
+	if ((int) _order.size() != data.getCount())
+	{
+		_order.resize(data.getCount());
+		std::iota(_order.begin(), _order.end(), 0);
+	}
+	std::shuffle(_order.begin(), _order.end(), _gen);
+	double loss = 0;
+	for (int start = 0; start < data.getCount(); start += _config.batchSize)
+	{
+		int batch = std::min(_config.batchSize, data.getCount() - start);
+		int replicas = std::min((int) _replicas.size(), batch);
+		float scale = 1.0f / (float) batch;
+		ThreadPool::global().parallelFor(replicas, [&](int r)
+		{
+			int first = start + batch * r / replicas;
+			int last = start + batch * (r + 1) / replicas;
+			_runReplica(_replicas[r], data, _order.data() + first, last - first, scale);
+		});
+		_step(replicas);
+		for (int r = 0; r < replicas; r++)
+		{
+			loss += _replicas[r].loss;
+		}
+	}
+	return loss / data.getCount();
+}
+
+/**
+ *
+ * @param data
+ * @return
+ */
+double Trainer::accuracy(const IdxDataset &data) const
+{
+	int size = data.getImageSize();
+	int right = 0;
+	for (int start = 0; start < data.getCount(); start += ACCURACY_CHUNK)
+	{
+		int count = std::min(ACCURACY_CHUNK, data.getCount() - start);
+		Matrix images(size, count, MatrixUninitialized);
+		for (int j = 0; j < count; j++)
+		{
+			const float *img = data.image(start + j);
+			MatrixView column = images.view().col(j);
+			for (int i = 0; i < size; i++)
+			{
+				column(i, 0) = img[i];
+			}
+		}
+		std::vector<Digit> digits = _network.classifyBatch(images);
+		for (int j = 0; j < count; j++)
+		{
+			right += (int) digits[j].value == data.label(start + j);
+		}
+	}
+	return data.getCount() == 0 ? 0 : (double) right / data.getCount();
+}
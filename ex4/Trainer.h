@@ -0,0 +1,176 @@
+// Trainer.h
+
+#ifndef TRAINER_H
+#define TRAINER_H
+
+#include "MlpNetwork.h"
+#include "Dataset.h"
+#include <random>
+#include <vector>
+
+/**
+ * @enum OptimizerType
+ * @brief how a gradient step updates the weights
+ */
+enum OptimizerType
+{
+	// w -= rate * g
+	OptimizerSgd,
+	// per weight step sizes from running moments of the gradient
+	// (Kingma and Ba), with their bias correction
+	OptimizerAdam
+};
+
+/**
+ * @struct TrainConfig
+ * @brief the settings of a Trainer, see defaultTrainConfig
+ */
+typedef struct TrainConfig
+{
+	OptimizerType optimizer;
+	float learningRate;
+	// images per gradient step, positive
+	int batchSize;
+	// Adam: decay of the first and second moments, and the
+	// term that keeps the step finite where the second is 0
+	float beta1, beta2, epsilon;
+	// data-parallel replicas each step is split over,
+	// 0 for the threads of ThreadPool::global()
+	int threads;
+	// of the shuffles
+	unsigned int seed;
+} TrainConfig;
+
+/**
+ * the usual settings of an optimizer: rate 0.1 for sgd and
+ * 0.001 for adam, batches of 64, beta1 0.9, beta2 0.999, epsilon 1e-8
+ * @param optimizer the optimizer
+ * @return the config
+ */
+TrainConfig defaultTrainConfig(OptimizerType optimizer);
+
+/**
+ * cross-entropy of softmax outputs against labels, and its gradient
+ * by the logits (the softmax inputs), which is simply p - onehot(label)
+ * @param probs classes x n softmax outputs, one column per image
+ * @param labels n labels
+ * @param scale the gradient is multiplied by it (1 / images in the step)
+ * @param grad set to the scaled gradient, shaped as probs
+ * @return the sum of the losses of the n columns
+ */
+double softmaxCrossEntropy(const Matrix &probs, const int *labels, float scale, Matrix &grad);
+
+/**
+ * applies gradient steps to float arrays. every trained array
+ * has its own slot, where Adam keeps its moments
+ */
+class Optimizer
+{
+private:
+	TrainConfig _config;
+	long _steps;
+	std::vector<std::vector<float>> _first;
+	std::vector<std::vector<float>> _second;
+public:
+	/**
+	 * regular constructor
+	 * @param config the optimizer and its settings
+	 */
+	explicit Optimizer(const TrainConfig &config);
+
+	/**
+	 * start a step: call once before the updates of a step
+	 */
+	void beginStep();
+
+	/**
+	 * update one array with its gradient
+	 * @param slot the array's own slot, from 0
+	 * @param param the values to update
+	 * @param grad their gradient
+	 * @param len number of values
+	 */
+	void update(int slot, float *param, const float *grad, int len);
+};
+
+/**
+ * trains an MlpNetwork in place on minibatches, by backpropagation
+ * of the cross-entropy of its softmax last layer.
+ * each minibatch is split over replicas that run on the threads of
+ * ThreadPool::global() with their own activations and gradients; their
+ * gradients are summed into the first replica's, then one optimizer
+ * step updates the shared weights. every buffer is kept from step to
+ * step and only reshaped if the batch size changes (the last batch
+ * of an epoch)
+ */
+class Trainer
+{
+private:
+	/**
+	 * @struct Replica
+	 * @brief the buffers of one share of a minibatch
+	 */
+	typedef struct Replica
+	{
+		// input size x images of the share
+		Matrix input;
+		std::vector<int> labels;
+		// per layer: outputs, and the gradient by them
+		std::vector<Matrix> outputs;
+		std::vector<Matrix> grads;
+		// per layer, shaped as the weights and biases
+		std::vector<Matrix> gradWeights;
+		std::vector<Matrix> gradBiases;
+		double loss;
+	} Replica;
+
+	MlpNetwork &_network;
+	TrainConfig _config;
+	Optimizer _optimizer;
+	std::vector<Replica> _replicas;
+	std::vector<int> _order;
+	std::mt19937 _gen;
+
+	/**
+	 * forward and backward pass of one replica on its share
+	 * @param replica the replica
+	 * @param data the dataset
+	 * @param indices the images of the share
+	 * @param count number of images in the share, at least 1
+	 * @param scale 1 / images in the whole step
+	 */
+	void _runReplica(Replica &replica, const IdxDataset &data, const int *indices, int count, float scale);
+
+	/**
+	 * sum the gradients of the replicas that ran into the first one's,
+	 * and update the weights with them
+	 * @param used number of replicas that ran
+	 */
+	void _step(int used);
+
+public:
+	/**
+	 * set up training. exits if the last layer is not softmax, an
+	 * earlier one is (its backward is the cross-entropy's, only right
+	 * last), an activation has no backward pass or the batch is empty
+	 * @param network the network to train, must outlive the trainer
+	 * @param config the settings
+	 */
+	Trainer(MlpNetwork &network, const TrainConfig &config);
+
+	/**
+	 * one pass over a shuffled dataset
+	 * @param data the dataset, images of the network's input size
+	 * @return the mean cross-entropy over the epoch
+	 */
+	double trainEpoch(const IdxDataset &data);
+
+	/**
+	 * fraction of a dataset the network classifies right
+	 * @param data the dataset
+	 * @return the accuracy, in [0, 1]
+	 */
+	double accuracy(const IdxDataset &data) const;
+};
+
+#endif //TRAINER_H
@@ -0,0 +1,1854 @@
+// bench.cpp
+// performance checks for the ex4 kernels. run ./bench
+
+#include "Matrix.h"
+#include "Gemm.h"
+#include "Simd.h"
+#include "Activation.h"
+#include "MlpNetwork.h"
+#include "ThreadPool.h"
+#include "ModelFile.h"
+#include "StaticMlpNetwork.h"
+#include "Dataset.h"
+#include "Trainer.h"
+#include "HalfMatrix.h"
+#include "ImageStream.h"
+#include "Benchmark.h"
+#include "Profile.h"
+#include "Strassen.h"
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <memory>
+#include <new>
+
+using std::printf;
+
+#define MIN_BENCH_SECONDS 0.2
+#define ALLOC_CHECK_CALLS 1000
+#define STARTUP_CHECK_IMAGES 100
+#define POOL_CHECK_CALLS 100
+// threads and images per thread of the shared network check
+#define SHARED_THREADS 4
+#define SHARED_IMAGES 20000
+// rows and cols around the sub-block of benchViews
+#define VIEW_MARGIN 3
+// random logits are spread over [-scale, scale]
+#define SOFTMAX_LOGIT_SCALE 10.0f
+// exp of it overflows a float
+#define SOFTMAX_OVERFLOW_LOGIT 200.0f
+// activation inputs are spread over [-range, range]
+#define ACTIVATION_RANGE 12.0f
+// error allowed against the double reference, relative above 1 and absolute below
+#define ACTIVATION_TOLERANCE 1e-6
+// batch of the sparse products in benchSparse
+#define SPARSE_BATCH 64
+// width of the hidden layers of benchDepth
+#define DEPTH_WIDTH 128
+// side of a layer too big for the caches (64MB of float weights)
+#define HALF_BIG_DIM 4096
+// finite difference step and the largest relative error of the
+// backpropagated gradient against it
+#define GRADIENT_STEP 1e-2f
+#define GRADIENT_TOLERANCE 1e-2
+// images of the synthetic training set, and the noise added to its
+// class prototypes
+#define TRAIN_IMAGES 4096
+#define TEST_IMAGES 1024
+#define TRAIN_NOISE 60
+#define TRAIN_EPOCHS 3
+#define BENCH_MODEL "bench.model"
+#define BENCH_IMAGES "bench-images.idx"
+#define BENCH_LABELS "bench-labels.idx"
+// images in the files the streaming benchmark reads
+#define STREAM_IMAGES 20000
+#define STREAM_BATCH 256
+#define BENCH_RAW "bench.raw"
+// a 100MB matrix for the binary and text io, and its files
+#define IO_DIM 5000
+#define BENCH_MATRIX_BIN "bench-matrix.bin"
+#define BENCH_MATRIX_TXT "bench-matrix.txt"
+// bench --suite [--filter=<text>] [--json=<file>] [--min-time=<seconds>]
+// entries of a strassen product checked against a double dot product
+#define STRASSEN_SAMPLES 512
+// interleaved runs of each strassen configuration, the median is reported
+#define STRASSEN_RUNS 5
+#define SUITE_ARG "--suite"
+// written by benchProfile when the instrumentation is compiled in
+#define PROFILE_JSON "bench-profile.json"
+#define PROFILE_TRACE "bench-trace.json"
+#define SUITE_SEED 42
+#define SUITE_BATCHES {1, 16, 64, 256}
+#define SUITE_SQUARE_DIMS {256, 512, 1024}
+#define SUITE_ACTIVATION_LENS {10, 128, 4096}
+
+// every global operator new of the process, see benchAllocations
+static long allocations = 0;
+
+void *operator new(std::size_t size)
+{
+	allocations++;
+	void *p = std::malloc(size ? size : 1);
+	if (p == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+/**
+ * fill a matrix with uniform values in [-1, 1)
+ * @param m the matrix to fill
+ * @param gen random source
+ */
+static void randomFill(Matrix &m, std::mt19937 &gen)
+{
+	std::uniform_real_distribution<float> dist(-1, 1);
+	for (int i = 0; i < m.getRows() * m.getCols(); i++)
+	{
+		m[i] = dist(gen);
+	}
+}
+
+/**
+ * run fn repeatedly for at least MIN_BENCH_SECONDS
+ * @param fn the code to measure
+ * @return average seconds per call
+ */
+template<class Fn>
+static double timeIt(Fn fn)
+{
+	using clock = std::chrono::steady_clock;
+	fn();
+	long iters = 0;
+	auto start = clock::now();
+	double elapsed = 0;
+	do
+	{
+		fn();
+		iters++;
+		elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	} while (elapsed < MIN_BENCH_SECONDS);
+	return elapsed / iters;
+}
+
+/**
+ * seconds of one call
+ * @param fn the call
+ * @return the time
+ */
+template<typename Fn>
+static double timeOnce(Fn fn)
+{
+	auto start = std::chrono::steady_clock::now();
+	fn();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * the median of a few samples
+ * @param samples the samples, at least one
+ * @return the median
+ */
+static double median(std::vector<double> samples)
+{
+	std::sort(samples.begin(), samples.end());
+	return samples[samples.size() / 2];
+}
+
+/**
+ * the i-j-k loop Matrix::operator* used before the blocked kernel
+ * @param lhs left matrix
+ * @param rhs right matrix
+ * @return the product
+ */
+static Matrix referenceMultiply(const Matrix &lhs, const Matrix &rhs)
+{
+	Matrix out(lhs.getRows(), rhs.getCols());
+	for (int i = 0; i < lhs.getRows(); i++)
+	{
+		for (int j = 0; j < rhs.getCols(); j++)
+		{
+			for (int k = 0; k < lhs.getCols(); k++)
+			{
+				out(i, j) += lhs(i, k) * rhs(k, j);
+			}
+		}
+	}
+	return out;
+}
+
+/**
+ * compare operator* with the reference loop on one shape
+ * @param m rows of the left matrix
+ * @param n cols of the right matrix
+ * @param k the shared dim
+ * @param gen random source
+ */
+static void benchGemm(int m, int n, int k, std::mt19937 &gen)
+{
+	Matrix a(m, k);
+	Matrix b(k, n);
+	randomFill(a, gen);
+	randomFill(b, gen);
+	double flops = 2.0 * m * n * k;
+
+	double tRef = timeIt([&]
+						 { referenceMultiply(a, b); });
+	double tNew = timeIt([&]
+						 { a * b; });
+
+	Matrix ref = referenceMultiply(a, b);
+	Matrix got = a * b;
+	float err = 0;
+	for (int i = 0; i < m * n; i++)
+	{
+		err = std::fmax(err, std::fabs(ref[i] - got[i]));
+	}
+	printf("gemm %5dx%-5d * %5dx%-5d  loop %7.2f GFLOP/s  blocked %7.2f GFLOP/s  x%-6.1f max err %g\n",
+		   m, k, k, n, flops / tRef * 1e-9, flops / tNew * 1e-9, tRef / tNew, err);
+}
+
+/**
+ * time the element-wise Matrix and Activation paths on every
+ * supported simd level and check they match the sse2 results bit for bit
+ * @param len number of elements
+ * @param gen random source
+ */
+static void benchElementwise(int len, std::mt19937 &gen)
+{
+	Matrix a(len, 1);
+	Matrix b(len, 1);
+	randomFill(a, gen);
+	randomFill(b, gen);
+	Activation relu(Relu);
+
+	setSimdLevel(SimdSse2);
+	Matrix sumRef = a + b;
+	Matrix scaleRef = a * 0.5f;
+	Matrix reluRef = relu(a);
+
+	for (int level = SimdSse2; level <= detectSimdLevel(); level++)
+	{
+		setSimdLevel((SimdLevel) level);
+		double tAdd = timeIt([&]
+							 { Matrix r = a + b; });
+		double tScale = timeIt([&]
+							   { Matrix r = a * 0.5f; });
+		double tRelu = timeIt([&]
+							  { relu(a); });
+		Matrix sum = a + b;
+		Matrix scaled = a * 0.5f;
+		Matrix activated = relu(a);
+		bool same = true;
+		for (int i = 0; i < len; i++)
+		{
+			same = same && sum[i] == sumRef[i] && scaled[i] == scaleRef[i] && activated[i] == reluRef[i];
+		}
+		printf("elementwise %-10s n=%-8d add %6.2f GB/s  scale %6.2f GB/s  relu %6.2f GB/s  %s\n",
+			   simd().name, len, 3.0 * sizeof(float) * len / tAdd * 1e-9,
+			   2.0 * sizeof(float) * len / tScale * 1e-9, 2.0 * sizeof(float) * len / tRelu * 1e-9,
+			   same ? "identical" : "MISMATCH");
+	}
+	setSimdLevel(detectSimdLevel());
+}
+
+/**
+ * fill the weights and biases of the MLP topology with
+ * random values scaled to keep the activations in range
+ * @param weights MLP_SIZE weight matrices to fill
+ * @param biases MLP_SIZE bias vectors to fill
+ * @param gen random source
+ */
+static void randomNetwork(Matrix weights[], Matrix biases[], std::mt19937 &gen)
+{
+	for (int i = 0; i < MLP_SIZE; i++)
+	{
+		weights[i] = Matrix(weightsDims[i].rows, weightsDims[i].cols);
+		biases[i] = Matrix(biasDims[i].rows, biasDims[i].cols);
+		randomFill(weights[i], gen);
+		randomFill(biases[i], gen);
+		weights[i] = weights[i] * (1 / std::sqrt((float) weightsDims[i].cols));
+	}
+}
+
+/**
+ * images/s of one operator() call per image against classifyBatch
+ * @param count images per batch
+ * @param gen random source
+ */
+static void benchBatch(int count, std::mt19937 &gen)
+{
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	MlpNetwork mlp(weights, biases);
+
+	int len = imgDims.rows * imgDims.cols;
+	Matrix images(len, count);
+	randomFill(images, gen);
+	std::vector<Matrix> single(count);
+	for (int j = 0; j < count; j++)
+	{
+		single[j] = Matrix(len, 1);
+		for (int i = 0; i < len; i++)
+		{
+			single[j][i] = images(i, j);
+		}
+	}
+
+	double tSingle = timeIt([&]
+							{
+								for (int j = 0; j < count; j++)
+								{
+									mlp(single[j]);
+								}
+							});
+	double tBatch = timeIt([&]
+						   { mlp.classifyBatch(images); });
+
+	std::vector<Digit> digits = mlp.classifyBatch(single.data(), count);
+	int agree = 0;
+	for (int j = 0; j < count; j++)
+	{
+		agree += mlp(single[j]).value == digits[j].value;
+	}
+	printf("mlp batch %-5d  single %10.0f images/s  batched %10.0f images/s  x%-5.1f agree %d/%d\n",
+		   count, count / tSingle, count / tBatch, tSingle / tBatch, agree, count);
+}
+
+/**
+ * products of transposed and sub-block views straight from the
+ * strided buffers against copying the operands out first, and
+ * a sum over the checked accessors against the unchecked view
+ * @param m rows of the product
+ * @param n cols of the product
+ * @param k the shared dim
+ * @param gen random source
+ */
+static void benchViews(int m, int n, int k, std::mt19937 &gen)
+{
+	Matrix stored(k, m);
+	Matrix b(k + VIEW_MARGIN, n + VIEW_MARGIN);
+	randomFill(stored, gen);
+	randomFill(b, gen);
+	ConstMatrixView a = stored.view().transposed();
+	ConstMatrixView block = b.view().block(VIEW_MARGIN, VIEW_MARGIN, k, n);
+	Matrix got(m, n);
+
+	double tCopy = timeIt([&]
+						  { Matrix(a) * Matrix(block); });
+	double tView = timeIt([&]
+						  { gemm(a, block, got.view()); });
+	Matrix ref = referenceMultiply(Matrix(a), Matrix(block));
+	gemm(a, block, got.view());
+	float err = 0;
+	for (int i = 0; i < m * n; i++)
+	{
+		err = std::fmax(err, std::fabs(ref[i] - got[i]));
+	}
+
+	float sink = 0;
+	double tChecked = timeIt([&]
+							 {
+								 for (int i = 0; i < stored.getRows(); i++)
+								 {
+									 for (int j = 0; j < stored.getCols(); j++)
+									 {
+										 sink += stored(i, j);
+									 }
+								 }
+							 });
+	ConstMatrixView all = stored.view();
+	double tUnchecked = timeIt([&]
+							   {
+								   for (int i = 0; i < all.getRows(); i++)
+								   {
+									   for (int j = 0; j < all.getCols(); j++)
+									   {
+										   sink += all(i, j);
+									   }
+								   }
+							   });
+	printf("views %4dx%-4d * block %4dx%-4d  copy %8.1f us  view %8.1f us  x%-5.2f max err %g"
+		   "  | sum checked %7.1f us  view %7.1f us%s\n", m, k, k, n, tCopy * 1e6, tView * 1e6, tCopy / tView, err,
+		   tChecked * 1e6, tUnchecked * 1e6, sink == 0 ? " " : "");
+}
+
+/**
+ * the blocked transpose against the plain row by row loop
+ * @param rows rows of the matrix
+ * @param cols cols of the matrix
+ * @param gen random source
+ */
+static void benchTranspose(int rows, int cols, std::mt19937 &gen)
+{
+	Matrix a(rows, cols);
+	randomFill(a, gen);
+	Matrix plain(cols, rows);
+	double tPlain = timeIt([&]
+						   {
+							   const float *in = a.data();
+							   float *out = plain.data();
+							   for (int i = 0; i < rows; i++)
+							   {
+								   for (int j = 0; j < cols; j++)
+								   {
+									   out[j * rows + i] = in[i * cols + j];
+								   }
+							   }
+						   });
+	double tBlocked = timeIt([&]
+							 { a.transpose(); });
+	Matrix t = a.transpose();
+	bool same = std::equal(t.data(), t.data() + rows * cols, plain.data());
+	printf("transpose %5dx%-5d  loop %8.1f us  blocked %8.1f us  x%-5.2f %s\n", rows, cols, tPlain * 1e6,
+		   tBlocked * 1e6, tPlain / tBlocked, same ? "identical" : "DIFFERENT");
+}
+
+/**
+ * multiplyTransposed of every transpose combination against
+ * transposing the operands first, for an m x n product
+ * @param m rows of the product
+ * @param n cols of the product
+ * @param k the shared dim
+ * @param gen random source
+ */
+static void benchMultiplyTransposed(int m, int n, int k, std::mt19937 &gen)
+{
+	for (int combo = 0; combo < 4; combo++)
+	{
+		bool transA = combo & 1;
+		bool transB = combo & 2;
+		Matrix a = transA ? Matrix(k, m) : Matrix(m, k);
+		Matrix b = transB ? Matrix(n, k) : Matrix(k, n);
+		randomFill(a, gen);
+		randomFill(b, gen);
+		double tCopy = timeIt([&]
+							  { (transA ? a.transpose() : a) * (transB ? b.transpose() : b); });
+		double tDirect = timeIt([&]
+								{ multiplyTransposed(a, b, transA, transB); });
+		Matrix ref = referenceMultiply(transA ? a.transpose() : a, transB ? b.transpose() : b);
+		Matrix got = multiplyTransposed(a, b, transA, transB);
+		float err = 0;
+		for (int i = 0; i < m * n; i++)
+		{
+			err = std::fmax(err, std::fabs(ref[i] - got[i]));
+		}
+		printf("A%sB%s %4dx%-4d * %4dx%-4d  transpose first %8.1f us  direct %8.1f us  x%-5.2f max err %g\n",
+			   transA ? "^T" : "  ", transB ? "^T" : "  ", m, k, k, n, tCopy * 1e6, tDirect * 1e6, tCopy / tDirect,
+			   err);
+	}
+}
+
+/**
+ * GFLOP/s of one product shape from 1 thread up to the core
+ * count (at least 4) of the global pool
+ * @param m rows of the left matrix
+ * @param n cols of the right matrix
+ * @param k the shared dim
+ * @param gen random source
+ */
+static void benchThreads(int m, int n, int k, std::mt19937 &gen)
+{
+	Matrix a(m, k);
+	Matrix b(k, n);
+	randomFill(a, gen);
+	randomFill(b, gen);
+	double flops = 2.0 * m * n * k;
+	int maxThreads = std::max(4, (int) std::thread::hardware_concurrency());
+	setGemmParallelThreshold(0);
+	printf("threads %5dx%-5d * %5dx%-5d ", m, k, k, n);
+	double tOne = 0;
+	for (int threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		ThreadPool::global().setThreads(threads);
+		double t = timeIt([&]
+						  { Matrix r = a * b; });
+		tOne = threads == 1 ? t : tOne;
+		printf(" %d: %6.1f GFLOP/s (x%.1f)", threads, flops / t * 1e-9, tOne / t);
+	}
+	printf("\n");
+	setGemmParallelThreshold(GEMM_PARALLEL_MACS);
+	ThreadPool::global().setThreads((int) std::thread::hardware_concurrency());
+}
+
+/**
+ * time one Dense layer of every weightsDims shape in both modes
+ * @param gen random source
+ */
+static void benchDenseModes(std::mt19937 &gen)
+{
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	for (int i = 0; i < MLP_SIZE; i++)
+	{
+		Dense layer(weights[i], biases[i], i == MLP_SIZE - 1 ? Softmax : Relu);
+		Matrix in(weightsDims[i].cols, 1);
+		Matrix out(weightsDims[i].rows, 1);
+		randomFill(in, gen);
+
+		layer.setMode(DenseUnfused);
+		double tUnfused = timeIt([&]
+								 { layer.forward(in.data(), out.data()); });
+		Matrix ref = layer(in);
+		layer.setMode(DenseFused);
+		double tFused = timeIt([&]
+							   { layer.forward(in.data(), out.data()); });
+		Matrix got = layer(in);
+		float err = 0;
+		for (int j = 0; j < ref.getRows(); j++)
+		{
+			err = std::fmax(err, std::fabs(ref[j] - got[j]));
+		}
+		printf("dense %4dx%-4d %-7s unfused %7.2f us  fused %7.2f us  x%-5.2f max err %g\n",
+			   weightsDims[i].rows, weightsDims[i].cols, i == MLP_SIZE - 1 ? "softmax" : "relu",
+			   tUnfused * 1e6, tFused * 1e6, tUnfused / tFused, err);
+	}
+}
+
+/**
+ * the stable vectorized softmax in both exp modes against the
+ * plain std::exp loop, its error against a double reference,
+ * logits big enough to overflow the plain loop, and the fused
+ * argmax against a full softmax followed by a search
+ * @param len length of the vector
+ * @param gen random source
+ */
+static void benchSoftmax(int len, std::mt19937 &gen)
+{
+	Matrix logits(len, 1);
+	randomFill(logits, gen);
+	logits = logits * SOFTMAX_LOGIT_SCALE;
+	Matrix out(len, 1);
+	Activation softmax(Softmax);
+
+	double tPlain = timeIt([&]
+						   {
+							   float s = 0;
+							   for (int i = 0; i < len; i++)
+							   {
+								   out[i] = std::exp(logits[i]);
+								   s += out[i];
+							   }
+							   simd().scale(out.data(), 1 / s, out.data(), len);
+						   });
+	std::vector<double> exact(len);
+	double maxLogit = *std::max_element(logits.data(), logits.data() + len);
+	double total = 0;
+	for (int i = 0; i < len; i++)
+	{
+		exact[i] = std::exp(logits[i] - maxLogit);
+		total += exact[i];
+	}
+	printf("softmax n=%-6d plain %8.2f us", len, tPlain * 1e6);
+	for (int mode = ExpAccurate; mode <= ExpFast; mode++)
+	{
+		Activation::setExpMode((ExpMode) mode);
+		double t = timeIt([&]
+						  {
+							  std::copy(logits.data(), logits.data() + len, out.data());
+							  softmax.apply(out.data(), len);
+						  });
+		std::copy(logits.data(), logits.data() + len, out.data());
+		softmax.apply(out.data(), len);
+		double err = 0;
+		for (int i = 0; i < len; i++)
+		{
+			err = std::fmax(err, std::fabs(out[i] - exact[i] / total) / (exact[i] / total));
+		}
+		printf("  %s %8.2f us rel err %.2g", mode == ExpAccurate ? "accurate" : "fast", t * 1e6, err);
+	}
+	Activation::setExpMode(ExpAccurate);
+
+	int index = 0;
+	double tFused = timeIt([&]
+						   { softmaxArgmax(logits.data(), len, &index); });
+	double tFull = timeIt([&]
+						  {
+							  std::copy(logits.data(), logits.data() + len, out.data());
+							  softmax.apply(out.data(), len);
+							  index = (int) (std::max_element(out.data(), out.data() + len) - out.data());
+						  });
+	Matrix big(len, 1);
+	big[0] = SOFTMAX_OVERFLOW_LOGIT;
+	softmax.apply(big.data(), len);
+	printf("  | argmax fused %7.2f us full %7.2f us  | logit %g -> p %g\n", tFused * 1e6, tFull * 1e6,
+		   SOFTMAX_OVERFLOW_LOGIT, big[0]);
+}
+
+/**
+ * every registered activation on every supported simd level:
+ * throughput of the vectorized kernel and of the scalar reference,
+ * and the worst error of the kernel against the reference
+ * @param len length of the vector
+ * @param gen random source
+ * @return true if every kernel is within ACTIVATION_TOLERANCE
+ */
+static bool benchActivations(int len, std::mt19937 &gen)
+{
+	Matrix in(len, 1);
+	std::uniform_real_distribution<float> dist(-ACTIVATION_RANGE, ACTIVATION_RANGE);
+	for (int i = 0; i < len; i++)
+	{
+		in[i] = dist(gen);
+	}
+	Matrix ref(len, 1);
+	Matrix out(len, 1);
+	bool valid = true;
+	for (int type = 0; type < activationCount(); type++)
+	{
+		Activation activation((ActivationType) type);
+		const ActivationInfo &info = activation.getInfo();
+		double tRef = timeIt([&]
+							 { info.reference(in.data(), ref.data(), len); });
+		info.reference(in.data(), ref.data(), len);
+		printf("activation %-9s n=%-6d reference %7.3f Gval/s ", info.name, len, len / tRef * 1e-9);
+		for (int level = SimdSse2; level <= detectSimdLevel(); level++)
+		{
+			setSimdLevel((SimdLevel) level);
+			double t = timeIt([&]
+							  {
+								  std::copy(in.data(), in.data() + len, out.data());
+								  activation.apply(out.data(), len);
+							  });
+			std::copy(in.data(), in.data() + len, out.data());
+			activation.apply(out.data(), len);
+			double err = 0;
+			for (int i = 0; i < len; i++)
+			{
+				err = std::fmax(err, std::fabs(out[i] - ref[i]) / std::fmax(1.0, std::fabs(ref[i])));
+			}
+			valid = valid && err <= ACTIVATION_TOLERANCE;
+			printf(" %s %7.3f Gval/s err %.1e", simd().name, len / t * 1e-9, err);
+		}
+		printf("\n");
+	}
+	setSimdLevel(detectSimdLevel());
+	return valid;
+}
+
+/**
+ * one pruned 128x784 Dense layer in every float format: single
+ * vector and SPARSE_BATCH batch times, memory of the weights, the
+ * error against the dense layer, and the format chooseWeightFormat picks
+ * @param density fraction of the weights left
+ * @param blocks prune whole 4x4 blocks instead of single weights
+ * @param gen random source
+ */
+static void benchSparse(float density, bool blocks, std::mt19937 &gen)
+{
+	int rows = weightsDims[0].rows;
+	int cols = weightsDims[0].cols;
+	Matrix weights(rows, cols);
+	Matrix bias(rows, 1);
+	randomFill(weights, gen);
+	randomFill(bias, gen);
+	std::uniform_real_distribution<float> keep(0, 1);
+	for (int i = 0; i < rows; i += blocks ? BSR_BLOCK : 1)
+	{
+		for (int j = 0; j < cols; j += blocks ? BSR_BLOCK : 1)
+		{
+			if (keep(gen) >= density)
+			{
+				for (int r = i; r < (blocks ? std::min(i + BSR_BLOCK, rows) : i + 1); r++)
+				{
+					for (int c = j; c < (blocks ? std::min(j + BSR_BLOCK, cols) : j + 1); c++)
+					{
+						weights(r, c) = 0;
+					}
+				}
+			}
+		}
+	}
+	Matrix in(cols, 1);
+	Matrix batch(cols, SPARSE_BATCH);
+	randomFill(in, gen);
+	randomFill(batch, gen);
+	Dense layer(weights, bias, Relu);
+	Matrix ref(rows, 1);
+	layer.forward(in.data(), ref.data());
+	Matrix refBatch = layer.forwardBatch(batch);
+
+	const WeightFormat formats[] = {WeightsFloat, WeightsCsr, WeightsBsr};
+	const char *names[] = {"float", "csr", "bsr"};
+	Matrix out(rows, 1);
+	printf("sparse %-6s density %4.2f", blocks ? "blocks" : "values", weightDensity(weights));
+	for (int f = 0; f < 3; f++)
+	{
+		layer.setWeightFormat(formats[f]);
+		double tSingle = timeIt([&]
+								{ layer.forward(in.data(), out.data()); });
+		double tBatch = timeIt([&]
+							   { layer.forwardBatch(batch); });
+		Matrix outBatch = layer.forwardBatch(batch);
+		double err = 0;
+		for (int i = 0; i < rows; i++)
+		{
+			err = std::fmax(err, std::fabs(out[i] - ref[i]));
+		}
+		for (int i = 0; i < rows * SPARSE_BATCH; i++)
+		{
+			err = std::fmax(err, std::fabs(outBatch[i] - refBatch[i]));
+		}
+		size_t bytes = f == 0 ? sizeof(float) * rows * cols : f == 1 ? CsrMatrix(weights).bytes() :
+															   BsrMatrix(weights).bytes();
+		printf("  %s %6.2f us %6.1f us/batch %4zu KB err %.0e", names[f], tSingle * 1e6, tBatch * 1e6,
+			   bytes / 1024, err);
+	}
+	WeightFormat chosen = chooseWeightFormat(weights);
+	printf("  auto %s\n", chosen == WeightsFloat ? "float" : chosen == WeightsCsr ? "csr" : "bsr");
+}
+
+/**
+ * int8 against float inference of one random network over a set of
+ * random images: top digit agreement, error of its probability,
+ * and images/s of operator() at every available simd level
+ * @param count images in the set
+ * @param gen random source
+ */
+static void benchQuantized(int count, std::mt19937 &gen)
+{
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	MlpNetwork exact(weights, biases);
+	MlpNetwork quantized(weights, biases, WeightsInt8);
+	std::vector<Matrix> images(count);
+	for (Matrix &img : images)
+	{
+		img = Matrix(imgDims.rows * imgDims.cols, 1);
+		randomFill(img, gen);
+	}
+
+	int agree = 0;
+	double probErr = 0;
+	for (Matrix &img : images)
+	{
+		Digit want = exact(img);
+		Digit got = quantized(img);
+		agree += want.value == got.value;
+		probErr += std::fabs(want.probability - got.probability);
+	}
+	printf("int8 %d images  top digit agree %d/%d  mean probability err %g\n", count, agree, count,
+		   probErr / count);
+
+	for (int level = SimdSse2; level <= detectSimdLevel(); level++)
+	{
+		setSimdLevel((SimdLevel) level);
+		double tFloat = timeIt([&]
+							   {
+								   for (Matrix &img : images)
+								   {
+									   exact(img);
+								   }
+							   });
+		double tInt8 = timeIt([&]
+							  {
+								  for (Matrix &img : images)
+								  {
+									  quantized(img);
+								  }
+							  });
+		printf("int8 %-10s float %10.0f images/s  int8 %10.0f images/s  x%.2f\n", simd().name,
+			   count / tFloat, count / tInt8, tFloat / tInt8);
+	}
+	setSimdLevel(detectSimdLevel());
+}
+
+/**
+ * startup of a network from raw float files read by operator>>
+ * (one read per value, then copies into the layers) against
+ * mapping a model file, and that both classify the same
+ * @param gen random source
+ */
+static void benchStartup(std::mt19937 &gen)
+{
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	writeModel(BENCH_MODEL, weights, biases, mlpActivations, MLP_SIZE);
+	{
+		std::ofstream raw(BENCH_RAW, std::ios::binary);
+		for (int i = 0; i < MLP_SIZE; i++)
+		{
+			raw.write((const char *) weights[i].data(), sizeof(float) * weights[i].getRows() * weights[i].getCols());
+			raw.write((const char *) biases[i].data(), sizeof(float) * biases[i].getRows() * biases[i].getCols());
+		}
+	}
+
+	double tStream = timeIt([&]
+							{
+								Matrix w[MLP_SIZE];
+								Matrix b[MLP_SIZE];
+								std::ifstream is(BENCH_RAW, std::ios::binary);
+								for (int i = 0; i < MLP_SIZE; i++)
+								{
+									w[i] = Matrix(weightsDims[i].rows, weightsDims[i].cols);
+									b[i] = Matrix(biasDims[i].rows, biasDims[i].cols);
+									is >> w[i] >> b[i];
+								}
+								MlpNetwork mlp(w, b);
+							});
+	double tMapped = timeIt([&]
+							{
+								MappedModel model(BENCH_MODEL);
+								MlpNetwork mlp(model);
+							});
+
+	MlpNetwork loaded(weights, biases);
+	MappedModel model(BENCH_MODEL);
+	MlpNetwork mapped(model);
+	Matrix img(imgDims.rows * imgDims.cols, 1);
+	int agree = 0;
+	for (int i = 0; i < STARTUP_CHECK_IMAGES; i++)
+	{
+		randomFill(img, gen);
+		Digit want = loaded(img);
+		Digit got = mapped(img);
+		agree += want.value == got.value && want.probability == got.probability;
+	}
+	printf("startup  stream %8.1f us  mapped %8.1f us  x%-6.1f identical %d/%d\n", tStream * 1e6,
+		   tMapped * 1e6, tStream / tMapped, agree, STARTUP_CHECK_IMAGES);
+	std::remove(BENCH_MODEL);
+	std::remove(BENCH_RAW);
+}
+
+/**
+ * a network of the given depth (DEPTH_WIDTH wide hidden layers with
+ * gelu, relu and tanh in turn, softmax last) written to a model file
+ * and mapped: images/s, heap allocations per call, and that it
+ * classifies as the same network built from the matrices
+ * @param depth number of layers, at least 2
+ * @param gen random source
+ * @return true if no call allocates
+ */
+static bool benchDepth(int depth, std::mt19937 &gen)
+{
+	const ActivationType hidden[] = {Gelu, Relu, Tanh};
+	std::vector<Matrix> weights(depth);
+	std::vector<Matrix> biases(depth);
+	std::vector<ActivationType> activations(depth);
+	for (int i = 0; i < depth; i++)
+	{
+		int rows = i == depth - 1 ? weightsDims[MLP_SIZE - 1].rows : DEPTH_WIDTH;
+		int cols = i == 0 ? imgDims.rows * imgDims.cols : DEPTH_WIDTH;
+		weights[i] = Matrix(rows, cols);
+		biases[i] = Matrix(rows, 1);
+		randomFill(weights[i], gen);
+		randomFill(biases[i], gen);
+		weights[i] = weights[i] * (1 / std::sqrt((float) cols));
+		activations[i] = i == depth - 1 ? Softmax : hidden[i % 3];
+	}
+	writeModel(BENCH_MODEL, weights.data(), biases.data(), activations.data(), depth);
+	MappedModel model(BENCH_MODEL);
+	MlpNetwork mapped(model);
+	MlpNetwork built(weights.data(), biases.data(), activations.data(), depth);
+
+	Matrix img(imgDims.rows * imgDims.cols, 1);
+	int agree = 0;
+	for (int i = 0; i < STARTUP_CHECK_IMAGES; i++)
+	{
+		randomFill(img, gen);
+		Digit want = built(img);
+		Digit got = mapped(img);
+		agree += want.value == got.value && want.probability == got.probability;
+	}
+	long before = allocations;
+	for (int i = 0; i < ALLOC_CHECK_CALLS; i++)
+	{
+		mapped(img);
+	}
+	long count = allocations - before;
+	double t = timeIt([&]
+					  { mapped(img); });
+	printf("mlp depth %-3d %10.0f images/s  heap allocations per call %g  identical %d/%d\n", mapped.getLayers(),
+		   1 / t, (double) count / ALLOC_CHECK_CALLS, agree, STARTUP_CHECK_IMAGES);
+	std::remove(BENCH_MODEL);
+	return count == 0;
+}
+
+/**
+ * mean cross-entropy of a network over a batch, by forwardBatch
+ * @param network the network, softmax last
+ * @param images the batch, one image per column
+ * @param labels its labels
+ * @return the mean loss
+ */
+static double meanLoss(const MlpNetwork &network, const Matrix &images, const int *labels)
+{
+	Matrix in = images;
+	for (int l = 0; l < network.getLayers(); l++)
+	{
+		in = network.getLayer(l).forwardBatch(in);
+	}
+	Matrix grad;
+	return softmaxCrossEntropy(in, labels, 1, grad) / images.getCols();
+}
+
+/**
+ * the largest error of sampled entries of a product against dot
+ * products in double, relative to max|A| max|B|
+ * @param a the left operand
+ * @param b the right operand
+ * @param c the product to check
+ * @param gen random source of the samples
+ * @return the error
+ */
+static double sampledProductError(const Matrix &a, const Matrix &b, const Matrix &c, std::mt19937 &gen)
+{
+	std::uniform_int_distribution<int> row(0, c.getRows() - 1);
+	std::uniform_int_distribution<int> col(0, c.getCols() - 1);
+	double err = 0;
+	for (int s = 0; s < STRASSEN_SAMPLES; s++)
+	{
+		int i = row(gen);
+		int j = col(gen);
+		double dot = 0;
+		for (int p = 0; p < a.getCols(); p++)
+		{
+			dot += (double) a(i, p) * b(p, j);
+		}
+		err = std::fmax(err, std::fabs(c(i, j) - dot));
+	}
+	double maxA = 0, maxB = 0;
+	for (int i = 0; i < a.getRows() * a.getCols(); i++)
+	{
+		maxA = std::fmax(maxA, std::fabs(a[i]));
+	}
+	for (int i = 0; i < b.getRows() * b.getCols(); i++)
+	{
+		maxB = std::fmax(maxB, std::fabs(b[i]));
+	}
+	return err / (maxA * maxB);
+}
+
+/**
+ * strassen against gemm on a square product at the cutoffs below
+ * the dim (a cutoff of at least the dim is plain gemm): GFLOP/s (by
+ * the 2 n^3 of the conventional product) of the median of STRASSEN_RUNS
+ * interleaved runs, as one run of a big product is long and noisy,
+ * and the sampled error against strassenErrorBound
+ * @param dim the dim
+ * @param gen random source
+ * @return true if every error is within its bound
+ */
+static bool benchStrassen(int dim, std::mt19937 &gen)
+{
+	Matrix a(dim, dim);
+	Matrix b(dim, dim);
+	randomFill(a, gen);
+	randomFill(b, gen);
+	Matrix c(dim, dim);
+	double flops = 2.0 * dim * dim * dim;
+	const int leaves[] = {STRASSEN_CUTOFF / 2, STRASSEN_CUTOFF, STRASSEN_CUTOFF * 2};
+	const int configs = sizeof(leaves) / sizeof(leaves[0]);
+	std::vector<double> tGemm;
+	std::vector<double> tFast[configs];
+	double errGemm = 0;
+	double err[configs] = {};
+	double bound[configs] = {};
+	int cutoff = getStrassenCutoff();
+	for (int run = 0; run < STRASSEN_RUNS; run++)
+	{
+		tGemm.push_back(timeOnce([&]
+								 { gemm(a.view(), b.view(), c.view()); }));
+		errGemm = run == 0 ? sampledProductError(a, b, c, gen) : errGemm;
+		for (int l = 0; l < configs && leaves[l] < dim; l++)
+		{
+			setStrassenCutoff(leaves[l]);
+			tFast[l].push_back(timeOnce([&]
+										{ strassen(dim, dim, dim, a.data(), dim, b.data(), dim, c.data(), dim); }));
+			err[l] = run == 0 ? sampledProductError(a, b, c, gen) : err[l];
+			bound[l] = strassenErrorBound(dim);
+		}
+	}
+	setStrassenCutoff(cutoff);
+	double t = median(tGemm);
+	printf("strassen %5d  gemm %6.1f GFLOP/s err %.1e ", dim, flops / t * 1e-9, errGemm);
+	bool valid = true;
+	for (int l = 0; l < configs && leaves[l] < dim; l++)
+	{
+		double tFastMedian = median(tFast[l]);
+		valid = valid && err[l] <= bound[l];
+		printf(" | cutoff %4d %6.1f GFLOP/s x%.2f err %.1e bound %.1e", leaves[l], flops / tFastMedian * 1e-9,
+			   t / tFastMedian, err[l], bound[l]);
+	}
+	printf(" (median of %d)\n", STRASSEN_RUNS);
+	return valid;
+}
+
+/**
+ * check backpropagation against central finite differences on a tiny
+ * network: one full batch step of plain sgd at rate 1 over 3 replicas
+ * moves every weight by exactly minus its gradient
+ * @param gen random source
+ * @return true if the relative error is within GRADIENT_TOLERANCE
+ */
+static bool benchGradient(std::mt19937 &gen)
+{
+	const int count = 12;
+	const int rows = 2;
+	const int cols = 3;
+	const int dims[] = {rows * cols, 5, 4, 3};
+	const ActivationType activations[] = {Tanh, Sigmoid, Softmax};
+	Matrix weights[3];
+	Matrix biases[3];
+	for (int l = 0; l < 3; l++)
+	{
+		weights[l] = Matrix(dims[l + 1], dims[l]);
+		biases[l] = Matrix(dims[l + 1], 1);
+		randomFill(weights[l], gen);
+		randomFill(biases[l], gen);
+	}
+	MlpNetwork network(weights, biases, activations, 3);
+
+	std::uniform_int_distribution<int> byte(0, 255);
+	std::vector<uint8_t> pixels(count * rows * cols);
+	std::vector<uint8_t> classes(count);
+	for (uint8_t &p : pixels)
+	{
+		p = (uint8_t) byte(gen);
+	}
+	for (int j = 0; j < count; j++)
+	{
+		classes[j] = (uint8_t) (j % dims[3]);
+	}
+	writeIdx(BENCH_IMAGES, BENCH_LABELS, pixels.data(), classes.data(), count, rows, cols);
+	IdxDataset data(BENCH_IMAGES, BENCH_LABELS);
+	std::remove(BENCH_IMAGES);
+	std::remove(BENCH_LABELS);
+	Matrix images(rows * cols, count);
+	std::vector<int> labels(count);
+	for (int j = 0; j < count; j++)
+	{
+		for (int i = 0; i < rows * cols; i++)
+		{
+			images(i, j) = data.image(j)[i];
+		}
+		labels[j] = data.label(j);
+	}
+
+	std::vector<double> numeric;
+	std::vector<float> before;
+	for (int l = 0; l < 3; l++)
+	{
+		for (Matrix *param : {&network.getLayer(l).trainableWeights(), &network.getLayer(l).trainableBias()})
+		{
+			for (int i = 0; i < param->getRows() * param->getCols(); i++)
+			{
+				float keep = param->data()[i];
+				param->data()[i] = keep + GRADIENT_STEP;
+				double up = meanLoss(network, images, labels.data());
+				param->data()[i] = keep - GRADIENT_STEP;
+				double down = meanLoss(network, images, labels.data());
+				param->data()[i] = keep;
+				numeric.push_back((up - down) / (2 * GRADIENT_STEP));
+				before.push_back(keep);
+			}
+		}
+	}
+
+	TrainConfig config = defaultTrainConfig(OptimizerSgd);
+	config.learningRate = 1;
+	config.batchSize = count;
+	config.threads = 3;
+	Trainer trainer(network, config);
+	trainer.trainEpoch(data);
+	double diff = 0;
+	double norm = 0;
+	size_t k = 0;
+	for (int l = 0; l < 3; l++)
+	{
+		for (const Matrix *param : {&network.getLayer(l).getWeights(), &network.getLayer(l).getBias()})
+		{
+			for (int i = 0; i < param->getRows() * param->getCols(); i++, k++)
+			{
+				double analytic = before[k] - param->data()[i];
+				diff += (analytic - numeric[k]) * (analytic - numeric[k]);
+				norm += analytic * analytic + numeric[k] * numeric[k];
+			}
+		}
+	}
+	double error = std::sqrt(diff / norm);
+	printf("gradient check %zu parameters  relative error %.2e\n", k, error);
+	return error <= GRADIENT_TOLERANCE;
+}
+
+/**
+ * epochs/s, loss and accuracy of training the MLP topology with an
+ * optimizer on a synthetic learnable set: noisy copies of one random
+ * prototype image per class, written and read back as IDX files
+ * @param optimizer the optimizer
+ * @param gen random source
+ */
+static void benchTraining(OptimizerType optimizer, std::mt19937 &gen)
+{
+	const int rows = imgDims.rows;
+	const int cols = imgDims.cols;
+	const int classCount = weightsDims[MLP_SIZE - 1].rows;
+	std::uniform_int_distribution<int> byte(0, 255);
+	std::uniform_int_distribution<int> noise(-TRAIN_NOISE, TRAIN_NOISE);
+	std::uniform_int_distribution<int> pick(0, classCount - 1);
+	std::vector<uint8_t> prototypes(classCount * rows * cols);
+	for (uint8_t &p : prototypes)
+	{
+		p = (uint8_t) byte(gen);
+	}
+	std::vector<uint8_t> pixels((size_t) (TRAIN_IMAGES + TEST_IMAGES) * rows * cols);
+	std::vector<uint8_t> classes(TRAIN_IMAGES + TEST_IMAGES);
+	for (int j = 0; j < TRAIN_IMAGES + TEST_IMAGES; j++)
+	{
+		classes[j] = (uint8_t) pick(gen);
+		for (int i = 0; i < rows * cols; i++)
+		{
+			int p = prototypes[classes[j] * rows * cols + i] + noise(gen);
+			pixels[(size_t) j * rows * cols + i] = (uint8_t) std::min(255, std::max(0, p));
+		}
+	}
+	writeIdx(BENCH_IMAGES, BENCH_LABELS, pixels.data(), classes.data(), TRAIN_IMAGES, rows, cols);
+	IdxDataset train(BENCH_IMAGES, BENCH_LABELS);
+	writeIdx(BENCH_IMAGES, BENCH_LABELS, pixels.data() + (size_t) TRAIN_IMAGES * rows * cols,
+			 classes.data() + TRAIN_IMAGES, TEST_IMAGES, rows, cols);
+	IdxDataset test(BENCH_IMAGES, BENCH_LABELS);
+	std::remove(BENCH_IMAGES);
+	std::remove(BENCH_LABELS);
+
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	MlpNetwork network(weights, biases);
+	Trainer trainer(network, defaultTrainConfig(optimizer));
+	double loss = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int epoch = 0; epoch < TRAIN_EPOCHS; epoch++)
+	{
+		loss = trainer.trainEpoch(train);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("train %-4s %d images x %d epochs %8.2f epochs/s  loss %.4f  test accuracy %.3f\n",
+		   optimizer == OptimizerAdam ? "adam" : "sgd", TRAIN_IMAGES, TRAIN_EPOCHS, TRAIN_EPOCHS / seconds, loss,
+		   trainer.accuracy(test));
+}
+
+/**
+ * the 16 bit weight formats against float on the MLP topology:
+ * rounding error of the weights, top digit agreement and probability
+ * error of the network, then per simd level the time of a
+ * matrix-vector product with the first layer and with a layer too big
+ * for the caches, and of the first layer on a batch
+ * @param count images in the set
+ * @param gen random source
+ */
+static void benchHalf(int count, std::mt19937 &gen)
+{
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	MlpNetwork exact(weights, biases);
+	std::vector<Matrix> images(count);
+	for (Matrix &img : images)
+	{
+		img = Matrix(imgDims.rows * imgDims.cols, 1);
+		randomFill(img, gen);
+	}
+	Matrix batch(imgDims.rows * imgDims.cols, SPARSE_BATCH);
+	randomFill(batch, gen);
+	const WeightFormat formats[] = {WeightsFp16, WeightsBf16};
+	const char *names[] = {"fp16", "bf16"};
+
+	for (int f = 0; f < 2; f++)
+	{
+		HalfMatrix half(weights[0], formats[f] == WeightsBf16 ? HalfBf16 : HalfFp16);
+		Matrix back = half.toFloat();
+		double maxErr = 0;
+		double maxWeight = 0;
+		for (int i = 0; i < back.getRows() * back.getCols(); i++)
+		{
+			maxErr = std::fmax(maxErr, std::fabs(back.data()[i] - weights[0].data()[i]));
+			maxWeight = std::fmax(maxWeight, std::fabs(weights[0].data()[i]));
+		}
+		MlpNetwork rounded(weights, biases, formats[f]);
+		int agree = 0;
+		double probErr = 0;
+		for (Matrix &img : images)
+		{
+			Digit want = exact(img);
+			Digit got = rounded(img);
+			agree += want.value == got.value;
+			probErr += std::fabs(want.probability - got.probability);
+		}
+		printf("%s %dx%d weights %zu bytes (float %zu)  max err / max weight %.2e  top digit agree %d/%d  "
+			   "mean probability err %g\n", names[f], half.getRows(), half.getCols(), half.bytes(),
+			   (size_t) half.getRows() * half.getCols() * sizeof(float), maxErr / maxWeight, agree, count, probErr / count);
+	}
+
+	// the first layer stays in L2 between calls; the big one streams from memory
+	Matrix bigWeights(HALF_BIG_DIM, HALF_BIG_DIM);
+	Matrix bigBias(HALF_BIG_DIM, 1);
+	randomFill(bigWeights, gen);
+	Dense layers[] = {Dense(weights[0], biases[0], Relu), Dense(bigWeights, bigBias, Relu)};
+	const WeightFormat all[] = {WeightsFloat, WeightsFp16, WeightsBf16};
+	for (int level = SimdSse2; level <= detectSimdLevel(); level++)
+	{
+		setSimdLevel((SimdLevel) level);
+		for (Dense &layer : layers)
+		{
+			int rows = layer.getWeights().getRows();
+			int cols = layer.getWeights().getCols();
+			Matrix in(cols, 1);
+			Matrix out(rows, 1);
+			randomFill(in, gen);
+			double t[3];
+			for (int f = 0; f < 3; f++)
+			{
+				layer.setWeightFormat(all[f]);
+				t[f] = timeIt([&]
+							  { layer.forward(in.data(), out.data()); });
+			}
+			printf("half %-10s gemv %4dx%-4d float %9.2f us  fp16 %9.2f us x%.2f  bf16 %9.2f us x%.2f\n",
+				   simd().name, rows, cols, t[0] * 1e6, t[1] * 1e6, t[0] / t[1], t[2] * 1e6, t[0] / t[2]);
+		}
+		double tBatch[3];
+		for (int f = 0; f < 3; f++)
+		{
+			layers[0].setWeightFormat(all[f]);
+			tBatch[f] = timeIt([&]
+							   { layers[0].forwardBatch(batch); });
+		}
+		printf("half %-10s batch %d float %7.1f us  fp16 x%.2f  bf16 x%.2f\n", simd().name, SPARSE_BATCH,
+			   tBatch[0] * 1e6, tBatch[0] / tBatch[1], tBatch[0] / tBatch[2]);
+	}
+	setSimdLevel(detectSimdLevel());
+}
+
+/**
+ * images/s of classifying a file of images: one operator>> and
+ * operator() per image (floats), against ImageStream batches read then
+ * classified in turn, and against a BatchPipeline reading the next
+ * batch meanwhile, for an IDX file and a raw float file of the same
+ * images. also checks that every way gives the same digits
+ * @param gen random source
+ * @return true if all the digits agree
+ */
+static bool benchStream(std::mt19937 &gen)
+{
+	const int size = imgDims.rows * imgDims.cols;
+	std::uniform_int_distribution<int> byte(0, 255);
+	std::vector<uint8_t> pixels((size_t) STREAM_IMAGES * size);
+	std::vector<uint8_t> classes(STREAM_IMAGES);
+	for (uint8_t &p : pixels)
+	{
+		p = (uint8_t) byte(gen);
+	}
+	writeIdx(BENCH_IMAGES, BENCH_LABELS, pixels.data(), classes.data(), STREAM_IMAGES, imgDims.rows, imgDims.cols);
+	{
+		std::vector<float> floats(pixels.size());
+		simd().bytesToFloat(pixels.data(), IDX_PIXEL_SCALE, floats.data(), (int) floats.size());
+		std::ofstream raw(BENCH_RAW, std::ios::binary | std::ios::trunc);
+		raw.write((const char *) floats.data(), (std::streamsize) (floats.size() * sizeof(float)));
+	}
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	MlpNetwork network(weights, biases);
+
+	std::vector<unsigned int> want;
+	auto start = std::chrono::steady_clock::now();
+	{
+		std::ifstream is(BENCH_RAW, std::ios::binary);
+		Matrix img(imgDims.rows, imgDims.cols);
+		for (int i = 0; i < STREAM_IMAGES; i++)
+		{
+			is >> img;
+			want.push_back(network(img).value);
+		}
+	}
+	double tSingle = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("stream %d images  operator>> + operator() %9.0f images/s\n", STREAM_IMAGES, STREAM_IMAGES / tSingle);
+
+	bool agree = true;
+	for (int raw = 0; raw < 2; raw++)
+	{
+		std::unique_ptr<ImageStream> stream = raw ? std::make_unique<ImageStream>(BENCH_RAW, size)
+												  : std::make_unique<ImageStream>(BENCH_IMAGES);
+		std::vector<unsigned int> got;
+		Matrix batch;
+		double tRead = timeIt([&]
+							  {
+								  stream->rewind();
+								  while (stream->next(batch, STREAM_BATCH) > 0)
+								  {}
+							  });
+		stream->rewind();
+		start = std::chrono::steady_clock::now();
+		while (stream->next(batch, STREAM_BATCH) > 0)
+		{
+			for (const Digit &d : network.classifyBatch(batch))
+			{
+				got.push_back(d.value);
+			}
+		}
+		double tSerial = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		agree = agree && got == want;
+
+		got.clear();
+		stream->rewind();
+		start = std::chrono::steady_clock::now();
+		{
+			BatchPipeline pipeline(*stream, STREAM_BATCH);
+			while (const Matrix *next = pipeline.next())
+			{
+				for (const Digit &d : network.classifyBatch(*next))
+				{
+					got.push_back(d.value);
+				}
+			}
+		}
+		double tPipelined = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		agree = agree && got == want;
+		printf("stream %-4s read only %9.0f images/s  read then classify %9.0f images/s  pipelined %9.0f "
+			   "images/s x%.2f\n", raw ? "raw" : "idx", STREAM_IMAGES / tRead, STREAM_IMAGES / tSerial,
+			   STREAM_IMAGES / tPipelined, tSingle / tPipelined);
+	}
+	printf("stream digits %s\n", agree ? "identical" : "DIFFER");
+	std::remove(BENCH_IMAGES);
+	std::remove(BENCH_LABELS);
+	std::remove(BENCH_RAW);
+	return agree;
+}
+
+/**
+ * that the compile time shaped network answers as MlpNetwork does
+ * on the same weights and images (it runs the same forward pass,
+ * so there is no speed to compare)
+ * @param count images in the set
+ * @param gen random source
+ * @return true if every answer is identical
+ */
+static bool benchStatic(int count, std::mt19937 &gen)
+{
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	MlpNetwork dynamic(weights, biases);
+	StaticMlpNetwork fixed(weights, biases);
+	int agree = 0;
+	for (int j = 0; j < count; j++)
+	{
+		Matrix img(imgDims.rows * imgDims.cols, 1);
+		randomFill(img, gen);
+		Digit want = dynamic(img);
+		Digit got = fixed(StaticMlpNetwork::Image(img));
+		agree += want.value == got.value && want.probability == got.probability;
+	}
+	printf("static mlp  identical %d/%d\n", agree, count);
+	return agree == count;
+}
+
+/**
+ * single images and batches through the instrumented network: with
+ * make PROFILE=1 the sections are written to PROFILE_JSON and the
+ * scopes of a few calls to PROFILE_TRACE, otherwise only the time
+ * per image is printed, to compare the two builds
+ * @param count images
+ * @param gen random source
+ */
+static void benchProfile(int count, std::mt19937 &gen)
+{
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	MlpNetwork mlp(weights, biases);
+	Matrix image(imgDims.rows * imgDims.cols, 1);
+	randomFill(image, gen);
+	Matrix images(imgDims.rows * imgDims.cols, SPARSE_BATCH);
+	randomFill(images, gen);
+
+	resetProfile();
+	double t = timeIt([&]
+					  {
+						  for (int i = 0; i < count; i++)
+						  {
+							  mlp(image);
+						  }
+					  });
+	printf("profile %-8s %8.1f ns/image", profileEnabled() ? "on" : "off", t / count * 1e9);
+	if (!profileEnabled())
+	{
+		printf("  (make PROFILE=1 to write %s and %s)\n", PROFILE_JSON, PROFILE_TRACE);
+		return;
+	}
+	setProfileTracing(true);
+	for (int i = 0; i < 10; i++)
+	{
+		mlp(image);
+		mlp.classifyBatch(images);
+	}
+	setProfileTracing(false);
+	bool written = writeProfileJson(PROFILE_JSON) && writeProfileTrace(PROFILE_TRACE);
+	printf("  %s %s and %s\n", written ? "wrote" : "could not write", PROFILE_JSON, PROFILE_TRACE);
+}
+
+/**
+ * bulk binary and text io of a IO_DIM x IO_DIM matrix against the
+ * stream paths they replace (a read or write per float, a formatted
+ * << with endl per row, a >> per value), each run once since a run
+ * is long: MB/s of the matrix, and whether the bulk paths and a
+ * byte swap there and back give back the very same floats
+ * @param gen random source
+ * @return true if they do
+ */
+static bool benchMatrixIo(std::mt19937 &gen)
+{
+	Matrix m(IO_DIM, IO_DIM);
+	randomFill(m, gen);
+	double mb = (double) IO_DIM * IO_DIM * sizeof(float) / (1 << 20);
+	Matrix back(IO_DIM, IO_DIM, MatrixUninitialized);
+
+	double tWriteEach = timeOnce([&]
+								 {
+									 std::ofstream os(BENCH_MATRIX_BIN, std::ios::binary);
+									 for (int i = 0; i < IO_DIM * IO_DIM; i++)
+									 {
+										 os.write((const char *) &m[i], sizeof(float));
+									 }
+								 });
+	double tWrite = timeOnce([&]
+							 {
+								 std::ofstream os(BENCH_MATRIX_BIN, std::ios::binary);
+								 writeBinary(os, m);
+							 });
+	double tReadEach = timeOnce([&]
+								{
+									std::ifstream is(BENCH_MATRIX_BIN, std::ios::binary);
+									for (int i = 0; i < IO_DIM * IO_DIM; i++)
+									{
+										is.read((char *) &back[i], sizeof(float));
+									}
+								});
+	double tRead = timeOnce([&]
+							{
+								std::ifstream is(BENCH_MATRIX_BIN, std::ios::binary);
+								readBinary(is, back);
+							});
+	bool same = std::equal(m.data(), m.data() + IO_DIM * IO_DIM, back.data());
+	double tSwap = timeOnce([&]
+							{
+								std::ofstream os(BENCH_MATRIX_BIN, std::ios::binary);
+								writeBinary(os, m, true);
+								os.close();
+								std::ifstream is(BENCH_MATRIX_BIN, std::ios::binary);
+								readBinary(is, back, true);
+							});
+	same = same && std::equal(m.data(), m.data() + IO_DIM * IO_DIM, back.data());
+	printf("matrix io %.0fMB binary  write per float %6.0f MB/s  bulk %6.0f MB/s  x%-5.1f"
+		   "read per float %6.0f MB/s  bulk %6.0f MB/s  x%-5.1f swapped write+read %6.0f MB/s  identical %s\n",
+		   mb, mb / tWriteEach, mb / tWrite, tWriteEach / tWrite, mb / tReadEach, mb / tRead, tReadEach / tRead,
+		   2 * mb / tSwap, same ? "yes" : "NO");
+
+	double tPrint = timeOnce([&]
+							 {
+								 std::ofstream os(BENCH_MATRIX_TXT);
+								 for (int i = 0; i < IO_DIM; i++)
+								 {
+									 for (int j = 0; j < IO_DIM; j++)
+									 {
+										 os << m(i, j) << " ";
+									 }
+									 os << std::endl;
+								 }
+							 });
+	double tScan = timeOnce([&]
+							{
+								std::ifstream is(BENCH_MATRIX_TXT);
+								for (int i = 0; i < IO_DIM * IO_DIM; i++)
+								{
+									is >> back[i];
+								}
+							});
+	double tCsv = timeOnce([&]
+						   {
+							   std::ofstream os(BENCH_MATRIX_TXT);
+							   writeCsv(os, m);
+						   });
+	double tParse = timeOnce([&]
+							 {
+								 std::ifstream is(BENCH_MATRIX_TXT);
+								 back = readCsv(is);
+							 });
+	bool exact = back.getRows() == IO_DIM && back.getCols() == IO_DIM &&
+				 std::equal(m.data(), m.data() + IO_DIM * IO_DIM, back.data());
+	printf("matrix io %.0fMB text    write << endl   %6.0f MB/s  to_chars %6.0f MB/s  x%-5.1f"
+		   "read >>        %6.0f MB/s  from_chars %6.0f MB/s  x%-5.1f round trip exact %s\n",
+		   mb, mb / tPrint, mb / tCsv, tPrint / tCsv, mb / tScan, mb / tParse, tScan / tParse, exact ? "yes" : "NO");
+	std::remove(BENCH_MATRIX_BIN);
+	std::remove(BENCH_MATRIX_TXT);
+	return same && exact;
+}
+
+/**
+ * buffer pool reuse of steady state classifyBatch calls, whose
+ * layer temporaries should all come back from the free lists
+ * @param count images per batch
+ * @param gen random source
+ * @return true if the calls took no buffer from the system
+ * and every matrix buffer was aligned
+ */
+static bool benchPool(int count, std::mt19937 &gen)
+{
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	MlpNetwork mlp(weights, biases);
+	Matrix images(imgDims.rows * imgDims.cols, count);
+	randomFill(images, gen);
+
+	mlp.classifyBatch(images);
+	resetPoolStats();
+	for (int i = 0; i < POOL_CHECK_CALLS; i++)
+	{
+		mlp.classifyBatch(images);
+	}
+	PoolStats stats = poolStats();
+	bool aligned = true;
+	for (int i = 0; i < MLP_SIZE; i++)
+	{
+		aligned = aligned && (size_t) weights[i].data() % POOL_ALIGN == 0;
+		aligned = aligned && (size_t) (weights[i] * images).data() % POOL_ALIGN == 0;
+		images = weights[i] * images;
+	}
+	printf("pool batch %-4d per call: %5.1f buffers  %5.1f reused  %5.1f from the system  %s\n", count,
+		   (double) stats.requests / POOL_CHECK_CALLS, (double) stats.reuses / POOL_CHECK_CALLS,
+		   (double) stats.systemAllocations / POOL_CHECK_CALLS, aligned ? "aligned" : "NOT ALIGNED");
+	return stats.systemAllocations == 0 && aligned;
+}
+
+/**
+ * classify from several threads on one const MlpNetwork at once
+ * and compare every digit with the single thread result
+ * @param gen random source
+ * @return true if every thread got the same digits
+ */
+static bool benchShared(std::mt19937 &gen)
+{
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	const MlpNetwork mlp(weights, biases);
+	std::vector<Matrix> images(SHARED_IMAGES);
+	std::vector<unsigned int> expected(SHARED_IMAGES);
+	for (int j = 0; j < SHARED_IMAGES; j++)
+	{
+		images[j] = Matrix(imgDims.rows * imgDims.cols, 1);
+		randomFill(images[j], gen);
+		expected[j] = mlp(images[j]).value;
+	}
+	std::vector<int> wrong(SHARED_THREADS, 0);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < SHARED_THREADS; t++)
+	{
+		threads.emplace_back([&, t]
+							 {
+								 for (int j = 0; j < SHARED_IMAGES; j++)
+								 {
+									 wrong[t] += mlp(images[j]).value != expected[j];
+								 }
+							 });
+	}
+	int total = 0;
+	for (int t = 0; t < SHARED_THREADS; t++)
+	{
+		threads[t].join();
+		total += wrong[t];
+	}
+	printf("mlp shared by %d threads  %d images each  %d wrong digits\n", SHARED_THREADS, SHARED_IMAGES, total);
+	return total == 0;
+}
+
+/**
+ * count heap allocations of steady state MlpNetwork::operator() calls
+ * @param gen random source
+ * @return true if the calls did not allocate
+ */
+static bool benchAllocations(std::mt19937 &gen)
+{
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	randomNetwork(weights, biases, gen);
+	MlpNetwork mlp(weights, biases);
+	Matrix img(imgDims.rows * imgDims.cols, 1);
+	randomFill(img, gen);
+
+	mlp(img);
+	long before = allocations;
+	for (int i = 0; i < ALLOC_CHECK_CALLS; i++)
+	{
+		mlp(img);
+	}
+	long count = allocations - before;
+	double t = timeIt([&]
+					  { mlp(img); });
+	printf("mlp single %10.0f images/s  heap allocations per call %g\n", 1 / t,
+		   (double) count / ALLOC_CHECK_CALLS);
+	return count == 0;
+}
+
+/**
+ * a * 0.5 + b evaluated lazily in one pass against
+ * the two eager passes and temporaries it used to take
+ * @param len number of elements
+ * @param gen random source
+ */
+static void benchExpressions(int len, std::mt19937 &gen)
+{
+	Matrix a(len, 1);
+	Matrix b(len, 1);
+	randomFill(a, gen);
+	randomFill(b, gen);
+	Matrix out(len, 1);
+
+	double tEager = timeIt([&]
+						   {
+							   Matrix scaled = a * 0.5f;
+							   Matrix sum = scaled + b;
+							   out = sum;
+						   });
+	double tFused = timeIt([&]
+						   { out = a * 0.5f + b; });
+	printf("expression a*0.5+b n=%-8d eager %8.1f us  fused %8.1f us  x%.1f\n",
+		   len, tEager * 1e6, tFused * 1e6, tEager / tFused);
+}
+
+/**
+ * a thread count parameter: powers of 2 up to the hardware's (at least 2)
+ * @return the counts
+ */
+static std::vector<int> suiteThreads()
+{
+	std::vector<int> counts;
+	int maxThreads = std::max(2, (int) std::thread::hardware_concurrency());
+	for (int threads = 1; threads <= maxThreads; threads *= 2)
+	{
+		counts.push_back(threads);
+	}
+	return counts;
+}
+
+/**
+ * register the parameterized suite run by "bench --suite": the products
+ * of every weightsDims shape by batches of images, square products and
+ * classifyBatch over the thread counts, every activation, every Dense
+ * layer and the whole network on single images
+ */
+static void registerSuite()
+{
+	for (int i = 0; i < MLP_SIZE; i++)
+	{
+		int rows = weightsDims[i].rows;
+		int cols = weightsDims[i].cols;
+		for (int batch : SUITE_BATCHES)
+		{
+			registerBenchmark("matmul/" + std::to_string(rows) + "x" + std::to_string(cols) + "/batch:" +
+							  std::to_string(batch), [=](BenchState &state)
+							  {
+								  std::mt19937 gen(SUITE_SEED);
+								  Matrix w(rows, cols);
+								  Matrix x(cols, batch);
+								  randomFill(w, gen);
+								  randomFill(x, gen);
+								  Matrix y(rows, batch);
+								  while (state.keepRunning())
+								  {
+									  gemm(w.view(), x.view(), y.view());
+								  }
+								  state.setItems(batch);
+								  state.setFlops(2.0 * rows * cols * batch);
+							  });
+		}
+		registerBenchmark("dense/" + std::to_string(rows) + "x" + std::to_string(cols) + "/" +
+						  (i == MLP_SIZE - 1 ? "softmax" : "relu"), [=](BenchState &state)
+						  {
+							  std::mt19937 gen(SUITE_SEED);
+							  Matrix w(rows, cols);
+							  Matrix b(rows, 1);
+							  Matrix in(cols, 1);
+							  randomFill(w, gen);
+							  randomFill(b, gen);
+							  randomFill(in, gen);
+							  Dense layer(std::move(w), std::move(b), i == MLP_SIZE - 1 ? Softmax : Relu);
+							  Matrix out(rows, 1);
+							  while (state.keepRunning())
+							  {
+								  layer.forward(in.data(), out.data());
+							  }
+							  state.setItems(1);
+							  state.setFlops(2.0 * rows * cols);
+							  state.setBytes((double) rows * cols * sizeof(float));
+						  });
+	}
+
+	for (int dim : SUITE_SQUARE_DIMS)
+	{
+		for (int threads : suiteThreads())
+		{
+			registerBenchmark("gemm/" + std::to_string(dim) + "/threads:" + std::to_string(threads),
+							  [=](BenchState &state)
+							  {
+								  std::mt19937 gen(SUITE_SEED);
+								  Matrix a(dim, dim);
+								  Matrix b(dim, dim);
+								  randomFill(a, gen);
+								  randomFill(b, gen);
+								  Matrix c(dim, dim);
+								  ThreadPool::global().setThreads(threads);
+								  while (state.keepRunning())
+								  {
+									  gemm(a.view(), b.view(), c.view());
+								  }
+								  ThreadPool::global().setThreads((int) std::thread::hardware_concurrency());
+								  state.setFlops(2.0 * dim * dim * dim);
+								  state.setCounter("threads", threads);
+							  });
+		}
+	}
+
+	for (int type = 0; type < activationCount(); type++)
+	{
+		for (int len : SUITE_ACTIVATION_LENS)
+		{
+			registerBenchmark(std::string("activation/") + activationInfo((ActivationType) type).name + "/len:" +
+							  std::to_string(len), [=](BenchState &state)
+							  {
+								  std::mt19937 gen(SUITE_SEED);
+								  std::uniform_real_distribution<float> dist(-ACTIVATION_RANGE, ACTIVATION_RANGE);
+								  std::vector<float> in(len);
+								  std::vector<float> out(len);
+								  for (float &v : in)
+								  {
+									  v = dist(gen);
+								  }
+								  Activation activation((ActivationType) type);
+								  while (state.keepRunning())
+								  {
+									  std::copy(in.begin(), in.end(), out.begin());
+									  activation.apply(out.data(), len);
+								  }
+								  state.setItems(len);
+							  });
+		}
+	}
+
+	registerBenchmark("mlp/latency", [](BenchState &state)
+	{
+		std::mt19937 gen(SUITE_SEED);
+		Matrix weights[MLP_SIZE];
+		Matrix biases[MLP_SIZE];
+		randomNetwork(weights, biases, gen);
+		MlpNetwork mlp(weights, biases);
+		Matrix image(imgDims.rows * imgDims.cols, 1);
+		randomFill(image, gen);
+		while (state.keepRunning())
+		{
+			mlp(image);
+		}
+		state.setItems(1);
+	});
+	for (int batch : SUITE_BATCHES)
+	{
+		for (int threads : suiteThreads())
+		{
+			registerBenchmark("mlp/batch:" + std::to_string(batch) + "/threads:" + std::to_string(threads),
+							  [=](BenchState &state)
+							  {
+								  std::mt19937 gen(SUITE_SEED);
+								  Matrix weights[MLP_SIZE];
+								  Matrix biases[MLP_SIZE];
+								  randomNetwork(weights, biases, gen);
+								  MlpNetwork mlp(weights, biases);
+								  Matrix images(imgDims.rows * imgDims.cols, batch);
+								  randomFill(images, gen);
+								  ThreadPool::global().setThreads(threads);
+								  while (state.keepRunning())
+								  {
+									  mlp.classifyBatch(images);
+								  }
+								  ThreadPool::global().setThreads((int) std::thread::hardware_concurrency());
+								  state.setItems(batch);
+								  state.setCounter("threads", threads);
+							  });
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && std::strcmp(argv[1], SUITE_ARG) == 0)
+	{
+		registerSuite();
+		return runBenchmarks(argc - 2, argv + 2);
+	}
+	std::mt19937 gen(42);
+	benchGemm(128, 1, 784, gen);
+	benchGemm(128, 64, 784, gen);
+	benchGemm(128, 256, 784, gen);
+	benchGemm(256, 256, 256, gen);
+	benchGemm(512, 512, 512, gen);
+	benchViews(128, 64, 784, gen);
+	benchTranspose(784, 128, gen);
+	benchTranspose(1024, 1024, gen);
+	benchMultiplyTransposed(128, 1, 784, gen);
+	benchMultiplyTransposed(128, 256, 784, gen);
+	benchViews(512, 512, 512, gen);
+	benchThreads(128, 1, 784, gen);
+	benchThreads(128, 256, 784, gen);
+	benchThreads(4096, 1, 4096, gen);
+	benchThreads(1024, 1024, 1024, gen);
+	bool fast = benchStrassen(1023, gen) && benchStrassen(4096, gen);
+	benchElementwise(128, gen);
+	benchElementwise(1 << 16, gen);
+	benchExpressions(1 << 16, gen);
+	benchExpressions(1 << 22, gen);
+	benchDenseModes(gen);
+	benchSoftmax(10, gen);
+	benchSoftmax(1000, gen);
+	bool accurate = benchActivations(1 << 12, gen);
+	for (float density : {0.05f, 0.1f, 0.2f, 0.3f, 0.5f})
+	{
+		benchSparse(density, false, gen);
+		benchSparse(density, true, gen);
+	}
+	benchBatch(1, gen);
+	benchBatch(16, gen);
+	benchBatch(64, gen);
+	benchBatch(256, gen);
+	benchQuantized(1000, gen);
+	benchHalf(1000, gen);
+	benchStartup(gen);
+	bool planned = benchDepth(4, gen) && benchDepth(8, gen) && benchDepth(16, gen);
+	bool typed = benchStatic(1000, gen);
+	bool trained = benchGradient(gen);
+	benchTraining(OptimizerSgd, gen);
+	benchTraining(OptimizerAdam, gen);
+	bool streamed = benchStream(gen);
+	benchProfile(10000, gen);
+	bool stored = benchMatrixIo(gen);
+	bool pooled = benchPool(64, gen);
+	bool shared = benchShared(gen);
+	return benchAllocations(gen) && shared && fast && stored && pooled && accurate && planned && typed && trained && streamed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,163 @@
+// mlpconvert.cpp
+// converts raw weight and bias files into one model file, either for the
+// default topology (four weight and four bias files) or for any network
+// described by a manifest
+
+#include "ModelFile.h"
+#include "MlpNetwork.h"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define ARGS_NUM (2 * MLP_SIZE + 2)
+#define MANIFEST_ARGS_NUM 3
+#define USAGE_MSG "Usage: mlpconvert w1 w2 w3 w4 b1 b2 b3 b4 out.model\n" \
+                  "       mlpconvert net.manifest out.model"
+#define FILE_ERR_MSG "Error: invalid input file "
+#define MANIFEST_ERR_MSG "Error: bad manifest line "
+// separates a file from the byte offset of a tensor in it
+#define OFFSET_SEP ':'
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+/**
+ * read one raw float matrix file. without an offset the file must
+ * hold exactly the values, with one it must hold them from there
+ * @param path the file
+ * @param matrix the matrix to fill, already shaped
+ * @param offset byte offset of the values, -1 for none
+ */
+static void readRaw(const char *path, Matrix &matrix, long offset = -1)
+{
+	std::ifstream is(path, std::ios::binary | std::ios::ate);
+	long expected = (long) sizeof(float) * matrix.getRows() * matrix.getCols();
+	long size = is.is_open() ? (long) is.tellg() : -1;
+	if (size < 0 || (offset < 0 ? size != expected : offset + expected > size))
+	{
+		cerr << FILE_ERR_MSG << path << endl;
+		exit(EXIT_FAILURE);
+	}
+	is.seekg(offset < 0 ? 0 : offset, std::ios_base::beg);
+	is.read((char *) matrix.data(), expected);
+	if (!is)
+	{
+		cerr << FILE_ERR_MSG << path << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * read a tensor named in a manifest as file or file:offset
+ * @param source the name
+ * @param matrix the matrix to fill, already shaped
+ * @return false if the offset is not a number
+ */
+static bool readSource(const string &source, Matrix &matrix)
+{
+	size_t sep = source.rfind(OFFSET_SEP);
+	if (sep == string::npos)
+	{
+		readRaw(source.c_str(), matrix);
+		return true;
+	}
+	char *end = nullptr;
+	long offset = std::strtol(source.c_str() + sep + 1, &end, 10);
+	if (sep + 1 == source.size() || *end != '\0' || offset < 0)
+	{
+		return false;
+	}
+	readRaw(source.substr(0, sep).c_str(), matrix, offset);
+	return true;
+}
+
+/**
+ * convert a manifest: one layer per line, in order,
+ *     outputs inputs activation weights[:offset] bias[:offset]
+ * e.g. "128 784 relu w1" and so on; offsets are in bytes, so several
+ * tensors can come from one file. empty lines and lines starting
+ * with # are skipped. exits on a bad line or file
+ * @param manifest the manifest file
+ * @param out the model file to write
+ */
+static void convertManifest(const char *manifest, const char *out)
+{
+	std::ifstream is(manifest);
+	if (!is.is_open())
+	{
+		cerr << FILE_ERR_MSG << manifest << endl;
+		exit(EXIT_FAILURE);
+	}
+	std::vector<Matrix> weights;
+	std::vector<Matrix> biases;
+	std::vector<ActivationType> activations;
+	string line;
+	for (int number = 1; std::getline(is, line); number++)
+	{
+		std::istringstream fields(line);
+		string first;
+		if (!(fields >> first) || first[0] == '#')
+		{
+			continue;
+		}
+		fields.str(line);
+		fields.clear();
+		int rows = 0;
+		int cols = 0;
+		string name, weightSource, biasSource, extra;
+		ActivationType type = Relu;
+		bool valid = (bool) (fields >> rows >> cols >> name >> weightSource >> biasSource) && !(fields >> extra) &&
+					 rows > 0 && cols > 0 && findActivation(name.c_str(), &type);
+		if (valid)
+		{
+			weights.emplace_back(rows, cols);
+			biases.emplace_back(rows, 1);
+			activations.push_back(type);
+			valid = readSource(weightSource, weights.back()) && readSource(biasSource, biases.back());
+		}
+		if (!valid)
+		{
+			cerr << MANIFEST_ERR_MSG << number << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (weights.empty())
+	{
+		cerr << FILE_ERR_MSG << manifest << endl;
+		exit(EXIT_FAILURE);
+	}
+	writeModel(out, weights.data(), biases.data(), activations.data(), (int) weights.size());
+}
+
+/**
+ * the converter
+ * @param argc ARGS_NUM or MANIFEST_ARGS_NUM
+ * @param argv weight files, bias files, output file; or manifest, output file
+ * @return EXIT_SUCCESS
+ */
+int main(int argc, char **argv)
+{
+	if (argc == MANIFEST_ARGS_NUM)
+	{
+		convertManifest(argv[1], argv[2]);
+		return EXIT_SUCCESS;
+	}
+	if (argc != ARGS_NUM)
+	{
+		cerr << USAGE_MSG << endl;
+		return EXIT_FAILURE;
+	}
+	Matrix weights[MLP_SIZE];
+	Matrix biases[MLP_SIZE];
+	for (int i = 0; i < MLP_SIZE; i++)
+	{
+		weights[i] = Matrix(weightsDims[i].rows, weightsDims[i].cols);
+		biases[i] = Matrix(biasDims[i].rows, biasDims[i].cols);
+		readRaw(argv[1 + i], weights[i]);
+		readRaw(argv[1 + MLP_SIZE + i], biases[i]);
+	}
+	writeModel(argv[ARGS_NUM - 1], weights, biases, mlpActivations, MLP_SIZE);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+// mlpload.cpp
+// load generator for mlpserve: client threads each keep a number of
+// random images in flight on their own connection, then the end to end
+// latency percentiles and the throughput are printed
+
+#include "InferenceServer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <thread>
+#include <unistd.h>
+
+#define MIN_ARGS_NUM 4
+#define MAX_ARGS_NUM 5
+#define USAGE_MSG "Usage: mlpload unix:<path>|tcp:<port> clients requests-per-client [in flight per client]"
+#define REPLY_ERR_MSG "Error: the server closed the connection"
+// different random images, sent round robin
+#define LOAD_IMAGES 16
+
+using std::cerr;
+using std::endl;
+using Clock = std::chrono::steady_clock;
+
+/**
+ * one client: send requests keeping inFlight of them unanswered
+ * @param address the server
+ * @param requests requests to send
+ * @param inFlight the most unanswered requests
+ * @param seed of the images
+ * @param latencies gets the microseconds of every request
+ */
+static void runClient(const char *address, int requests, int inFlight, unsigned int seed,
+					  std::vector<float> *latencies)
+{
+	int size = imgDims.rows * imgDims.cols;
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<float> pixel(0, 1);
+	std::vector<float> images((size_t) LOAD_IMAGES * size);
+	for (float &p : images)
+	{
+		p = pixel(gen);
+	}
+	int fd = connectTo(address);
+	std::queue<Clock::time_point> sent;
+	int next = 0;
+	for (int done = 0; done < requests; done++)
+	{
+		while (next < requests && (int) sent.size() < inFlight)
+		{
+			sent.push(Clock::now());
+			sendAll(fd, images.data() + (size_t) (next % LOAD_IMAGES) * size, size * sizeof(float));
+			next++;
+		}
+		ServerReply reply;
+		if (!receiveAll(fd, &reply, sizeof(reply)))
+		{
+			cerr << REPLY_ERR_MSG << endl;
+			exit(EXIT_FAILURE);
+		}
+		latencies->push_back(std::chrono::duration<float, std::micro>(Clock::now() - sent.front()).count());
+		sent.pop();
+	}
+	close(fd);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < MIN_ARGS_NUM || argc > MAX_ARGS_NUM)
+	{
+		cerr << USAGE_MSG << endl;
+		return EXIT_FAILURE;
+	}
+	int clients = std::max(1, std::atoi(argv[2]));
+	int requests = std::max(1, std::atoi(argv[3]));
+	int inFlight = argc > 4 ? std::max(1, std::atoi(argv[4])) : 1;
+	std::vector<std::vector<float>> latencies(clients);
+	std::vector<std::thread> threads;
+	Clock::time_point start = Clock::now();
+	for (int c = 0; c < clients; c++)
+	{
+		threads.emplace_back(runClient, argv[1], requests, inFlight, (unsigned int) c, &latencies[c]);
+	}
+	for (std::thread &t : threads)
+	{
+		t.join();
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	std::vector<float> all;
+	for (const std::vector<float> &client : latencies)
+	{
+		all.insert(all.end(), client.begin(), client.end());
+	}
+	printf("%d clients x %d requests, %d in flight each: %.0f requests/s  p50 %.1f us  p99 %.1f us\n", clients,
+		   requests, inFlight, all.size() / seconds, latencyPercentile(all, 0.5), latencyPercentile(all, 0.99));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+// mlpserve.cpp
+// serves a model file on a socket with micro-batching (see InferenceServer)
+// until SIGINT or SIGTERM, then prints what it served
+
+#include "InferenceServer.h"
+#include "ModelFile.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#define MIN_ARGS_NUM 3
+#define MAX_ARGS_NUM 5
+#define USAGE_MSG "Usage: mlpserve net.model unix:<path>|tcp:<port> [max batch [max wait us]]"
+#define DEFAULT_MAX_BATCH 64
+#define DEFAULT_MAX_WAIT_MICROS 200
+
+using std::cerr;
+using std::endl;
+
+int main(int argc, char **argv)
+{
+	if (argc < MIN_ARGS_NUM || argc > MAX_ARGS_NUM)
+	{
+		cerr << USAGE_MSG << endl;
+		return EXIT_FAILURE;
+	}
+	ServerConfig config = {DEFAULT_MAX_BATCH, DEFAULT_MAX_WAIT_MICROS};
+	if (argc > 3)
+	{
+		config.maxBatch = std::atoi(argv[3]);
+	}
+	if (argc > 4)
+	{
+		config.maxWaitMicros = std::atoi(argv[4]);
+	}
+	// blocked before the server threads start, so they inherit it and
+	// only sigwait below sees the signals
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	MappedModel model(argv[1]);
+	MlpNetwork network(model);
+	InferenceServer server(network, argv[2], config);
+	printf("serving %s on %s  max batch %d  max wait %d us\n", argv[1], argv[2], config.maxBatch,
+		   config.maxWaitMicros);
+	fflush(stdout);
+	int signal;
+	sigwait(&signals, &signal);
+	server.stop();
+	ServerStats stats = server.stats();
+	printf("served %ld requests in %ld batches (mean %.1f) over %.1f s  p50 %.1f us  p99 %.1f us\n",
+		   stats.requests, stats.batches, stats.batches ? (double) stats.requests / stats.batches : 0.0,
+		   stats.seconds, stats.p50Micros, stats.p99Micros);
+	return EXIT_SUCCESS;
+}